@@ -29,11 +29,11 @@ LOCAL_C_INCLUDES += external/stlport/stlport/ \
 ifdef NCURES
 LOCAL_SRC_FILES += \
 	powerdebug.c sensor.c clocks.c regulator.c \
-	display.c tree.c utils.c mainloop.c gpio.c
+	display.c tree.c arena.c snapshot.c utils.c uring.c attr.c uevent.c mainloop.c history.c ftrace.c row.c gpio.c
 else
 LOCAL_SRC_FILES += \
 	powerdebug.c sensor.c clocks.c regulator.c \
-	tree.c utils.c mainloop.c gpio.c
+	tree.c arena.c snapshot.c utils.c uring.c attr.c uevent.c mainloop.c history.c ftrace.c row.c gpio.c
 
 endif
 include $(BUILD_EXECUTABLE)
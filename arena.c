@@ -0,0 +1,183 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/* Size of the chunks, the bigger blocks get a chunk of their own */
+#define ARENA_CHUNK_SIZE 65536
+
+static inline size_t arena_round(size_t size)
+{
+	return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/*
+ * Initialize an empty arena, no memory is allocated until the first
+ * block.
+ *
+ * @arena : the arena to be initialized
+ */
+void arena_init(struct arena *arena)
+{
+	memset(arena, 0, sizeof(*arena));
+}
+
+/*
+ * Allocate a block of memory in an arena, a block freed with the same
+ * size class is reused first.
+ *
+ * @arena : the arena
+ * @size  : the size of the block
+ * Returns a zeroed block on success, NULL otherwise
+ */
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk = arena->chunks;
+	size_t class, csize;
+	void *ptr;
+
+	size = arena_round(size ? size : 1);
+
+	class = size / ARENA_ALIGN - 1;
+	if (class < ARENA_CLASSES && arena->freelist[class]) {
+		ptr = arena->freelist[class];
+		arena->freelist[class] = *(void **)ptr;
+		return memset(ptr, 0, size);
+	}
+
+	if (!chunk || chunk->used + size > chunk->size) {
+
+		csize = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+
+		chunk = calloc(1, sizeof(*chunk) + csize);
+		if (!chunk)
+			return NULL;
+
+		chunk->size = csize;
+
+		/* keep filling the current chunk after a big block */
+		if (size > ARENA_CHUNK_SIZE && arena->chunks) {
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		} else {
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+		}
+	}
+
+	ptr = chunk->data + chunk->used;
+	chunk->used += size;
+
+	return ptr;
+}
+
+/*
+ * Copy a string in an arena.
+ *
+ * @arena : the arena
+ * @s     : the string to be copied
+ * Returns the copy on success, NULL otherwise
+ */
+char *arena_strdup(struct arena *arena, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *str;
+
+	str = arena_alloc(arena, len);
+	if (str)
+		memcpy(str, s, len);
+
+	return str;
+}
+
+/*
+ * Give back a block to an arena, the block is kept to be reused by an
+ * allocation of the same size class, the memory is only released with
+ * the arena.
+ *
+ * @arena : the arena
+ * @ptr   : the block, ignored if NULL
+ * @size  : the size given when the block was allocated
+ */
+void arena_free(struct arena *arena, void *ptr, size_t size)
+{
+	size_t class;
+
+	if (!ptr)
+		return;
+
+	class = arena_round(size ? size : 1) / ARENA_ALIGN - 1;
+	if (class >= ARENA_CLASSES)
+		return;
+
+	*(void **)ptr = arena->freelist[class];
+	arena->freelist[class] = ptr;
+}
+
+/*
+ * Move the memory of an arena to another one, the blocks allocated in
+ * the first arena are then freed with the second one. This is used to
+ * gather the arenas filled separately by several threads.
+ *
+ * @arena : the arena receiving the memory
+ * @from  : the arena to be emptied
+ */
+void arena_merge(struct arena *arena, struct arena *from)
+{
+	struct arena_chunk *chunk;
+	void *ptr;
+	int i;
+
+	while (from->chunks) {
+		chunk = from->chunks;
+		from->chunks = chunk->next;
+
+		/* the current chunk of the arena stays at the head */
+		if (arena->chunks) {
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		} else {
+			chunk->next = NULL;
+			arena->chunks = chunk;
+		}
+	}
+
+	for (i = 0; i < ARENA_CLASSES; i++) {
+		while (from->freelist[i]) {
+			ptr = from->freelist[i];
+			from->freelist[i] = *(void **)ptr;
+			*(void **)ptr = arena->freelist[i];
+			arena->freelist[i] = ptr;
+		}
+	}
+}
+
+/*
+ * Free all the memory of an arena at once.
+ *
+ * @arena : the arena to be destroyed
+ */
+void arena_destroy(struct arena *arena)
+{
+	struct arena_chunk *chunk;
+
+	while (arena->chunks) {
+		chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+
+	memset(arena->freelist, 0, sizeof(arena->freelist));
+}
@@ -0,0 +1,53 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+#include <stddef.h>
+
+/* Alignment of the blocks allocated in an arena */
+#define ARENA_ALIGN 16
+
+/* Number of size classes of the freed blocks kept for reuse */
+#define ARENA_CLASSES 64
+
+/*
+ * Structure describing a chunk of memory of an arena
+ *
+ * next : the next chunk of the arena
+ * size : the size of the data
+ * used : the number of bytes of the data already allocated
+ * data : the memory given to the blocks
+ */
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+/*
+ * Structure describing an arena, the blocks are allocated one after
+ * the other in big chunks and are all freed at once with the arena
+ *
+ * chunks   : the list of chunks, the current one first
+ * freelist : the blocks freed with arena_free, by size class
+ */
+struct arena {
+	struct arena_chunk *chunks;
+	void *freelist[ARENA_CLASSES];
+};
+
+extern void arena_init(struct arena *arena);
+extern void *arena_alloc(struct arena *arena, size_t size);
+extern char *arena_strdup(struct arena *arena, const char *s);
+extern void arena_free(struct arena *arena, void *ptr, size_t size);
+extern void arena_merge(struct arena *arena, struct arena *from);
+extern void arena_destroy(struct arena *arena);
@@ -0,0 +1,369 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <limits.h>
+
+#include "attr.h"
+#include "row.h"
+#include "tree.h"
+#include "utils.h"
+
+/*
+ * Look for the biggest unit keeping a frequency greater than one.
+ *
+ * @r   : the frequency in Hz
+ * @div : a pointer to store the number of Hz in the returned unit
+ * Returns the name of the unit
+ */
+static inline const char *attr_rate(uint64_t r, uint64_t *div)
+{
+	/* GHZ */
+	if (r >= 1000000000) {
+		*div = 1000000000;
+		return "GHZ";
+	}
+
+	/* MHZ */
+	if (r >= 1000000) {
+		*div = 1000000;
+		return "MHZ";
+	}
+
+	/* KHZ */
+	if (r >= 1000) {
+		*div = 1000;
+		return "KHZ";
+	}
+
+	*div = 1;
+	return "HZ";
+}
+
+/*
+ * Build the bitmap of the attributes having one of the flags.
+ *
+ * @attrs : the description of the attributes
+ * @nr    : the number of attributes
+ * @flags : ATTR_* flags
+ * Returns the bitmap of the attributes
+ */
+attr_mask_t attr_mask(const struct attr *attrs, int nr, int flags)
+{
+	attr_mask_t mask = 0;
+	int i;
+
+	for (i = 0; i < nr && i < ATTR_MAX; i++)
+		if (attrs[i].flags & flags)
+			mask |= 1UL << i;
+
+	return mask;
+}
+
+/*
+ * Compute a key of the description of the attributes, which changes
+ * when an attribute is added, removed or moved, so a bitmap saved with
+ * another description is not used.
+ *
+ * @attrs : the description of the attributes
+ * @nr    : the number of attributes
+ * Returns the key
+ */
+unsigned int attr_key(const struct attr *attrs, int nr)
+{
+	unsigned int key = 2166136261u;
+	const char *s;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		for (s = attrs[i].name; *s; s++)
+			key = (key ^ (unsigned char)*s) * 16777619u;
+		key = (key ^ '/') * 16777619u;
+	}
+
+	return key;
+}
+
+/*
+ * Look for the attribute files of a node, the attributes not provided
+ * by the node are then never read again.
+ *
+ * @t     : the node containing the attribute files
+ * @attrs : the description of the attributes
+ * @nr    : the number of attributes
+ * @mask  : the bitmap of the attributes to look for
+ * Returns the bitmap of the attributes present
+ */
+attr_mask_t attr_probe(struct tree *t, const struct attr *attrs, int nr,
+		       attr_mask_t mask)
+{
+	attr_mask_t present = 0;
+	int i;
+
+	for (i = 0; i < nr && i < ATTR_MAX; i++) {
+
+		if (!(mask & (1UL << i)))
+			continue;
+
+		if (!tree_access(t, attrs[i].name))
+			present |= 1UL << i;
+	}
+
+	return present;
+}
+
+/*
+ * Queue the reads of the attributes of a node, the values are stored in
+ * the private structure when file_batch_submit is called.
+ *
+ * @t     : the node containing the attribute files
+ * @attrs : the description of the attributes
+ * @nr    : the number of attributes
+ * @info  : the private structure of the node
+ * @mask  : the bitmap of the attributes to be read
+ * Returns 0 on success, -1 otherwise
+ */
+int attr_batch(struct tree *t, const struct attr *attrs, int nr,
+	       void *info, attr_mask_t mask)
+{
+	int i;
+
+	for (i = 0; i < nr && i < ATTR_MAX; i++) {
+
+		if (!(mask & (1UL << i)))
+			continue;
+
+		if (tree_batch_value(t, attrs[i].name, attrs[i].type,
+				     (char *)info + attrs[i].offset,
+				     attrs[i].size))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Format a value of the type of an attribute.
+ *
+ * @buf   : the buffer to store the string
+ * @size  : the size of the buffer
+ * @attr  : the description of the attribute
+ * @value : a pointer to the value
+ * Returns the length of the string, as snprintf does
+ */
+int attr_format_value(char *buf, size_t size, const struct attr *attr,
+		      const void *value)
+{
+	const char *unit;
+	uint64_t div;
+
+	switch (attr->type) {
+	case VALUE_INT:
+		return snprintf(buf, size, "%d", *(int *)value);
+	case VALUE_HEX:
+		return snprintf(buf, size, "0x%x", *(unsigned int *)value);
+	case VALUE_U64:
+		if (!(attr->flags & ATTR_HZ))
+			return snprintf(buf, size, "%" PRIu64,
+					*(uint64_t *)value);
+		unit = attr_rate(*(uint64_t *)value, &div);
+		return snprintf(buf, size, "%g%s",
+				(double)*(uint64_t *)value / div, unit);
+	case VALUE_STRING:
+		return snprintf(buf, size, "%s", (char *)value);
+	}
+
+	return snprintf(buf, size, "?");
+}
+
+/*
+ * Append a value of the type of an attribute to a line, as
+ * attr_format_value does.
+ *
+ * @row   : the line
+ * @attr  : the description of the attribute
+ * @value : a pointer to the value
+ */
+void attr_row_value(struct row *row, const struct attr *attr,
+		    const void *value)
+{
+	const char *unit;
+	uint64_t div;
+
+	switch (attr->type) {
+	case VALUE_INT:
+		row_int(row, *(int *)value);
+		return;
+	case VALUE_HEX:
+		row_hex(row, *(unsigned int *)value);
+		return;
+	case VALUE_U64:
+		if (!(attr->flags & ATTR_HZ)) {
+			row_u64(row, *(uint64_t *)value);
+			return;
+		}
+		unit = attr_rate(*(uint64_t *)value, &div);
+		row_ratio(row, *(uint64_t *)value, div);
+		row_str(row, unit);
+		return;
+	case VALUE_STRING:
+		row_str(row, value);
+		return;
+	}
+
+	row_str(row, "?");
+}
+
+/*
+ * Format the value of an attribute.
+ *
+ * @buf  : the buffer to store the string
+ * @size : the size of the buffer
+ * @attr : the description of the attribute
+ * @info : the private structure containing the value
+ * Returns the length of the string, as snprintf does
+ */
+int attr_format(char *buf, size_t size, const struct attr *attr, void *info)
+{
+	return attr_format_value(buf, size, attr, (char *)info + attr->offset);
+}
+
+/*
+ * Append a column to a line, the line is truncated to the size of the
+ * buffer.
+ */
+static int attr_column(char *buf, size_t size, int len,
+		       const char *str, int width)
+{
+	if (len >= size)
+		return len;
+
+	return len + snprintf(buf + len, size - len, "%-*s ", width, str);
+}
+
+/*
+ * Format the names of the columns of the attributes displayed.
+ *
+ * @buf   : the buffer to store the line
+ * @size  : the size of the buffer
+ * @attrs : the description of the attributes
+ * @nr    : the number of attributes
+ * Returns the length of the line
+ */
+int attr_header(char *buf, size_t size, const struct attr *attrs, int nr)
+{
+	int i, len = 0;
+
+	for (i = 0; i < nr; i++)
+		if (attrs[i].flags & ATTR_SHOW)
+			len = attr_column(buf, size, len, attrs[i].header,
+					  attrs[i].width);
+	return len;
+}
+
+/*
+ * Append the values of the attributes displayed as columns to a line,
+ * the attributes not present are shown as '-'.
+ *
+ * @row     : the line
+ * @attrs   : the description of the attributes
+ * @nr      : the number of attributes
+ * @info    : the private structure containing the values
+ * @present : the bitmap of the attributes present
+ */
+void attr_line(struct row *row, const struct attr *attrs, int nr,
+	       void *info, attr_mask_t present)
+{
+	int i, start;
+
+	for (i = 0; i < nr; i++) {
+
+		if (!(attrs[i].flags & ATTR_SHOW))
+			continue;
+
+		start = row->len;
+
+		if (i < ATTR_MAX && (present & (1UL << i)))
+			attr_row_value(row, &attrs[i],
+				       (char *)info + attrs[i].offset);
+		else
+			row_str(row, "-");
+
+		row_pad(row, start, attrs[i].width);
+	}
+}
+
+const struct attr_style attr_style_inline = {
+	.prefix = "",
+	.delim  = ":",
+	.suffix = "",
+	.sep    = ", ",
+};
+
+const struct attr_style attr_style_lines = {
+	.prefix = "\t",
+	.delim  = ": ",
+	.suffix = "\n",
+	.sep    = "",
+};
+
+/*
+ * Print an entry of a dump, the strings of the style are not formats.
+ *
+ * @style : how the entry is printed
+ * @name  : the name of the entry
+ * @value : the value of the entry
+ */
+void attr_dump_entry(const struct attr_style *style, const char *name,
+		     const char *value)
+{
+	printf("%s%s%s%s%s", style->prefix, name, style->delim, value,
+	       style->suffix);
+}
+
+/*
+ * Print the attributes to be dumped on the standard output, the
+ * attributes not present are skipped.
+ *
+ * @attrs   : the description of the attributes
+ * @nr      : the number of attributes
+ * @info    : the private structure containing the values
+ * @present : the bitmap of the attributes present
+ * @style   : how the attributes are printed
+ */
+void attr_dump(const struct attr *attrs, int nr, void *info,
+	       attr_mask_t present, const struct attr_style *style)
+{
+	char value[NAME_MAX];
+	bool first = true;
+	int i;
+
+	for (i = 0; i < nr && i < ATTR_MAX; i++) {
+
+		if (!(attrs[i].flags & ATTR_DUMP))
+			continue;
+
+		if (!(present & (1UL << i)))
+			continue;
+
+		attr_format(value, sizeof(value), &attrs[i], info);
+
+		printf("%s", first ? "" : style->sep);
+		attr_dump_entry(style, attrs[i].name, value);
+
+		first = false;
+	}
+}
@@ -0,0 +1,124 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+#include <stddef.h>
+
+struct tree;
+struct row;
+
+/* Size of the short string attributes */
+#define VALUE_MAX 16
+
+/* The attribute is displayed as a column of the panel */
+#define ATTR_SHOW	0x1
+/* The attribute is printed by the dump */
+#define ATTR_DUMP	0x2
+/* The attribute is a frequency displayed with its unit */
+#define ATTR_HZ		0x4
+/* The value does not change, it is read once when the node is filled */
+#define ATTR_STATIC	0x8
+
+#define ATTR_SHOW_DUMP	(ATTR_SHOW | ATTR_DUMP)
+
+/*
+ * Bitmap of the attributes of a node, the bit n stands for the entry n
+ * of the table describing the attributes
+ */
+typedef unsigned long attr_mask_t;
+
+#define ATTR_MAX (sizeof(attr_mask_t) * 8)
+
+/*
+ * Structure describing an attribute file of a node and the field of
+ * the private structure of the node where its value is stored
+ *
+ * name   : the name of the attribute file
+ * header : the name of the column in the panel
+ * offset : the offset of the field in the private structure
+ * size   : the size of the field
+ * type   : the type of the value, VALUE_*
+ * width  : the width of the column in the panel
+ * flags  : ATTR_* flags
+ */
+struct attr {
+	const char *name;
+	const char *header;
+	size_t offset;
+	size_t size;
+	int type;
+	int width;
+	int flags;
+};
+
+/*
+ * The attributes of a subsystem are described once with a list of
+ *
+ *   X(field, type, ctype, dim, header, width, flags)
+ *
+ * where ctype and dim give the declaration of the field. The list is
+ * expanded with ATTR_FIELD to declare the fields of the private
+ * structure and with ATTR_DESC to build the array of struct attr.
+ */
+#define ATTR_FIELD(field, vtype, ctype, dim, title, w, fl)	\
+	ctype field dim;
+
+#define ATTR_DESC(st, field, vtype, ctype, dim, title, w, fl)	\
+	{							\
+		.name   = #field,				\
+		.header = title,				\
+		.offset = offsetof(struct st, field),		\
+		.size   = sizeof(((struct st *)0)->field),	\
+		.type   = vtype,				\
+		.width  = w,					\
+		.flags  = fl,					\
+	},
+
+#define ATTR_COUNT(attrs) (sizeof(attrs) / sizeof(attrs[0]))
+
+/*
+ * Structure describing how the attributes are dumped, an attribute is
+ * printed as <prefix><name><delim><value><suffix>, with sep between two
+ * attributes
+ */
+struct attr_style {
+	const char *prefix;
+	const char *delim;
+	const char *suffix;
+	const char *sep;
+};
+
+/* The attributes on one line, "name:value, name:value" */
+extern const struct attr_style attr_style_inline;
+
+/* An attribute per line, indented with a tab */
+extern const struct attr_style attr_style_lines;
+
+extern attr_mask_t attr_mask(const struct attr *attrs, int nr, int flags);
+extern unsigned int attr_key(const struct attr *attrs, int nr);
+extern attr_mask_t attr_probe(struct tree *t, const struct attr *attrs, int nr,
+			      attr_mask_t mask);
+extern int attr_batch(struct tree *t, const struct attr *attrs, int nr,
+		      void *info, attr_mask_t mask);
+extern int attr_format_value(char *buf, size_t size, const struct attr *attr,
+			     const void *value);
+extern void attr_row_value(struct row *row, const struct attr *attr,
+			   const void *value);
+extern int attr_format(char *buf, size_t size, const struct attr *attr,
+		       void *info);
+extern int attr_header(char *buf, size_t size,
+		       const struct attr *attrs, int nr);
+extern void attr_line(struct row *row, const struct attr *attrs, int nr,
+		      void *info, attr_mask_t present);
+extern void attr_dump_entry(const struct attr_style *style, const char *name,
+			    const char *value);
+extern void attr_dump(const struct attr *attrs, int nr, void *info,
+		      attr_mask_t present, const struct attr_style *style);
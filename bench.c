@@ -0,0 +1,1195 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#undef _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "display.h"
+#include "regulator.h"
+#include "clocks.h"
+#include "sensor.h"
+#include "gpio.h"
+#include "tree.h"
+#include "snapshot.h"
+#include "utils.h"
+#include "fixture.h"
+#include "history.h"
+#include "attr.h"
+#include "row.h"
+
+/* Number of refreshes measured for each read method */
+#define BENCH_LOOPS 20
+
+/* Number of loads measured for each scan method */
+#define BENCH_SCAN_LOOPS 5
+
+/* Number of values parsed for each parser */
+#define BENCH_PARSE_LOOPS 1000000
+
+/* Number of times the lines of the clocks are formatted */
+#define BENCH_RENDER_LOOPS 20
+
+struct bench_clock {
+	int flags;
+	uint64_t rate;
+	float frate;
+	int usecount;
+};
+
+static struct bench_clock *clocks;
+static int nrclocks;
+
+/* The columns of the clock panel, to format the lines of the clocks */
+#define BENCH_ATTRS(X)							\
+	X(flags,    VALUE_HEX, int,      , "Flags",    16, ATTR_SHOW)	\
+	X(rate,     VALUE_U64, uint64_t, , "Rate",     12,		\
+	  ATTR_SHOW | ATTR_HZ)						\
+	X(usecount, VALUE_INT, int,      , "Usecount",  9, ATTR_SHOW)
+
+#define BENCH_DESC(...) ATTR_DESC(bench_clock, __VA_ARGS__)
+
+static const struct attr bench_attrs[] = {
+	BENCH_ATTRS(BENCH_DESC)
+};
+
+static struct fixture fixture = {
+	.clocks     = 10000,
+	.fanout     = 8,
+	.depth      = 8,
+	.regulators = 200,
+	.sensors    = 16,
+	.channels   = 16,
+	.gpios      = 128,
+};
+
+/*
+ * The subsystems are built with the text based interface, the panels
+ * are rendered in memory by the functions below instead of ncurses, so
+ * the rendering measured is the formatting of the lines.
+ */
+static struct display_ops *bench_ops[GPIO + 1];
+static struct row bench_rows[GPIO + 1];
+static size_t bench_rendered;
+static int bench_lines;
+
+int display_register(int win, struct display_ops *ops)
+{
+	bench_ops[win] = ops;
+
+	return 0;
+}
+
+struct row *display_row(int win)
+{
+	row_reset(&bench_rows[win]);
+
+	return &bench_rows[win];
+}
+
+int display_print_line(int win, int line, struct row *row, int bold,
+		       void *data)
+{
+	bench_rendered += row->len;
+	bench_lines++;
+
+	return 0;
+}
+
+int display_column_name(const char *line)
+{
+	bench_rendered += strlen(line);
+
+	return 0;
+}
+
+int display_refresh_pad(int win)
+{
+	return 0;
+}
+
+int display_reset_cursor(int win)
+{
+	return 0;
+}
+
+int display_update(int win)
+{
+	return 0;
+}
+
+void *display_get_row_data(int win)
+{
+	return NULL;
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int bench_index_cb(struct tree *t, void *data)
+{
+	/* the root directory is not a clock */
+	if (t->parent)
+		t->private = &clocks[nrclocks++];
+
+	return 0;
+}
+
+/*
+ * Close the attribute files cached by a benchmark, so the next ones
+ * start with the whole file descriptor budget.
+ */
+static int bench_close_cb(struct tree *t, void *data)
+{
+	file_close_cached(&t->handles);
+
+	return 0;
+}
+
+/*
+ * The way the attributes were read before the cache and the typed
+ * parsers, kept here as the reference.
+ */
+static int bench_fscanf_value(const char *path, const char *name,
+			      const char *format, void *value)
+{
+	char rpath[PATH_MAX];
+	FILE *file;
+	int ret;
+
+	snprintf(rpath, sizeof(rpath), "%s/%s", path, name);
+
+	file = fopen(rpath, "r");
+	if (!file)
+		return -1;
+
+	ret = fscanf(file, format, value) == EOF ? -1 : 0;
+
+	fclose(file);
+
+	return ret;
+}
+
+static int bench_legacy_cb(struct tree *t, void *data)
+{
+	struct bench_clock *clk = t->private;
+
+	if (!clk)
+		return 0;
+
+	bench_fscanf_value(t->path, "flags", "%x", &clk->flags);
+	bench_fscanf_value(t->path, "rate", "%f", &clk->frate);
+	bench_fscanf_value(t->path, "usecount", "%d", &clk->usecount);
+
+	return 0;
+}
+
+static int bench_read_cb(struct tree *t, void *data)
+{
+	struct bench_clock *clk = t->private;
+
+	if (!clk)
+		return 0;
+
+	file_read_value(t->path, "flags", VALUE_HEX, &clk->flags,
+			sizeof(clk->flags));
+	file_read_value(t->path, "rate", VALUE_U64, &clk->rate,
+			sizeof(clk->rate));
+	file_read_value(t->path, "usecount", VALUE_INT, &clk->usecount,
+			sizeof(clk->usecount));
+
+	return 0;
+}
+
+static int bench_cached_cb(struct tree *t, void *data)
+{
+	struct bench_clock *clk = t->private;
+
+	if (!clk)
+		return 0;
+
+	tree_read_value(t, "flags", VALUE_HEX, &clk->flags,
+			sizeof(clk->flags));
+	tree_read_value(t, "rate", VALUE_U64, &clk->rate, sizeof(clk->rate));
+	tree_read_value(t, "usecount", VALUE_INT, &clk->usecount,
+			sizeof(clk->usecount));
+
+	return 0;
+}
+
+static int bench_batch_cb(struct tree *t, void *data)
+{
+	struct bench_clock *clk = t->private;
+
+	if (!clk)
+		return 0;
+
+	tree_batch_value(t, "flags", VALUE_HEX, &clk->flags,
+			 sizeof(clk->flags));
+	tree_batch_value(t, "rate", VALUE_U64, &clk->rate, sizeof(clk->rate));
+	tree_batch_value(t, "usecount", VALUE_INT, &clk->usecount,
+			 sizeof(clk->usecount));
+
+	return 0;
+}
+
+/*
+ * Compare the typed parsers with sscanf on the content of typical
+ * attribute files.
+ */
+static void bench_parse(void)
+{
+	static const struct {
+		const char *label;
+		const char *content;
+		const char *format;
+		int type;
+	} samples[] = {
+		{ "u64 (rate)",      "1200000000\n",      "%lu", VALUE_U64    },
+		{ "hex (flags)",     "0x3\n",             "%x",  VALUE_HEX    },
+		{ "int (microvolt)", "-1800000\n",        "%d",  VALUE_INT    },
+		{ "string (name)",   "regulator-dummy\n", "%s",  VALUE_STRING },
+	};
+	char value[64];
+	double start, scanf_ns, parse_ns;
+	int i, j;
+
+	printf("\nparsing of %d values\n", BENCH_PARSE_LOOPS);
+
+	for (i = 0; i < sizeof(samples) / sizeof(samples[0]); i++) {
+
+		start = bench_now();
+		for (j = 0; j < BENCH_PARSE_LOOPS; j++)
+			sscanf(samples[i].content, samples[i].format, value);
+		scanf_ns = (bench_now() - start) * 1e3 / BENCH_PARSE_LOOPS;
+
+		start = bench_now();
+		for (j = 0; j < BENCH_PARSE_LOOPS; j++)
+			parse_value(samples[i].content, samples[i].type,
+				    value, sizeof(value));
+		parse_ns = (bench_now() - start) * 1e3 / BENCH_PARSE_LOOPS;
+
+		printf("%-24s sscanf %6.1f ns  parser %6.1f ns\n",
+		       samples[i].label, scanf_ns, parse_ns);
+	}
+}
+
+static void bench_run(const char *label, struct tree *tree,
+		      tree_cb_t cb, bool batch)
+{
+	double start, elapsed;
+	int i;
+
+	/* warm up, the caches are filled at the first read */
+	tree_for_each(tree, cb, NULL);
+	if (batch)
+		file_batch_submit();
+
+	start = bench_now();
+
+	for (i = 0; i < BENCH_LOOPS; i++) {
+		tree_for_each(tree, cb, NULL);
+		if (batch)
+			file_batch_submit();
+	}
+
+	elapsed = (bench_now() - start) / BENCH_LOOPS;
+
+	printf("%-24s %10.0f us/refresh %8.2f us/node\n", label,
+	       elapsed, elapsed / nrclocks);
+}
+
+static void bench_subsystem(const char *label, int win, const char *path,
+			    bool follow, int (*init)(void))
+{
+	struct display_ops *ops;
+	struct tree *tree;
+	double start, load, fill, refresh, render;
+	int i;
+
+	start = bench_now();
+	tree = tree_load(path, NULL, follow);
+	if (!tree) {
+		printf("%-10s failed to load %s\n", label, path);
+		return;
+	}
+	load = bench_now() - start;
+
+	/* only the load is timed, the subsystem loads its own tree */
+	tree_destroy(tree);
+
+	start = bench_now();
+	if (init()) {
+		printf("%-10s failed to initialize\n", label);
+		return;
+	}
+	fill = bench_now() - start;
+
+	ops = bench_ops[win];
+
+	start = bench_now();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		ops->display(false);
+	render = (bench_now() - start) / BENCH_LOOPS;
+
+	start = bench_now();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		ops->display(true);
+	refresh = (bench_now() - start) / BENCH_LOOPS - render;
+	if (refresh < 0)
+		refresh = 0;
+
+	printf("%-10s %10.0f %10.0f %10.0f %10.0f\n", label,
+	       load, fill, refresh, render);
+}
+
+static void bench_subsystems(const char *root)
+{
+	char path[PATH_MAX];
+
+	printf("\n%-10s %10s %10s %10s %10s (us)\n", "subsystem",
+	       "tree_load", "init", "refresh", "render");
+
+	snprintf(path, sizeof(path), "%s/sys/kernel/debug/clock", root);
+	bench_subsystem("clock", CLOCK, path, false, clock_init);
+
+	snprintf(path, sizeof(path), "%s/sys/class/regulator", root);
+	bench_subsystem("regulator", REGULATOR, path, true,
+			regulator_init);
+
+	snprintf(path, sizeof(path), "%s/sys/class/hwmon", root);
+	/* the hwmon devices make loops of links */
+	bench_subsystem("sensor", SENSOR, path, true, sensor_init);
+
+	snprintf(path, sizeof(path), "%s/sys/class/gpio", root);
+	bench_subsystem("gpio", GPIO, path, true, gpio_init);
+}
+
+/*
+ * Format the line of a clock with snprintf, column after column, as
+ * the panels did before the lines were formatted in a struct row.
+ */
+static int bench_snprintf_cb(struct tree *t, void *data)
+{
+	char buf[ROW_MAX], value[NAME_MAX];
+	size_t size = sizeof(buf);
+	int i, len;
+
+	if (!t->parent)
+		return 0;
+
+	len = snprintf(buf, size, "%*s%-*s ", (t->depth - 1) * 2, "",
+		       55 - (t->depth - 1) * 2, t->name);
+
+	for (i = 0; i < ATTR_COUNT(bench_attrs) && len < size; i++) {
+		attr_format(value, sizeof(value), &bench_attrs[i], t->private);
+		len += snprintf(buf + len, size - len, "%-*s ",
+				bench_attrs[i].width, value);
+	}
+
+	if (len < size)
+		len += snprintf(buf + len, size - len, "%-8d", t->nrchild);
+
+	bench_rendered += len < size ? len : size - 1;
+
+	return 0;
+}
+
+static int bench_row_cb(struct tree *t, void *data)
+{
+	struct row *row = data;
+	int start;
+
+	if (!t->parent)
+		return 0;
+
+	row_reset(row);
+	row_chars(row, ' ', (t->depth - 1) * 2);
+	row_column(row, t->name, 55 - (t->depth - 1) * 2);
+	attr_line(row, bench_attrs, ATTR_COUNT(bench_attrs), t->private, ~0UL);
+
+	start = row->len;
+	row_int(row, t->nrchild);
+	row_chars(row, ' ', start + 8 - row->len);
+
+	bench_rendered += row->len;
+
+	return 0;
+}
+
+/*
+ * Measure the formatting of the lines of the clocks with snprintf and
+ * with the formatter of the panels, then the render of the clock panel
+ * showing all the clocks found by their prefix.
+ */
+static void bench_render(struct tree *tree)
+{
+	struct row row;
+	size_t rendered;
+	double start, elapsed;
+	int i;
+
+	printf("\nrender of %d rows\n", nrclocks);
+
+	bench_rendered = 0;
+	start = bench_now();
+	for (i = 0; i < BENCH_RENDER_LOOPS; i++)
+		tree_for_each(tree, bench_snprintf_cb, NULL);
+	elapsed = (bench_now() - start) / BENCH_RENDER_LOOPS;
+	rendered = bench_rendered;
+
+	printf("%-24s %10.0f us/render %8.1f ns/row\n", "snprintf",
+	       elapsed, elapsed * 1e3 / nrclocks);
+
+	bench_rendered = 0;
+	start = bench_now();
+	for (i = 0; i < BENCH_RENDER_LOOPS; i++)
+		tree_for_each(tree, bench_row_cb, &row);
+	elapsed = (bench_now() - start) / BENCH_RENDER_LOOPS;
+
+	printf("%-24s %10.0f us/render %8.1f ns/row\n", "row",
+	       elapsed, elapsed * 1e3 / nrclocks);
+
+	if (bench_rendered != rendered)
+		printf("%-24s %zu bytes rendered instead of %zu\n", "row",
+		       bench_rendered, rendered);
+
+	if (clock_init()) {
+		printf("%-24s failed to initialize\n", "clock");
+		return;
+	}
+
+	/* the first search builds the index of the names */
+	bench_ops[CLOCK]->find("clk", TREE_FIND_PREFIX);
+
+	bench_lines = 0;
+	start = bench_now();
+	for (i = 0; i < BENCH_RENDER_LOOPS; i++)
+		bench_ops[CLOCK]->find("clk", TREE_FIND_PREFIX);
+	elapsed = (bench_now() - start) / BENCH_RENDER_LOOPS;
+
+	if (!bench_lines)
+		return;
+
+	printf("%-24s %10.0f us/render %8.1f ns/row\n", "clock panel",
+	       elapsed, elapsed * 1e3 * BENCH_RENDER_LOOPS / bench_lines);
+}
+
+/*
+ * Measure the initialization of a subsystem, with the snapshots in a
+ * directory or without snapshot.
+ */
+static double bench_init(int (*init)(void), const char *dir)
+{
+	double start;
+
+	snapshot_set_dir(dir);
+
+	start = bench_now();
+	if (init())
+		return -1;
+
+	return bench_now() - start;
+}
+
+static void bench_start(const char *label, const char *dir,
+			int (*init)(void))
+{
+	double browsed = 0, cached = 0, elapsed;
+	int i;
+
+	/* the first start saves the snapshot */
+	if (bench_init(init, dir) < 0) {
+		printf("%-10s failed to initialize\n", label);
+		return;
+	}
+
+	/* the trees of the previous starts are still there, alternate */
+	for (i = 0; i < 3; i++) {
+
+		elapsed = bench_init(init, "");
+		if (!browsed || elapsed < browsed)
+			browsed = elapsed;
+
+		elapsed = bench_init(init, dir);
+		if (!cached || elapsed < cached)
+			cached = elapsed;
+	}
+
+	printf("%-10s %10.0f %10.0f %6.2fx\n", label, browsed, cached,
+	       browsed / cached);
+}
+
+static unsigned long bench_mask_cb(struct tree *t)
+{
+	return 0;
+}
+
+/*
+ * Check a directory added below the root directory after the snapshot
+ * was saved is found by the next load, which has to browse the tree.
+ * The time of the parent is set back, as debugfs does not update it.
+ */
+static void bench_tree_added(const char *path)
+{
+	struct snapshot *snap;
+	struct tree *tree, *t;
+	char parent[PATH_MAX], added[PATH_MAX];
+	struct timespec times[2];
+	struct stat s;
+	int len;
+
+	tree = snapshot_load("bench", path, 0, NULL, false, &snap);
+	if (!tree)
+		return;
+
+	if (!snap || !tree->child) {
+		printf("%-10s failed to load the snapshot\n", "tree");
+		tree_destroy(tree);
+		return;
+	}
+
+	len = snprintf(parent, sizeof(parent), "%s", tree->child->path);
+
+	snapshot_save(snap, "bench", tree, 0, bench_mask_cb);
+	tree_destroy(tree);
+
+	if (len >= sizeof(parent) || stat(parent, &s) ||
+	    snprintf(added, sizeof(added), "%s/bench-added",
+		     parent) >= sizeof(added) || mkdir(added, 0755)) {
+		printf("%-10s failed to create a directory\n", "tree");
+		return;
+	}
+
+	times[0] = s.st_atim;
+	times[1] = s.st_mtim;
+	utimensat(AT_FDCWD, parent, times, 0);
+
+	tree = snapshot_load("bench", path, 0, NULL, false, &snap);
+	t = tree ? tree_find(tree, "bench-added") : NULL;
+
+	if (snap || !t || strcmp(t->path, added))
+		printf("%-10s %s not found after the snapshot\n", "tree",
+		       added);
+
+	if (snap)
+		snapshot_save(snap, "bench", tree, 0, bench_mask_cb);
+	if (tree)
+		tree_destroy(tree);
+
+	rmdir(added);
+}
+
+/*
+ * Measure the load of the clock tree alone, without the reads of the
+ * attribute files which come next.
+ */
+static void bench_tree_start(const char *root, const char *dir)
+{
+	struct snapshot *snap;
+	struct tree *tree;
+	char path[PATH_MAX];
+	double start, browsed, cached;
+
+	snprintf(path, sizeof(path), "%s/sys/kernel/debug/clock", root);
+
+	snapshot_set_dir(dir);
+
+	start = bench_now();
+	tree = snapshot_load("bench", path, 0, NULL, false, &snap);
+	browsed = bench_now() - start;
+	if (!tree || snap) {
+		printf("%-10s failed to load %s\n", "tree", path);
+		return;
+	}
+
+	snapshot_save(snap, "bench", tree, 0, bench_mask_cb);
+	tree_destroy(tree);
+
+	start = bench_now();
+	tree = snapshot_load("bench", path, 0, NULL, false, &snap);
+	cached = bench_now() - start;
+	if (!tree || !snap) {
+		printf("%-10s failed to load the snapshot\n", "tree");
+		return;
+	}
+
+	snapshot_save(snap, "bench", tree, 0, bench_mask_cb);
+	tree_destroy(tree);
+
+	printf("%-10s %10.0f %10.0f %6.2fx\n", "clock tree", browsed, cached,
+	       browsed / cached);
+
+	bench_tree_added(path);
+}
+
+/*
+ * Compare the start of the subsystems browsing the directories with the
+ * start from the snapshot saved by the previous run.
+ */
+static void bench_snapshots(const char *root)
+{
+	char dir[PATH_MAX];
+
+	snprintf(dir, sizeof(dir), "%s/cache", root);
+
+	printf("\n%-10s %10s %10s (us)\n", "start", "browsed", "snapshot");
+
+	bench_tree_start(root, dir);
+	bench_start("clock", dir, clock_init);
+	bench_start("regulator", dir, regulator_init);
+
+	snapshot_set_dir("");
+}
+
+/*
+ * Move a file out of the way or put it back.
+ */
+static void bench_rename(const char *dir, const char *name, bool away)
+{
+	char path[PATH_MAX], off[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= sizeof(path) ||
+	    snprintf(off, sizeof(off), "%s/%s.off", dir, name) >= sizeof(off))
+		return;
+
+	if (away)
+		rename(path, off);
+	else
+		rename(off, path);
+}
+
+/*
+ * Compare the refresh of the clocks of the common clock framework read
+ * from clk_summary, from clk_dump and from the attribute files of every
+ * clock. The bulk files are moved away in turn so the clocks fall back
+ * to the next method.
+ */
+static void bench_bulk(const char *root)
+{
+	static const char *files[] = { "clk_summary", "clk_dump" };
+	static const char *labels[] = { "clk_summary", "clk_dump",
+					"attribute files" };
+	struct fixture fx = fixture;
+	char path[PATH_MAX], dir[PATH_MAX];
+	struct display_ops *ops;
+	double start, render, refresh;
+	int i, j;
+
+	fx.ccf = true;
+
+	snprintf(path, sizeof(path), "%s/ccf", root);
+
+	if (fixture_create(path, &fx) || file_set_root(path)) {
+		printf("failed to create the tree in %s\n", path);
+		return;
+	}
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	strncat(dir, "/sys/kernel/debug/clk", sizeof(dir) - strlen(dir) - 1);
+
+	printf("\nrefresh of %d clocks of the common clock framework\n",
+	       fx.clocks);
+
+	if (clock_init()) {
+		printf("%-16s failed to initialize\n", "clock");
+		goto out;
+	}
+
+	ops = bench_ops[CLOCK];
+
+	start = bench_now();
+	for (j = 0; j < BENCH_LOOPS; j++)
+		ops->display(false);
+	render = (bench_now() - start) / BENCH_LOOPS;
+
+	for (i = 0; i < sizeof(labels) / sizeof(labels[0]); i++) {
+
+		start = bench_now();
+		for (j = 0; j < BENCH_LOOPS; j++)
+			ops->display(true);
+		refresh = (bench_now() - start) / BENCH_LOOPS - render;
+
+		printf("%-16s %10.0f us/refresh %8.2f us/node\n", labels[i],
+		       refresh, refresh / fx.clocks);
+
+		if (i >= sizeof(files) / sizeof(files[0]))
+			break;
+
+		bench_rename(dir, files[i], true);
+	}
+
+	for (i = 0; i < sizeof(files) / sizeof(files[0]); i++)
+		bench_rename(dir, files[i], false);
+out:
+	file_set_root(root);
+}
+
+/*
+ * Measure the cost of a sample added to a history, then the refresh of
+ * the clock panel with and without the histories.
+ */
+static void bench_history(void)
+{
+	static const int sizes[] = { 0, 64 };
+	static const uint64_t rates[] = { 24000000, 48000000, 96000000,
+					  192000000, 384000000 };
+	struct display_ops *ops;
+	struct history *h;
+	double start, elapsed, render;
+	int i, j;
+
+	if (history_set_size(64))
+		return;
+
+	h = history_alloc();
+	if (!h)
+		return;
+
+	printf("\nhistory of %d samples, %zu bytes per value\n", h->size,
+	       sizeof(*h) + h->size * sizeof(h->samples[0]));
+
+	start = bench_now();
+	for (j = 0; j < BENCH_PARSE_LOOPS; j++)
+		history_add(h, j * 1000ULL, rates[j % 5], j % 3);
+	elapsed = (bench_now() - start) * 1e3 / BENCH_PARSE_LOOPS;
+
+	printf("%-24s %6.1f ns/sample\n", "history_add", elapsed);
+
+	history_free(h);
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+
+		history_set_size(sizes[i]);
+
+		if (clock_init()) {
+			printf("%-24s failed to initialize\n", "clock");
+			break;
+		}
+
+		ops = bench_ops[CLOCK];
+
+		start = bench_now();
+		for (j = 0; j < BENCH_LOOPS; j++)
+			ops->display(false);
+		render = (bench_now() - start) / BENCH_LOOPS;
+
+		start = bench_now();
+		for (j = 0; j < BENCH_LOOPS; j++)
+			ops->display(true);
+		elapsed = (bench_now() - start) / BENCH_LOOPS - render;
+
+		printf("clock refresh, %2d samples %10.0f us/refresh\n",
+		       sizes[i], elapsed);
+	}
+
+	history_set_size(0);
+}
+
+/*
+ * Type a name character after character then erase it, as the find
+ * mode of the display does, and measure the search of each keystroke.
+ */
+static void bench_search(struct tree *tree, const char *name, int mode)
+{
+	static const char *modes[] = {
+		[TREE_FIND_PREFIX]    = "prefix",
+		[TREE_FIND_SUBSTRING] = "substring",
+		[TREE_FIND_GLOB]      = "glob",
+		[TREE_FIND_FUZZY]     = "fuzzy",
+	};
+	struct tree **ptree;
+	char typed[NAME_MAX + 1] = "";
+	double start, elapsed, first, total = 0, max = 0;
+	int i, j, len = strlen(name), keys = 0, nr = 0;
+
+	/* the first search builds the name tables */
+	start = bench_now();
+	tree_search(tree, "", mode, &ptree);
+	tree_search(tree, name, mode, &ptree);
+	first = bench_now() - start;
+
+	for (i = 0; i < BENCH_LOOPS; i++) {
+
+		for (j = 1; j <= 2 * len; j++, keys++) {
+
+			memcpy(typed, name, j <= len ? j : 2 * len - j);
+			typed[j <= len ? j : 2 * len - j] = '\0';
+
+			start = bench_now();
+			if (tree_search(tree, typed, mode, &ptree) < 0)
+				return;
+			elapsed = bench_now() - start;
+
+			total += elapsed;
+			if (elapsed > max)
+				max = elapsed;
+		}
+	}
+
+	nr = tree_search(tree, name, mode, &ptree);
+
+	printf("tree_search %-9s %-8s %7.1f us/key (max %4.0f us, "
+	       "first %5.0f us) %6d found\n", modes[mode], name,
+	       total / keys, max, first, nr);
+}
+
+/*
+ * Measure the search in the find mode for each kind of match.
+ */
+static void bench_searches(struct tree *tree)
+{
+	bench_search(tree, "clk1234", TREE_FIND_PREFIX);
+	bench_search(tree, "k123", TREE_FIND_SUBSTRING);
+	bench_search(tree, "clk1*4", TREE_FIND_GLOB);
+	bench_search(tree, "c1234", TREE_FIND_FUZZY);
+}
+
+static void bench_finds(struct tree *tree)
+{
+	static const char *names[] = { "clk", "clk1", "clk12", "clk1234", };
+	struct tree **ptree;
+	double start, elapsed;
+	int i, j, nr = 0;
+
+	printf("\n");
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+
+		start = bench_now();
+
+		for (j = 0; j < BENCH_LOOPS; j++) {
+			ptree = NULL;
+			nr = tree_finds(tree, names[i], &ptree);
+			free(ptree);
+		}
+
+		elapsed = (bench_now() - start) / BENCH_LOOPS;
+
+		printf("tree_finds(\"%s\")%*s %10.0f us %8d found\n",
+		       names[i], (int)(12 - strlen(names[i])), "",
+		       elapsed, nr);
+	}
+
+	bench_searches(tree);
+
+	/* the first call builds the name index */
+	start = bench_now();
+	tree_find(tree, "clk1");
+	printf("tree_find index build        %10.0f us\n",
+	       bench_now() - start);
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+
+		start = bench_now();
+
+		for (j = 0; j < BENCH_LOOPS * 1000; j++)
+			tree_find(tree, names[i]);
+
+		elapsed = (bench_now() - start) / (BENCH_LOOPS * 1000);
+
+		printf("tree_find(\"%s\")%*s %10.3f us\n",
+		       names[i], (int)(13 - strlen(names[i])), "", elapsed);
+	}
+}
+
+static int bench_sign_cb(struct tree *t, void *data)
+{
+	unsigned long *sign = data;
+	const char *s;
+
+	for (s = t->name; *s; s++)
+		*sign = *sign * 31 + *s;
+
+	*sign = *sign * 31 + t->depth;
+
+	return 0;
+}
+
+/*
+ * Compute a signature of the structure of a tree, the names and the
+ * depths of the nodes in the order they are browsed.
+ */
+static unsigned long bench_sign(struct tree *tree)
+{
+	unsigned long sign = 0;
+
+	tree_for_each(tree, bench_sign_cb, &sign);
+
+	return sign;
+}
+
+static double bench_load(const char *path, int workers, bool follow,
+			 unsigned long *sign, double *destroy)
+{
+	struct tree *tree;
+	double start, elapsed = 0, freed = 0;
+	int i;
+
+	tree_set_workers(workers);
+
+	for (i = 0; i < BENCH_SCAN_LOOPS; i++) {
+
+		start = bench_now();
+		tree = tree_load(path, NULL, follow);
+		elapsed += bench_now() - start;
+
+		if (!tree) {
+			perror(path);
+			return -1;
+		}
+
+		*sign = bench_sign(tree);
+
+		start = bench_now();
+		tree_destroy(tree);
+		freed += bench_now() - start;
+	}
+
+	if (destroy)
+		*destroy = freed / BENCH_SCAN_LOOPS;
+
+	return elapsed / BENCH_SCAN_LOOPS;
+}
+
+/*
+ * Compare the serial scan with the parallel scan on clock trees of
+ * different sizes.
+ */
+static void bench_scan(const char *root)
+{
+	static const int sizes[] = { 1000, 10000, 100000 };
+	static const int workers[] = { 2, 4, 0 };
+	struct fixture fx = {
+		.fanout = fixture.fanout,
+		.depth  = fixture.depth,
+	};
+	char path[PATH_MAX], label[32];
+	struct tree *tree;
+	unsigned long serial_sign, sign;
+	double serial, elapsed, destroy;
+	int i, j;
+
+	printf("\ntree_load of clock trees (%ld processors)\n",
+	       sysconf(_SC_NPROCESSORS_ONLN));
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+
+		snprintf(path, sizeof(path), "%s/scan-%d", root, sizes[i]);
+
+		fx.clocks = sizes[i];
+		if (fixture_create(path, &fx)) {
+			printf("failed to create the tree in %s\n", path);
+			return;
+		}
+
+		strncat(path, "/sys/kernel/debug/clock",
+			sizeof(path) - strlen(path) - 1);
+
+		serial = bench_load(path, 1, false, &serial_sign, &destroy);
+
+		printf("%6d nodes   serial       %10.0f us (destroy %.0f us)\n",
+		       sizes[i], serial, destroy);
+
+		/* the cost of the directories recorded to cut the loops */
+		elapsed = bench_load(path, 1, true, &sign, NULL);
+
+		printf("%6d nodes   follow       %10.0f us %6.2fx %s\n",
+		       sizes[i], elapsed, serial / elapsed,
+		       sign == serial_sign ? "" : "(differs!)");
+
+		for (j = 0; j < sizeof(workers) / sizeof(workers[0]); j++) {
+
+			elapsed = bench_load(path, workers[j], false, &sign,
+					     NULL);
+
+			if (workers[j])
+				snprintf(label, sizeof(label), "%d threads",
+					 workers[j]);
+			else
+				snprintf(label, sizeof(label), "default");
+
+			printf("%6d nodes   %-12s %10.0f us %6.2fx %s\n",
+			       sizes[i], label, elapsed, serial / elapsed,
+			       sign == serial_sign ? "" : "(differs!)");
+		}
+	}
+
+	tree_set_workers(0);
+
+	/* the find mode on the biggest tree */
+	tree = tree_load(path, NULL, false);
+	if (!tree)
+		return;
+
+	printf("\nsearch in %d nodes\n", sizes[i - 1]);
+	bench_searches(tree);
+
+	tree_destroy(tree);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [OPTIONS]\n", name);
+	printf("  -n <nr>    number of clocks (%d)\n", fixture.clocks);
+	printf("  -f <nr>    children per clock (%d)\n", fixture.fanout);
+	printf("  -D <nr>    depth of the clock tree (%d)\n", fixture.depth);
+	printf("  -r <nr>    number of regulators (%d)\n",
+	       fixture.regulators);
+	printf("  -s <nr>    number of hwmon devices (%d)\n",
+	       fixture.sensors);
+	printf("  -c <nr>    temperature inputs per hwmon device (%d)\n",
+	       fixture.channels);
+	printf("  -g <nr>    number of gpios (%d)\n", fixture.gpios);
+	printf("  -o <dir>   only create the trees in the directory\n");
+	printf("  -L         lay the clocks out as the common clock framework "
+	       "does (with -o)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	char template[] = "/dev/shm/powerdebug-bench.XXXXXX";
+	char path[PATH_MAX];
+	const char *root;
+	char *output = NULL;
+	struct tree *tree;
+	int c, ret = 1;
+
+	while ((c = getopt(argc, argv, "n:f:D:r:s:c:g:o:Lh")) != -1) {
+
+		switch (c) {
+		case 'n':
+			fixture.clocks = atoi(optarg);
+			break;
+		case 'f':
+			fixture.fanout = atoi(optarg);
+			break;
+		case 'D':
+			fixture.depth = atoi(optarg);
+			break;
+		case 'r':
+			fixture.regulators = atoi(optarg);
+			break;
+		case 's':
+			fixture.sensors = atoi(optarg);
+			break;
+		case 'c':
+			fixture.channels = atoi(optarg);
+			break;
+		case 'g':
+			fixture.gpios = atoi(optarg);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'L':
+			fixture.ccf = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	/* the refresh of the clocks is measured with the legacy layout */
+	if (fixture.ccf && !output) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (output) {
+		if (fixture_create(output, &fixture)) {
+			fprintf(stderr, "failed to create the trees in %s\n",
+				output);
+			return 1;
+		}
+		return 0;
+	}
+
+	/* the trees are created in a tmpfs when there is one */
+	root = mkdtemp(template);
+	if (!root) {
+		strcpy(template, "/tmp/powerdebug-bench.XXXXXX");
+		root = mkdtemp(template);
+	}
+	if (!root)
+		return 1;
+
+	if (fixture_create(root, &fixture)) {
+		fprintf(stderr, "failed to create the synthetic trees\n");
+		goto out;
+	}
+
+	snprintf(path, sizeof(path), "%s/sys/kernel/debug/clock", root);
+
+	tree = tree_load(path, NULL, false);
+	if (!tree) {
+		fprintf(stderr, "failed to load the synthetic tree\n");
+		goto out;
+	}
+
+	clocks = calloc(fixture.clocks, sizeof(*clocks));
+	if (!clocks)
+		goto out;
+
+	tree_for_each(tree, bench_index_cb, NULL);
+
+	printf("refresh of %d clocks x 3 attributes\n", nrclocks);
+
+	bench_run("fopen/fscanf", tree, bench_legacy_cb, false);
+	bench_run("open/read/parse", tree, bench_read_cb, false);
+	bench_run("cached pread", tree, bench_cached_cb, false);
+	bench_run("batched", tree, bench_batch_cb, true);
+
+	bench_parse();
+
+	bench_finds(tree);
+
+	tree_for_each(tree, bench_close_cb, NULL);
+
+	if (file_set_root(root))
+		goto out;
+
+	bench_subsystems(root);
+
+	bench_render(tree);
+
+	bench_snapshots(root);
+
+	bench_bulk(root);
+
+	bench_history();
+
+	bench_scan(root);
+
+	ret = 0;
+out:
+	fixture_remove(root);
+
+	return ret;
+}
@@ -23,7 +23,9 @@
 #undef _GNU_SOURCE
 #endif
 #include <string.h>
+#include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/param.h>
@@ -35,70 +37,281 @@
 #include "clocks.h"
 #include "tree.h"
 #include "utils.h"
+#include "attr.h"
+#include "snapshot.h"
+#include "history.h"
+#include "ftrace.h"
+#include "row.h"
+
+/*
+ * Attributes of a clock with the legacy layout:
+ * X(field, type, ctype, dim, header, width, flags)
+ */
+#define CLOCK_ATTRS(X)							\
+	X(flags,    VALUE_HEX, int,      , "Flags",    16, ATTR_SHOW_DUMP |	\
+							   ATTR_STATIC)	\
+	X(rate,     VALUE_U64, uint64_t, , "Rate",     12, ATTR_SHOW_DUMP |	\
+							   ATTR_HZ)	\
+	X(usecount, VALUE_INT, int,      , "Usecount",  9, ATTR_SHOW_DUMP)
+
+/*
+ * Attributes of a clock of the common clock framework, the flags are a
+ * hexadecimal value or the names of the flags depending on the kernel,
+ * they are only dumped
+ */
+#define CCF_ATTRS(X)							\
+	X(clk_rate,          VALUE_U64,    uint64_t, , "Rate",    12,	\
+	  ATTR_SHOW_DUMP | ATTR_HZ)					\
+	X(clk_enable_count,  VALUE_INT,    int,      , "Enable",   7,	\
+	  ATTR_SHOW_DUMP)						\
+	X(clk_prepare_count, VALUE_INT,    int,      , "Prepare",  8,	\
+	  ATTR_SHOW_DUMP)						\
+	X(clk_phase,         VALUE_INT,    int,      , "Phase",    6,	\
+	  ATTR_SHOW_DUMP)						\
+	X(clk_flags,         VALUE_STRING, char, [32], "Flags", 0,	\
+	  ATTR_DUMP | ATTR_STATIC)
 
 struct clock_info {
-	int flags;
-	float rate;
-	int usecount;
+	CLOCK_ATTRS(ATTR_FIELD)
+	CCF_ATTRS(ATTR_FIELD)
+	attr_mask_t present;
 	bool expanded;
 	char *prefix;
+	struct history *history;
 } *clocks_info;
 
+#define CLOCK_DESC(...) ATTR_DESC(clock_info, __VA_ARGS__)
+
+static const struct attr clock_attrs[] = {
+	CLOCK_ATTRS(CLOCK_DESC)
+};
+
+static const struct attr ccf_attrs[] = {
+	CCF_ATTRS(CLOCK_DESC)
+};
+
+/* Maximum number of columns of clk_summary */
+#define CLOCK_BULK_COLUMNS 16
+
+/* Maximum depth of the clocks followed in clk_dump */
+#define CLOCK_BULK_DEPTH 64
+
+/* Size of the buffer the bulk files are read in, it grows up to the max */
+#define CLOCK_BULK_SIZE 65536
+#define CLOCK_BULK_MAX (4 << 20)
+
+/*
+ * Listing all the directories of a nested tree costs more than reading
+ * the values, the tree is reloaded once every few refreshes.
+ */
+#define CLOCK_RELOAD_PERIOD 10
+
+/*
+ * Structure describing a file giving the values of all the clocks at
+ * once, it is read instead of the attribute files of every clock. The
+ * file is parsed in place as it is read, by chunks of complete lines or
+ * JSON members.
+ *
+ * name    : the name of the file in the directory of the clocks
+ * parse   : parse a chunk of the file, returns the length parsed, < 0 if
+ *           the content is not understood
+ * broken  : the content was not understood, the file is not read again
+ * nr      : the number of clocks updated by the current read
+ * rows    : the header of clk_summary is passed
+ * columns : the attribute of each column of clk_summary, -1 if none
+ * depth   : the number of JSON objects opened in clk_dump
+ * stack   : the clock of each JSON object opened, NULL if none
+ */
+struct clock_bulk {
+	const char *name;
+	int (*parse)(struct clock_bulk *bulk, char *buf, size_t len, bool eof);
+	bool broken;
+	int nr;
+	bool rows;
+	int columns[CLOCK_BULK_COLUMNS];
+	int depth;
+	struct tree *stack[CLOCK_BULK_DEPTH];
+};
+
+static int clock_summary_parse(struct clock_bulk *bulk, char *buf,
+			       size_t len, bool eof);
+static int clock_json_parse(struct clock_bulk *bulk, char *buf,
+			    size_t len, bool eof);
+
+/* The text summary is cheaper to parse than the JSON dump */
+static struct clock_bulk ccf_bulks[] = {
+	{ .name = "clk_summary", .parse = clock_summary_parse },
+	{ .name = "clk_dump",    .parse = clock_json_parse },
+};
+
+/*
+ * Structure describing a layout of the clocks in debugfs
+ *
+ * dir   : the directory of the clocks in debugfs, also the name of the
+ *         snapshot of the tree
+ * check : a file found in the directory with this layout only, or NULL
+ * parent : the file giving the name of the parent of a clock when the
+ *          clocks are all in the same directory, or NULL
+ * attrs : the attributes of a clock
+ * nr    : the number of attributes
+ * users : the offset in struct clock_info of the number of users of the
+ *         clock, the clocks in use are shown in bold
+ * rate  : the name of the attribute giving the rate, kept in the history
+ * bulks : the files giving the values of all the clocks, NULL if none
+ * nrbulks : the number of these files
+ */
+struct clock_layout {
+	const char *dir;
+	const char *check;
+	const char *parent;
+	const struct attr *attrs;
+	int nr;
+	size_t users;
+	const char *rate;
+	struct clock_bulk *bulks;
+	int nrbulks;
+};
+
+/* The layouts in the order they are looked for */
+static const struct clock_layout clock_layouts[] = {
+	{ "clk", "clk_summary", "clk_parent", ccf_attrs, ATTR_COUNT(ccf_attrs),
+	  offsetof(struct clock_info, clk_enable_count), "clk_rate",
+	  ccf_bulks, ATTR_COUNT(ccf_bulks) },
+	{ "clock", NULL, NULL, clock_attrs, ATTR_COUNT(clock_attrs),
+	  offsetof(struct clock_info, usecount), "rate", NULL, 0 },
+};
+
+static const struct clock_layout *clock_layout;
+
+/* The attribute whose values are kept in the history of the clocks */
+static const struct attr *clock_rate;
+
+/* The attribute giving the number of users of the clocks */
+static const struct attr *clock_count;
+
 static struct tree *clock_tree = NULL;
 
+/*
+ * The clocks are all in the same directory and their hierarchy is
+ * given by their clk_parent file
+ */
+static bool clock_flat;
+
+/* The number of clocks in the directory when the flat tree was loaded */
+static int clock_nrflat;
+
+/* Number of refreshes since the nested tree was reloaded */
+static int clock_refreshes;
+
+/*
+ * The clocks shown in the panel in preorder, the clocks with all their
+ * parents expanded. The list is built again when the tree is reloaded,
+ * a subtree is spliced in or out when a clock is expanded or collapsed.
+ */
+static struct tree **clock_rows;
+static int clock_nrrows;
+static int clock_maxrows;
+static bool clock_rows_valid;
+
+/* The buffer the bulk files are read in */
+static char *clock_buf;
+static size_t clock_bufsize;
+
+/* Attributes not read again when the clocks are refreshed */
+static attr_mask_t clock_static;
+
+/* Attributes updated from the trace buffers, not read by the refreshes */
+static attr_mask_t clock_traced;
+static bool clock_tracing;
+
+enum { CLOCK_TRACE_RATE, CLOCK_TRACE_ENABLE, CLOCK_TRACE_DISABLE,
+       CLOCK_TRACE_PARENT };
+
+static const char *const clock_name_fields[] = { "name", NULL };
+static const char *const clock_rate_fields[] = { "name", "rate", NULL };
+static const char *const clock_parent_fields[] = { "name", "pname", NULL };
+
+/*
+ * Events of the common clock framework changing a clock, the enables and
+ * the disables are only traced when the count goes from or to zero so
+ * the enable count of a clock only tells if it is enabled while tracing
+ *
+ * name   : the name of the event
+ * fields : the fields of the records, the name of the clock first
+ * action : CLOCK_TRACE_*
+ */
+static const struct clock_event {
+	const char *name;
+	const char *const *fields;
+	int action;
+} clock_events[] = {
+	{ "clk_set_rate_complete",   clock_rate_fields,   CLOCK_TRACE_RATE },
+	{ "clk_enable_complete",     clock_name_fields,   CLOCK_TRACE_ENABLE },
+	{ "clk_disable_complete",    clock_name_fields,   CLOCK_TRACE_DISABLE },
+	{ "clk_set_parent_complete", clock_parent_fields, CLOCK_TRACE_PARENT },
+};
+
 static int locate_debugfs(char *clk_path)
 {
-	strcpy(clk_path, "/sys/kernel/debug");
-	return 0;
+	return file_root_path(clk_path, PATH_MAX, "/sys/kernel/debug");
 }
 
-static struct clock_info *clock_alloc(void)
+static struct clock_info *clock_alloc(struct tree *t)
 {
-	struct clock_info *ci;
-
-	ci = malloc(sizeof(*ci));
-	if (ci)
-		memset(ci, 0, sizeof(*ci));
+	return tree_alloc_private(t, sizeof(struct clock_info));
+}
 
-	return ci;
+static inline int clock_users(struct clock_info *clk)
+{
+	return *(int *)((char *)clk + clock_layout->users);
 }
 
-static inline const char *clock_rate(float *rate)
+/*
+ * Look for the layout of the clocks in debugfs.
+ *
+ * @path : the buffer to store the directory of the clocks
+ * @size : the size of the buffer
+ * Returns the layout found, NULL if there is none
+ */
+static const struct clock_layout *clock_detect(char *path, size_t size)
 {
-        float r;
+	const struct clock_layout *layout;
+	char debugfs[PATH_MAX];
+	char check[PATH_MAX];
+	int i;
+
+	if (locate_debugfs(debugfs))
+		return NULL;
+
+	for (i = 0; i < sizeof(clock_layouts) / sizeof(clock_layouts[0]); i++) {
 
-        /* GHZ */
-        r = *rate ;
-        if (r >= 1000000000) {
-                *rate = r/1000000000;
-                return "GHZ";
-        }
+		layout = &clock_layouts[i];
 
-        /* MHZ */
-	else if (r>=1000000) {
-                *rate = r/1000000;
-                return "MHZ";
-        }
+		if (snprintf(path, size, "%s/%s", debugfs, layout->dir) >= size)
+			return NULL;
 
-        /* KHZ */
-	else if (r>=1000) {
-                *rate = r/1000;
-                return "KHZ";
-        }
-	else 
-                *rate = r;
-                return "HZ";
+		if (!layout->check) {
+			if (!access(path, F_OK))
+				return layout;
+			continue;
+		}
 
-        return "";
+		if (snprintf(check, sizeof(check), "%s/%s", path,
+			     layout->check) >= sizeof(check))
+			return NULL;
+
+		if (!access(check, F_OK))
+			return layout;
+	}
+
+	return NULL;
 }
 
 static int dump_clock_cb(struct tree *t, void *data)
 {
 	struct clock_info *clk = t->private;
 	struct clock_info *pclk;
-	const char *unit;
 	int ret = 0;
-	float rate = clk->rate;
 
 	if (!t->parent) {
 		printf("/\n");
@@ -114,11 +327,18 @@ static int dump_clock_cb(struct tree *t, void *data)
 	if (ret < 0)
 		return -1;
 
-	unit = clock_rate(&rate);
+	printf("%s%s-- %s (", clk->prefix,  !t->next ? "`" : "", t->name);
+	attr_dump(clock_layout->attrs, clock_layout->nr, clk, clk->present,
+		  &attr_style_inline);
+	printf(")");
+
+	if (clk->history) {
+		printf(" [");
+		history_dump(clk->history, clock_rate, &attr_style_inline);
+		printf("]");
+	}
 
-	printf("%s%s-- %s (flags:0x%x, usecount:%d, rate: %f %s)\n",
-	       clk->prefix,  !t->next ? "`" : "", t->name, clk->flags,
-	       clk->usecount, rate, unit);
+	printf("\n");
 
 	return 0;
 }
@@ -141,27 +361,427 @@ static int dump_all_parents(char *clkarg)
 	return tree_for_each_parent(tree, dump_clock_cb, NULL);
 }
 
+/*
+ * Look for an attribute of the clocks which is not read once.
+ *
+ * @name : the name of the attribute
+ * Returns the index of the attribute, -1 if not found
+ */
+static int clock_attr_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < clock_layout->nr && i < ATTR_MAX; i++)
+		if (!strcmp(clock_layout->attrs[i].name, name))
+			return (clock_static | clock_traced) & (1UL << i) ?
+				-1 : i;
+
+	return -1;
+}
+
+/*
+ * Store the value of an attribute of a clock, parsed in place in the
+ * buffer of a bulk file.
+ *
+ * @t     : the node of the clock
+ * @index : the index of the attribute
+ * @s     : the value as found in the file
+ */
+static void clock_attr_set(struct tree *t, int index, const char *s)
+{
+	const struct attr *attr = &clock_layout->attrs[index];
+	struct clock_info *clk = t->private;
+
+	if (!parse_value(s, attr->type, (char *)clk + attr->offset,
+			 attr->size))
+		clk->present |= 1UL << index;
+}
+
+/*
+ * Look for the clock of a name found in a bulk file, the root of the
+ * tree is not a clock.
+ */
+static struct tree *clock_bulk_find(const char *name)
+{
+	struct tree *t = tree_find(clock_tree, name);
+
+	return t && t->parent ? t : NULL;
+}
+
+/*
+ * Parse the header of clk_summary, the line starting with "clock" names
+ * the columns. The counts of enables and prepares come first, named
+ * enable_cnt and prepare_cnt or count under a line giving the names.
+ */
+static void clock_summary_header(struct clock_bulk *bulk, char **tokens,
+				 int nr)
+{
+	int i, counts = 0;
+	const char *name;
+
+	if (nr < 2 || strcmp(tokens[0], "clock"))
+		return;
+
+	for (i = 1; i < nr && i <= CLOCK_BULK_COLUMNS; i++) {
+
+		name = tokens[i];
+
+		if (!strcmp(name, "count") || strstr(name, "_cnt")) {
+			counts++;
+			name = counts == 1 ? "clk_enable_count" :
+			       counts == 2 ? "clk_prepare_count" : NULL;
+		} else if (!strcmp(name, "rate"))
+			name = "clk_rate";
+		else if (!strcmp(name, "phase"))
+			name = "clk_phase";
+		else
+			name = NULL;
+
+		bulk->columns[i - 1] = name ? clock_attr_find(name) : -1;
+	}
+}
+
+/*
+ * Parse a line of clk_summary, the line is split in place.
+ */
+static int clock_summary_line(struct clock_bulk *bulk, char *line)
+{
+	char *tokens[CLOCK_BULK_COLUMNS + 1];
+	struct tree *t;
+	int i, nr = 0;
+
+	while (nr < CLOCK_BULK_COLUMNS + 1) {
+
+		while (*line == ' ' || *line == '\t')
+			line++;
+
+		if (!*line)
+			break;
+
+		tokens[nr++] = line;
+
+		while (*line && *line != ' ' && *line != '\t')
+			line++;
+
+		if (*line)
+			*line++ = '\0';
+	}
+
+	if (!nr)
+		return 0;
+
+	if (!bulk->rows) {
+
+		if (strncmp(tokens[0], "---", 3)) {
+			clock_summary_header(bulk, tokens, nr);
+			return 0;
+		}
+
+		/* the header is not understood */
+		for (i = 0; i < CLOCK_BULK_COLUMNS; i++)
+			if (bulk->columns[i] >= 0)
+				break;
+		if (i == CLOCK_BULK_COLUMNS)
+			return -1;
+
+		bulk->rows = true;
+		return 0;
+	}
+
+	/* the consumers of a clock are listed below it by the new kernels */
+	t = clock_bulk_find(tokens[0]);
+	if (!t)
+		return 0;
+
+	for (i = 1; i < nr; i++)
+		if (bulk->columns[i - 1] >= 0)
+			clock_attr_set(t, bulk->columns[i - 1], tokens[i]);
+
+	bulk->nr++;
+
+	return 0;
+}
+
+/*
+ * Parse the complete lines of a chunk of clk_summary, the clocks are
+ * indented below their parent and followed by their values.
+ */
+static int clock_summary_parse(struct clock_bulk *bulk, char *buf,
+			       size_t len, bool eof)
+{
+	char *line = buf, *end;
+
+	while ((end = memchr(line, '\n', buf + len - line))) {
+
+		*end = '\0';
+
+		if (clock_summary_line(bulk, line))
+			return -1;
+
+		line = end + 1;
+	}
+
+	if (eof && line < buf + len && clock_summary_line(bulk, line))
+		return -1;
+
+	return line - buf;
+}
+
+/*
+ * Parse a JSON member of clk_dump ended by c, either the name of a
+ * clock opening its object or a value of the current clock.
+ */
+static void clock_json_member(struct clock_bulk *bulk, char *member, char c)
+{
+	char name[NAME_MAX];
+	struct tree *t = NULL;
+	char *key = NULL, *end;
+	int index;
+
+	key = strchr(member, '"');
+	if (key) {
+		end = strchr(++key, '"');
+		if (end) {
+			*end = '\0';
+			member = end + 1;
+		} else
+			key = NULL;
+	}
+
+	if (c == '{') {
+
+		if (key) {
+			t = clock_bulk_find(key);
+			if (t)
+				bulk->nr++;
+		}
+
+		if (bulk->depth < CLOCK_BULK_DEPTH)
+			bulk->stack[bulk->depth] = t;
+		bulk->depth++;
+		return;
+	}
+
+	if (key && bulk->depth > 0 && bulk->depth <= CLOCK_BULK_DEPTH) {
+
+		t = bulk->stack[bulk->depth - 1];
+
+		member = strchr(member, ':');
+
+		/* the members are named as the files without the prefix */
+		if (t && member &&
+		    snprintf(name, sizeof(name), "clk_%s", key) < sizeof(name)) {
+			index = clock_attr_find(name);
+			if (index >= 0)
+				clock_attr_set(t, index, member + 1);
+		}
+	}
+
+	if (c == '}' && bulk->depth > 0)
+		bulk->depth--;
+}
+
+/*
+ * Parse the complete JSON members of a chunk of clk_dump, the object of
+ * a clock contains its values then the objects of its children. The
+ * names of the clocks do not contain the structural characters.
+ */
+static int clock_json_parse(struct clock_bulk *bulk, char *buf,
+			    size_t len, bool eof)
+{
+	char *member = buf, *s;
+	bool string = false;
+	char c;
+
+	for (s = buf; s < buf + len; s++) {
+
+		c = *s;
+
+		if (c == '"')
+			string = !string;
+
+		if (string || (c != '{' && c != '}' && c != ','))
+			continue;
+
+		*s = '\0';
+		clock_json_member(bulk, member, c);
+		member = s + 1;
+	}
+
+	return member - buf;
+}
+
+/*
+ * Read the values of all the clocks from a bulk file, the file is read
+ * and parsed by chunks in a buffer growing with the file, so the next
+ * refreshes read it with a single call.
+ *
+ * @bulk : the file to be read
+ * Returns 0 on success, -1 if the file can not be read, -2 if it is not
+ * understood
+ */
+static int clock_bulk_read(struct clock_bulk *bulk)
+{
+	size_t len = 0;
+	ssize_t ret;
+	char *buf;
+	int fd, parsed = 0;
+
+	if (!clock_buf) {
+		clock_buf = malloc(CLOCK_BULK_SIZE);
+		if (!clock_buf)
+			return -1;
+		clock_bufsize = CLOCK_BULK_SIZE;
+	}
+
+	fd = tree_open(clock_tree, bulk->name);
+	if (fd < 0)
+		return -1;
+
+	bulk->nr = 0;
+	bulk->rows = false;
+	bulk->depth = 0;
+	memset(bulk->columns, -1, sizeof(bulk->columns));
+
+	for (;;) {
+
+		ret = read(fd, clock_buf + len, clock_bufsize - len - 1);
+		if (ret <= 0)
+			break;
+
+		len += ret;
+		clock_buf[len] = '\0';
+
+		/* the buffer is full, it grows instead of being parsed */
+		if (len == clock_bufsize - 1 && clock_bufsize < CLOCK_BULK_MAX) {
+			buf = realloc(clock_buf, clock_bufsize * 2);
+			if (buf) {
+				clock_buf = buf;
+				clock_bufsize *= 2;
+				continue;
+			}
+		}
+
+		parsed = bulk->parse(bulk, clock_buf, len, false);
+		if (parsed < 0)
+			break;
+
+		/* an incomplete line or member is kept for the next chunk */
+		len -= parsed;
+		memmove(clock_buf, clock_buf + parsed, len);
+
+		/* a line or a member does not fit in the buffer */
+		if (len == clock_bufsize - 1) {
+			parsed = -1;
+			break;
+		}
+	}
+
+	close(fd);
+
+	if (ret < 0)
+		return -1;
+
+	if (parsed >= 0 && ret == 0)
+		parsed = bulk->parse(bulk, clock_buf, len, true);
+
+	return parsed < 0 || !bulk->nr ? -2 : 0;
+}
+
+/*
+ * Read the values of all the clocks from the first bulk file which can
+ * be read, the files not understood are not read again.
+ * Returns 0 on success, -1 if the attribute files have to be read
+ */
+static int read_clock_bulk(void)
+{
+	struct clock_bulk *bulk;
+	int i, ret;
+
+	for (i = 0; i < clock_layout->nrbulks; i++) {
+
+		bulk = &clock_layout->bulks[i];
+		if (bulk->broken)
+			continue;
+
+		ret = clock_bulk_read(bulk);
+		if (!ret)
+			return 0;
+
+		if (ret == -2)
+			bulk->broken = true;
+	}
+
+	return -1;
+}
+
 static inline int read_clock_cb(struct tree *t, void *data)
 {
 	struct clock_info *clk = t->private;
 
-	file_read_value(t->path, "flags", "%x", &clk->flags);
-	file_read_value(t->path, "rate", "%f", &clk->rate);
-	file_read_value(t->path, "usecount", "%d", &clk->usecount);
+	return attr_batch(t, clock_layout->attrs, clock_layout->nr, clk,
+			  clk->present & ~(clock_static | clock_traced));
+}
+
+static int clock_history_cb(struct tree *t, void *data)
+{
+	struct clock_info *clk = t->private;
+	uint64_t *now = data;
+
+	if (clk->history)
+		history_add(clk->history, *now,
+			    *(uint64_t *)((char *)clk + clock_rate->offset),
+			    clock_users(clk) > 0);
 
 	return 0;
 }
 
 static int read_clock_info(struct tree *tree)
 {
-	return tree_for_each(tree, read_clock_cb, NULL);
+	bool tracing = ftrace_traced("clk");
+	uint64_t now;
+
+	/*
+	 * The rates and the counts are read again when tracing starts or
+	 * records are lost
+	 */
+	clock_traced = tracing && clock_tracing ?
+		1UL << (clock_rate - clock_layout->attrs) |
+		1UL << (clock_count - clock_layout->attrs) : 0;
+	clock_tracing = tracing;
+
+	/* a single file gives the values of all the clocks */
+	if (read_clock_bulk()) {
+
+		if (tree_for_each(tree, read_clock_cb, NULL))
+			return -1;
+
+		file_batch_submit();
+	}
+
+	/* the histories are fed by the records of the trace buffers */
+	if (clock_traced || !history_enabled())
+		return 0;
+
+	now = history_now();
+
+	return tree_for_each(tree, clock_history_cb, &now);
 }
 
+/*
+ * Allocate the private data of a clock and read its attributes.
+ *
+ * @t    : the node of the clock
+ * @data : the snapshot the tree was loaded from, giving the attributes
+ *         found in the directory, or NULL to look for them
+ * Returns 0 on success, < 0 otherwise
+ */
 static int fill_clock_cb(struct tree *t, void *data)
 {
+	struct snapshot *snap = data;
 	struct clock_info *clk;
 
-	clk = clock_alloc();
+	clk = clock_alloc(t);
 	if (!clk)
 		return -1;
 	t->private = clk;
@@ -172,149 +792,494 @@ static int fill_clock_cb(struct tree *t, void *data)
 		return 0;
 	}
 
-	return read_clock_cb(t, data);
+	if (snap)
+		clk->present = snapshot_mask(snap, t);
+	else
+		clk->present = attr_probe(t, clock_layout->attrs,
+					  clock_layout->nr,
+					  attr_mask(clock_layout->attrs,
+						    clock_layout->nr,
+						    ATTR_SHOW | ATTR_DUMP));
+
+	if (history_enabled()) {
+		clk->history = history_alloc();
+		if (!clk->history)
+			return -1;
+	}
+
+	return attr_batch(t, clock_layout->attrs, clock_layout->nr, clk,
+			  clk->present);
 }
 
-static int fill_clock_tree(void)
+static int clock_release_cb(struct tree *t, void *data)
 {
-	return tree_for_each(clock_tree, fill_clock_cb, NULL);
+	struct clock_info *clk = t->private;
+
+	if (!clk)
+		return 0;
+
+	/* the prefix of the root node is not allocated */
+	if (t->parent)
+		free(clk->prefix);
+	history_free(clk->history);
+	tree_free_private(t, clk, sizeof(*clk));
+
+	return 0;
 }
 
-static int is_collapsed(struct tree *t, void *data)
+static unsigned long clock_mask_cb(struct tree *t)
 {
 	struct clock_info *clk = t->private;
 
-	if (!clk->expanded)
-		return 1;
+	return clk->present;
+}
+
+static int fill_clock_tree(struct snapshot *snap)
+{
+	clock_static = attr_mask(clock_layout->attrs, clock_layout->nr,
+				 ATTR_STATIC);
+
+	if (tree_for_each(clock_tree, fill_clock_cb, snap))
+		return -1;
+
+	file_batch_submit();
 
 	return 0;
 }
 
-static char *clock_line(struct tree *t)
+/*
+ * Rebuild the hierarchy of the clocks when debugfs lists them all in
+ * the same directory, as the common clock framework does in the recent
+ * kernels. The parent of a clock is given by its clk_parent file, the
+ * clocks without this file or with an empty one are roots. The parents
+ * are all looked up before a clock is moved, so the name index of the
+ * tree is built once.
+ *
+ * @tree : the tree of the clocks as found in the directory
+ * Returns the number of clocks moved, < 0 on error
+ */
+static int clock_reparent(struct tree *tree)
 {
-	struct clock_info *clk;
-	float rate;
-	const char *clkunit;
-	char *clkrate, *clkname, *clkline = NULL;
+	char name[NAME_MAX + 1];
+	struct tree **parents;
+	struct tree *t, *next;
+	int i, nr = 0;
 
-	clk = t->private;
-	rate = clk->rate;
-	clkunit = clock_rate(&rate);
+	parents = calloc(tree->nrchild, sizeof(*parents));
+	if (!parents)
+		return -1;
 
-	if (asprintf(&clkname, "%*s%s", (t->depth - 1) * 2, "", t->name) < 0)
-		return NULL;
+	for (t = tree->child, i = 0; t; t = t->next, i++)
+		if (!tree_read_value(t, clock_layout->parent, VALUE_STRING,
+				     name, sizeof(name)))
+			parents[i] = tree_find(tree, name);
 
-	if (asprintf(&clkrate, "%d%s", rate, clkunit) < 0)
-		goto free_clkname;
+	for (t = tree->child, i = 0; t; t = next, i++) {
 
-	if (asprintf(&clkline, "%-55s 0x%-16x %-12s %-9d %-8d", clkname,
-		     clk->flags, clkrate, clk->usecount, t->nrchild) < 0)
-		goto free_clkrate;
+		next = t->next;
+
+		if (!parents[i] || parents[i] == t || tree_move(t, parents[i]))
+			continue;
+
+		nr++;
+	}
 
-free_clkrate:
-	free(clkrate);
-free_clkname:
-	free(clkname);
+	free(parents);
 
-	return clkline;
+	return nr;
 }
 
-static int _clock_print_info_cb(struct tree *t, void *data)
+/*
+ * Check if clocks were registered or unregistered in the directory of
+ * a flat tree since it was loaded.
+ * Returns true if the clocks changed, false otherwise
+ */
+static bool clock_flat_changed(void)
 {
-	struct clock_info *clock = t->private;
-	int *line = data;
-	char *buffer;
+	struct dirent *d;
+	bool changed = false;
+	int nr = 0;
+	DIR *dir;
+
+	dir = tree_opendir(clock_tree);
+	if (!dir)
+		return false;
+
+	while ((d = readdir(dir))) {
+
+		if (d->d_name[0] == '.' || d->d_type != DT_DIR)
+			continue;
+
+		nr++;
+
+		if (!tree_find(clock_tree, d->d_name)) {
+			changed = true;
+			break;
+		}
+	}
+
+	closedir(dir);
+
+	return changed || nr != clock_nrflat;
+}
+
+/*
+ * Keep the state of a clock found in the previous tree, its history is
+ * exchanged with the empty one, freed with the previous tree.
+ */
+static int clock_keep_cb(struct tree *t, void *data)
+{
+	struct clock_info *clk = t->private;
+	struct clock_info *oclk;
+	struct history *history;
+	struct tree *old;
 
-        /* we skip the root node of the tree */
 	if (!t->parent)
 		return 0;
 
-	buffer = clock_line(t);
-	if (!buffer)
+	old = tree_find(data, t->name);
+	if (!old)
+		return 0;
+
+	oclk = old->private;
+
+	clk->expanded = oclk->expanded;
+
+	history = clk->history;
+	clk->history = oclk->history;
+	oclk->history = history;
+
+	return 0;
+}
+
+/*
+ * Load the tree of the clocks again when they are all in the same
+ * directory, tree_reload can not be used as the nodes are not in the
+ * directory of their parent. The clocks expanded and the histories are
+ * kept.
+ * Returns 0 on success, < 0 otherwise
+ */
+static int reload_clock_flat(void)
+{
+	struct tree *old = clock_tree;
+	struct tree *tree;
+
+	if (!clock_flat_changed())
+		return 0;
+
+	tree = tree_load(old->path, NULL, false);
+	if (!tree)
 		return -1;
 
-	display_print_line(CLOCK, *line, buffer, clock->usecount, t);
+	clock_tree = tree;
 
-	(*line)++;
+	if (fill_clock_tree(NULL))
+		goto out_free;
+
+	clock_nrflat = tree->nrchild;
+
+	if (clock_reparent(tree) < 0)
+		goto out_free;
+
+	tree_for_each(tree, clock_keep_cb, old);
+
+	tree_for_each(old, clock_release_cb, NULL);
+	tree_destroy(old);
+
+	return 0;
+
+out_free:
+	tree_for_each(tree, clock_release_cb, NULL);
+	tree_destroy(tree);
+	clock_tree = old;
+	return -1;
+}
+
+/*
+ * Update the clock tree with the clocks registered or unregistered
+ * since it was loaded, debugfs does not send any event for them.
+ * Returns 0 on success, < 0 otherwise
+ */
+static int reload_clock_tree(void)
+{
+	if (clock_flat)
+		return reload_clock_flat();
+
+	if (++clock_refreshes < CLOCK_RELOAD_PERIOD)
+		return 0;
+
+	clock_refreshes = 0;
+
+	if (tree_reload(clock_tree, NULL, false, fill_clock_cb,
+			clock_release_cb, NULL) < 0)
+		return -1;
 
-	free(buffer);
+	file_batch_submit();
 
 	return 0;
 }
 
-static int clock_print_info_cb(struct tree *t, void *data)
+static void clock_line(struct tree *t, struct row *row)
 {
+	struct clock_info *clk = t->private;
+	int start;
+
+	row_chars(row, ' ', (t->depth - 1) * 2);
+	row_column(row, t->name, 55 - (t->depth - 1) * 2);
+
+	attr_line(row, clock_layout->attrs, clock_layout->nr, clk,
+		  clk->present);
+
+	if (history_enabled())
+		history_line(row, clk->history, clock_rate);
+
+	start = row->len;
+	row_int(row, t->nrchild);
+	row_chars(row, ' ', start + 8 - row->len);
+}
+
+static int _clock_print_info_cb(struct tree *t, void *data)
+{
+	struct clock_info *clock = t->private;
+	struct row *row = display_row(CLOCK);
+	int *line = data;
+
         /* we skip the root node of the tree */
 	if (!t->parent)
 		return 0;
 
-        /* show the clock when *all* its parent is expanded */
-	if (tree_for_each_parent(t->parent, is_collapsed, NULL))
+	clock_line(t, row);
+
+	display_print_line(CLOCK, *line, row, clock_users(clock), t);
+
+	(*line)++;
+
+	return 0;
+}
+
+static int clock_rows_grow(int nr)
+{
+	struct tree **rows;
+	int max = clock_maxrows ? clock_maxrows : 256;
+
+	if (nr <= clock_maxrows)
 		return 0;
 
-	return _clock_print_info_cb(t, data);
+	while (max < nr)
+		max *= 2;
+
+	rows = realloc(clock_rows, max * sizeof(*rows));
+	if (!rows)
+		return -1;
+
+	clock_rows = rows;
+	clock_maxrows = max;
+
+	return 0;
 }
 
-static int clock_print_header(void)
+/*
+ * Append the rows of the subtree of an expanded clock, in preorder.
+ *
+ * @t : the node of the clock
+ * Returns 0 on success, -1 otherwise
+ */
+static int clock_rows_append(struct tree *t)
 {
-	char *buf;
-	int ret;
+	struct clock_info *clk;
+	struct tree *child;
+
+	for (child = t->child; child; child = child->next) {
 
-	if (asprintf(&buf, "%-55s %-16s %-12s %-9s %-8s",
-		     "Name", "Flags", "Rate", "Usecount", "Children") < 0)
+		if (clock_rows_grow(clock_nrrows + 1))
+			return -1;
+
+		clock_rows[clock_nrrows++] = child;
+
+		/* the children are shown when *all* their parents are expanded */
+		clk = child->private;
+		if (clk->expanded && clock_rows_append(child))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int clock_rows_build(void)
+{
+	clock_nrrows = 0;
+
+	if (clock_rows_append(clock_tree))
 		return -1;
 
-	ret = display_column_name(buf);
+	clock_rows_valid = true;
 
-	free(buf);
+	return 0;
+}
 
-	return ret;
+/*
+ * Look for the row of a clock, the search costs no more than moving the
+ * rows following it.
+ *
+ * @t : the node of the clock
+ * Returns the row of the clock, -1 if it is not shown
+ */
+static int clock_row_find(struct tree *t)
+{
+	int i;
+
+	for (i = 0; i < clock_nrrows; i++)
+		if (clock_rows[i] == t)
+			return i;
+
+	return -1;
 }
 
-static int clock_print_info(struct tree *tree)
+/*
+ * Insert the rows of the subtree of a clock just expanded, after the
+ * row of the clock. The rows are appended at the end of the list then
+ * moved in place.
+ *
+ * @t   : the node of the clock
+ * @row : the row of the clock
+ * Returns 0 on success, -1 otherwise
+ */
+static int clock_rows_expand(struct tree *t, int row)
 {
-	int ret, line = 0;
+	struct tree **subtree;
+	int old = clock_nrrows, nr;
+
+	if (clock_rows_append(t))
+		return -1;
+
+	nr = clock_nrrows - old;
+	if (!nr)
+		return 0;
+
+	subtree = malloc(nr * sizeof(*subtree));
+	if (!subtree)
+		return -1;
+
+	memcpy(subtree, clock_rows + old, nr * sizeof(*subtree));
+	memmove(clock_rows + row + 1 + nr, clock_rows + row + 1,
+		(old - row - 1) * sizeof(*clock_rows));
+	memcpy(clock_rows + row + 1, subtree, nr * sizeof(*subtree));
+
+	free(subtree);
+
+	return 0;
+}
+
+/*
+ * Remove the rows of the subtree of a clock just collapsed, they follow
+ * the row of the clock and are deeper.
+ *
+ * @t   : the node of the clock
+ * @row : the row of the clock
+ */
+static void clock_rows_collapse(struct tree *t, int row)
+{
+	int end = row + 1;
+
+	while (end < clock_nrrows && clock_rows[end]->depth > t->depth)
+		end++;
+
+	memmove(clock_rows + row + 1, clock_rows + end,
+		(clock_nrrows - end) * sizeof(*clock_rows));
+
+	clock_nrrows -= end - row - 1;
+}
+
+static int clock_print_header(void)
+{
+	char buf[256];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%-55s ", "Name");
+	len += attr_header(buf + len, sizeof(buf) - len, clock_layout->attrs,
+			   clock_layout->nr);
+	if (history_enabled() && len < sizeof(buf))
+		len += history_header(buf + len, sizeof(buf) - len);
+	if (len < sizeof(buf))
+		snprintf(buf + len, sizeof(buf) - len, "%-8s", "Children");
+
+	return display_column_name(buf);
+}
+
+static int clock_print_info(void)
+{
+	int i, line = 0;
+
+	if (!clock_rows_valid && clock_rows_build())
+		return -1;
 
 	display_reset_cursor(CLOCK);
 
 	clock_print_header();
 
-	ret = tree_for_each(tree, clock_print_info_cb, &line);
+	for (i = 0; i < clock_nrrows; i++)
+		_clock_print_info_cb(clock_rows[i], &line);
 
 	display_refresh_pad(CLOCK);
 
-	return ret;
+	return 0;
 }
 
 static int clock_select(void)
 {
 	struct tree *t = display_get_row_data(CLOCK);
 	struct clock_info *clk = t->private;
+	int row;
 
 	clk->expanded = !clk->expanded;
 
+	/* a clock selected from the find mode may be hidden */
+	row = clock_rows_valid ? clock_row_find(t) : -1;
+	if (row < 0)
+		return 0;
+
+	if (!clk->expanded) {
+		clock_rows_collapse(t, row);
+		return 0;
+	}
+
+	if (clock_rows_expand(t, row)) {
+		clock_rows_valid = false;
+		return -1;
+	}
+
 	return 0;
 }
 
 /*
  * Read the clock information and fill the tree with the information
- * found in the files. Then print the result to the text based interface
+ * found in the files, the clocks added or removed are picked up when
+ * the values are read again. Then print the result to the text based
+ * interface
  * Return 0 on success, < 0 otherwise
  */
 static int clock_display(bool refresh)
 {
+	if (refresh && reload_clock_tree())
+		return -1;
+
 	if (refresh && read_clock_info(clock_tree))
 		return -1;
 
-	return clock_print_info(clock_tree);
+	/* the clocks may have moved in the tree */
+	if (refresh)
+		clock_rows_valid = false;
+
+	return clock_print_info();
 }
 
-static int clock_find(const char *name)
+static int clock_find(const char *name, int mode)
 {
 	struct tree **ptree = NULL;
 	int i, nr, line = 0, ret = 0;
 
-	nr = tree_finds(clock_tree, name, &ptree);
+	/* the array belongs to the tree, the search is narrowed as typed */
+	nr = tree_search(clock_tree, name, mode, &ptree);
 
 	display_reset_cursor(CLOCK);
 
@@ -328,8 +1293,6 @@ static int clock_find(const char *name)
 
 	display_refresh_pad(CLOCK);
 
-	free(ptree);
-
 	return ret;
 }
 
@@ -346,6 +1309,58 @@ static int clock_selectf(void)
 	return display_refresh_pad(CLOCK);
 }
 
+/*
+ * Apply a record of the trace buffers to its clock, the clocks are only
+ * moved in the tree when they are all in the same directory.
+ *
+ * @rec  : the record, NULL when all the records read at once are applied
+ * @data : the event of the record
+ * Returns 0 on success, < 0 otherwise
+ */
+static int clock_trace_cb(const struct ftrace_record *rec, void *data)
+{
+	const struct clock_event *event = data;
+	struct clock_info *clk;
+	struct tree *t, *parent;
+	uint64_t *rate;
+	int *users;
+
+	if (!rec)
+		return display_update(CLOCK);
+
+	t = clock_bulk_find(rec->strings[0]);
+	if (!t)
+		return 0;
+
+	clk = t->private;
+	rate = (uint64_t *)((char *)clk + clock_rate->offset);
+	users = (int *)((char *)clk + clock_layout->users);
+
+	switch (event->action) {
+	case CLOCK_TRACE_RATE:
+		*rate = rec->values[1];
+		break;
+	case CLOCK_TRACE_ENABLE:
+		if (*users < 1)
+			*users = 1;
+		break;
+	case CLOCK_TRACE_DISABLE:
+		*users = 0;
+		break;
+	case CLOCK_TRACE_PARENT:
+		parent = clock_bulk_find(rec->strings[1]);
+		if (clock_flat && parent && parent != t->parent &&
+		    !tree_move(t, parent))
+			clock_rows_valid = false;
+		return 0;
+	}
+
+	if (clk->history)
+		history_add(clk->history, rec->time, *rate, *users > 0);
+
+	return 0;
+}
+
 /*
  * Read the clock information and fill the tree with the information
  * found in the files. Then dump to stdout a formatted result.
@@ -386,21 +1401,66 @@ static struct display_ops clock_ops = {
 int clock_init(void)
 {
 	char clk_dir_path[PATH_MAX];
-
-	if (locate_debugfs(clk_dir_path))
+	struct snapshot *snap;
+	unsigned int key;
+	int i, ret;
+
+	clock_rows_valid = false;
+	clock_flat = false;
+	clock_refreshes = 0;
+	clock_traced = 0;
+	clock_tracing = false;
+
+	clock_layout = clock_detect(clk_dir_path, sizeof(clk_dir_path));
+	if (!clock_layout)
 		return -1;
 
-	sprintf(clk_dir_path, "%s/clock", clk_dir_path);
+	for (i = 0; i < clock_layout->nr; i++) {
+		if (!strcmp(clock_layout->attrs[i].name, clock_layout->rate))
+			clock_rate = &clock_layout->attrs[i];
+		if (clock_layout->attrs[i].offset == clock_layout->users)
+			clock_count = &clock_layout->attrs[i];
+	}
 
-	if (access(clk_dir_path, F_OK))
-		return -1;
+	for (i = 0; i < ATTR_COUNT(clock_events); i++)
+		ftrace_register("clk", clock_events[i].name,
+				clock_events[i].fields, clock_trace_cb,
+				(void *)&clock_events[i]);
 
-	clock_tree = tree_load(clk_dir_path, NULL, false);
+	/* the tree of a previous initialization holds directory fds */
+	if (clock_tree) {
+		tree_for_each(clock_tree, clock_release_cb, NULL);
+		tree_destroy(clock_tree);
+		clock_tree = NULL;
+	}
+
+	/* browsing debugfs is the longest part of the start */
+	key = attr_key(clock_layout->attrs, clock_layout->nr);
+
+	clock_tree = snapshot_load(clock_layout->dir, clk_dir_path, key, NULL,
+				   false, &snap);
 	if (!clock_tree)
 		return -1;
 
-	if (fill_clock_tree())
+	ret = fill_clock_tree(snap);
+
+	/* the snapshot keeps the tree as found in the directory */
+	snapshot_save(snap, clock_layout->dir, clock_tree, key, clock_mask_cb);
+
+	if (ret)
 		return -1;
+
+	if (clock_layout->parent) {
+
+		clock_nrflat = clock_tree->nrchild;
+
+		ret = clock_reparent(clock_tree);
+		if (ret < 0)
+			return -1;
+
+		/* the old kernels nest the directories as the clocks */
+		clock_flat = ret > 0;
+	}
 #ifdef NCURES
 	return display_register(CLOCK, &clock_ops);
 #else
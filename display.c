@@ -14,6 +14,7 @@
  *******************************************************************************/
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
@@ -24,6 +25,8 @@
 #include "mainloop.h"
 #include "regulator.h"
 #include "display.h"
+#include "tree.h"
+#include "row.h"
 
 enum { PT_COLOR_DEFAULT = 1,
        PT_COLOR_HEADER_BAR,
@@ -56,6 +59,7 @@ struct windata {
 	int nrdata;
 	int scrolling;
 	int cursor;
+	struct row row;
 };
 
 /* Warning this is linked with the enum { CLOCK, REGULATOR, ... } */
@@ -127,6 +131,18 @@ static int display_refresh(int win, bool read)
 	return wrefresh(main_win);
 }
 
+/*
+ * Redraw a panel with the values already read, this is used when some
+ * values were updated without a refresh of the whole panel.
+ *
+ * @win : the panel to redraw
+ * Returns 0 on success, < 0 otherwise
+ */
+int display_update(int win)
+{
+	return display_refresh(win, false);
+}
+
 int display_refresh_pad(int win)
 {
 	int maxx, maxy;
@@ -254,7 +270,22 @@ int display_reset_cursor(int win)
 	return wmove(windata[win].pad, 0, 0);
 }
 
-int display_print_line(int win, int line, char *str, int bold, void *data)
+/*
+ * Get the buffer a line of a panel is formatted in before it is printed
+ * with display_print_line, the buffer is reused for each line.
+ *
+ * @win : the panel
+ * Returns the buffer, emptied
+ */
+struct row *display_row(int win)
+{
+	row_reset(&windata[win].row);
+
+	return &windata[win].row;
+}
+
+int display_print_line(int win, int line, struct row *row, int bold,
+		       void *data)
 {
 	int attr = 0;
 
@@ -270,7 +301,8 @@ int display_print_line(int win, int line, char *str, int bold, void *data)
 	if (attr)
 		wattron(windata[win].pad, attr);
 
-	wprintw(windata[win].pad, "%s\n", str);
+	waddnstr(windata[win].pad, row->buf, row->len);
+	waddch(windata[win].pad, '\n');
 
 	if (attr)
 		wattroff(windata[win].pad, attr);
@@ -284,13 +316,38 @@ struct find_data {
 	size_t len;
 	char *string;
 	regex_t *reg;
+	int mode;
 	int ocursor;
 	int oscrolling;
 };
 
+/* Names of the kinds of match, shown in the footer */
+static const char *find_modes[] = {
+	[TREE_FIND_PREFIX]    = "prefix",
+	[TREE_FIND_SUBSTRING] = "substring",
+	[TREE_FIND_GLOB]      = "glob",
+	[TREE_FIND_FUZZY]     = "fuzzy",
+};
+
+static int display_find_footer(struct find_data *findd)
+{
+	char buf[128];
+
+	if (strlen(findd->string))
+		snprintf(buf, sizeof(buf), "find %s: %s",
+			 find_modes[findd->mode], findd->string);
+	else
+		snprintf(buf, sizeof(buf),
+			 "find %s (tab to change, esc to exit)?",
+			 find_modes[findd->mode]);
+
+	return display_show_footer(current_win, buf);
+}
+
 struct find_data *display_find_init(void)
 {
-	const char *regexp = "^[a-z|0-9|_|-|.]";
+	/* the characters of a name and of a glob pattern */
+	const char *regexp = "^[][a-z0-9_.*?-]";
 	struct find_data *findd;
 	const size_t len = 64;
 	regex_t *reg;
@@ -318,6 +375,7 @@ struct find_data *display_find_init(void)
 	findd->string = search4;
 	findd->reg = reg;
 	findd->len = len;
+	findd->mode = TREE_FIND_PREFIX;
 
 	/* save the location of the cursor on the main window in order to
 	 * browse the search result
@@ -366,7 +424,7 @@ static int display_switch_to_find(int fd)
 	if (mainloop_add(fd, display_find_keystroke, findd))
 		return -1;
 
-	if (display_show_footer(current_win, "find (esc to exit)?"))
+	if (display_find_footer(findd))
 		return -1;
 
 	return 0;
@@ -469,6 +527,14 @@ static int display_find_keystroke(int fd, void *data)
 
 		break;
 
+	case '\t':
+		findd->mode = (findd->mode + 1) % TREE_FIND_MODES;
+
+		windata[current_win].cursor = 0;
+		windata[current_win].scrolling = 0;
+
+		break;
+
 	case '\r':
 		if (!windata[current_win].ops || !windata[current_win].ops->selectf)
 			return 0;
@@ -499,14 +565,13 @@ static int display_find_keystroke(int fd, void *data)
 	if (!windata[current_win].ops || !windata[current_win].ops->find)
 		return 0;
 
-	if (windata[current_win].ops->find(string))
+	if (windata[current_win].ops->find(string, findd->mode))
 		return -1;
 
 	if (display_show_header(current_win))
 		return -1;
 
-	if (display_show_footer(current_win, strlen(string) ? string :
-				"find (esc to exit)?"))
+	if (display_find_footer(findd))
 		return -1;
 
 	return 0;
@@ -15,17 +15,21 @@
 
 enum { CLOCK, REGULATOR, SENSOR, GPIO };
 
+struct row;
+
 struct display_ops {
 	int (*display)(bool refresh);
 	int (*select)(void);
-	int (*find)(const char *);
+	int (*find)(const char *, int);
 	int (*selectf)(void);
 };
 
-extern int display_print_line(int window, int line, char *str,
+extern struct row *display_row(int window);
+extern int display_print_line(int window, int line, struct row *row,
 			      int bold, void *data);
 
 extern int display_refresh_pad(int window);
+extern int display_update(int window);
 extern int display_reset_cursor(int window);
 extern void *display_get_row_data(int window);
 
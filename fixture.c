@@ -0,0 +1,492 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#undef _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fixture.h"
+
+/*
+ * Create a directory and its missing parents.
+ *
+ * @path : the directory to be created
+ * Returns 0 on success, -1 otherwise
+ */
+static int fixture_mkdir(const char *path)
+{
+	char buf[PATH_MAX];
+	char *s;
+
+	if (snprintf(buf, sizeof(buf), "%s", path) >= sizeof(buf))
+		return -1;
+
+	for (s = buf + 1; *s; s++) {
+
+		if (*s != '/')
+			continue;
+
+		*s = '\0';
+		if (mkdir(buf, 0755) && errno != EEXIST)
+			return -1;
+		*s = '/';
+	}
+
+	if (mkdir(buf, 0755) && errno != EEXIST)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Create an attribute file with its content followed by a new line,
+ * as sysfs does.
+ *
+ * @path : the directory containing the file
+ * @name : the name of the file
+ * @fmt  : the format of the content
+ * Returns 0 on success, -1 otherwise
+ */
+static int fixture_write(const char *path, const char *name,
+			 const char *fmt, ...)
+{
+	char rpath[PATH_MAX];
+	va_list ap;
+	FILE *f;
+
+	snprintf(rpath, sizeof(rpath), "%s/%s", path, name);
+
+	f = fopen(rpath, "w");
+	if (!f)
+		return -1;
+
+	va_start(ap, fmt);
+	vfprintf(f, fmt, ap);
+	va_end(ap);
+
+	fputc('\n', f);
+
+	return fclose(f) ? -1 : 0;
+}
+
+static int fixture_clock(const char *path, int nr)
+{
+	if (fixture_mkdir(path))
+		return -1;
+
+	if (fixture_write(path, "flags", "0x%x", nr % 16) ||
+	    fixture_write(path, "rate", "%llu",
+			  24000000ULL * (1 + nr % 50)) ||
+	    fixture_write(path, "usecount", "%d", nr % 3))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Create a clock of the common clock framework, all the clocks are in
+ * the same directory and give the name of their parent.
+ *
+ * @path   : the directory of the clock
+ * @nr     : the number of the clock
+ * @parent : the name of the parent clock, NULL for a root clock
+ * Returns 0 on success, -1 otherwise
+ */
+static int fixture_ccf_clock(const char *path, int nr, const char *parent)
+{
+	if (fixture_mkdir(path))
+		return -1;
+
+	if (fixture_write(path, "clk_rate", "%llu",
+			  24000000ULL * (1 + nr % 50)) ||
+	    fixture_write(path, "clk_enable_count", "%d", nr % 3) ||
+	    fixture_write(path, "clk_prepare_count", "%d", nr % 3) ||
+	    fixture_write(path, "clk_phase", "%d", nr % 4 * 90) ||
+	    fixture_write(path, "clk_flags", nr % 2 ? "CLK_SET_RATE_PARENT" :
+			  "0x0") ||
+	    fixture_write(path, "clk_parent", "%s", parent ? parent : ""))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Structure describing a clock of the tree being created
+ *
+ * path    : the directory of the clock
+ * depth   : the depth of the clock, 0 for the directory of the clocks
+ * first   : the index of the first child of the clock
+ * nrchild : the number of children of the clock
+ */
+struct fixture_node {
+	char *path;
+	int depth;
+	int first;
+	int nrchild;
+};
+
+/*
+ * Write the line of a clock in clk_summary, in the format of the
+ * kernel, then the lines of its children indented below it.
+ */
+static void fixture_summary(FILE *f, const struct fixture_node *nodes,
+			    int index)
+{
+	const struct fixture_node *node = &nodes[index];
+	int nr = index - 1, level = node->depth - 1, i;
+
+	if (index)
+		fprintf(f, "%*s%-*s %7d %8d %8d %11llu %10lu %5d %6d\n",
+			level * 3 + 1, "", 30 - level * 3,
+			strrchr(node->path, '/') + 1, nr % 3, nr % 3, 0,
+			24000000ULL * (1 + nr % 50), 0UL, nr % 4 * 90, 50000);
+
+	for (i = 0; i < node->nrchild; i++)
+		fixture_summary(f, nodes, node->first + i);
+}
+
+/*
+ * Write the JSON object of a clock in clk_dump, in the format of the
+ * kernel, the objects of its children are nested in it.
+ */
+static void fixture_dump(FILE *f, const struct fixture_node *nodes,
+			 int index)
+{
+	const struct fixture_node *node = &nodes[index];
+	int nr = index - 1, i;
+
+	if (index)
+		fprintf(f, "\"%s\": { \"enable_count\": %d,"
+			"\"prepare_count\": %d,\"protect_count\": %d,"
+			"\"rate\": %llu,\"accuracy\": %d,\"phase\": %d,"
+			"\"duty_cycle\": %d", strrchr(node->path, '/') + 1,
+			nr % 3, nr % 3, 0, 24000000ULL * (1 + nr % 50), 0,
+			nr % 4 * 90, 50000);
+	else
+		fputc('{', f);
+
+	for (i = 0; i < node->nrchild; i++) {
+		if (index || i)
+			fputc(',', f);
+		fixture_dump(f, nodes, node->first + i);
+	}
+
+	fputs(index ? "}" : "}\n", f);
+}
+
+/*
+ * Create the files of the common clock framework giving the values of
+ * all the clocks, the summary as text and the dump as JSON.
+ */
+static int fixture_bulk(const char *dir, const struct fixture_node *nodes)
+{
+	char path[PATH_MAX];
+	FILE *f;
+
+	if (snprintf(path, sizeof(path), "%s/clk_summary", dir) >= sizeof(path))
+		return -1;
+
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+
+	fprintf(f, "                                 enable  prepare  protect"
+		"                                duty\n");
+	fprintf(f, "   clock                          count    count    count"
+		"        rate   accuracy phase  cycle\n");
+	fprintf(f, "---------------------------------------------------------"
+		"------------------------------------\n");
+	fixture_summary(f, nodes, 0);
+
+	if (fclose(f))
+		return -1;
+
+	if (snprintf(path, sizeof(path), "%s/clk_dump", dir) >= sizeof(path))
+		return -1;
+
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+
+	fixture_dump(f, nodes, 0);
+
+	return fclose(f) ? -1 : 0;
+}
+
+/*
+ * Create the clock tree as found in debugfs, a directory per clock with
+ * the children clocks as subdirectories with the legacy layout, or all
+ * the clocks in the same directory with the common clock framework. The
+ * tree is filled breadth first, so every clock has fanout children
+ * until the depth or the number of clocks is reached.
+ */
+static int fixture_clocks(const char *root, const struct fixture *fx)
+{
+	struct fixture_node *queue;
+	char path[PATH_MAX];
+	char dir[PATH_MAX];
+	int head = 0, tail = 0, nr = 0, i, ret = -1;
+
+	queue = calloc(fx->clocks + 1, sizeof(*queue));
+	if (!queue)
+		return -1;
+
+	snprintf(dir, sizeof(dir), "%s/sys/kernel/debug/%s", root,
+		 fx->ccf ? "clk" : "clock");
+
+	if (fixture_mkdir(dir))
+		goto out;
+
+	snprintf(path, sizeof(path), "%s", dir);
+
+	queue[tail].path = strdup(path);
+	queue[tail++].depth = 0;
+
+	while (head < tail && nr < fx->clocks) {
+
+		if (queue[head].depth >= fx->depth)
+			break;
+
+		queue[head].first = tail;
+
+		for (i = 0; i < fx->fanout && nr < fx->clocks; i++, nr++) {
+
+			if (snprintf(path, sizeof(path), "%s/clk%d",
+				     fx->ccf ? dir : queue[head].path, nr) >=
+			    sizeof(path))
+				goto out;
+
+			if (fx->ccf ? fixture_ccf_clock(path, nr, head ?
+					strrchr(queue[head].path, '/') + 1 :
+					NULL) :
+			    fixture_clock(path, nr))
+				goto out;
+
+			queue[tail].path = strdup(path);
+			queue[tail++].depth = queue[head].depth + 1;
+			queue[head].nrchild++;
+		}
+
+		head++;
+	}
+
+	ret = fx->ccf ? fixture_bulk(dir, queue) : 0;
+out:
+	for (i = 0; i < tail; i++)
+		free(queue[i].path);
+	free(queue);
+
+	return ret;
+}
+
+static int fixture_regulators(const char *root, const struct fixture *fx)
+{
+	char path[PATH_MAX];
+	int i;
+
+	for (i = 0; i < fx->regulators; i++) {
+
+		snprintf(path, sizeof(path),
+			 "%s/sys/class/regulator/regulator.%d", root, i);
+
+		if (fixture_mkdir(path))
+			return -1;
+
+		if (fixture_write(path, "name", "vdd_%d", i) ||
+		    fixture_write(path, "type", "voltage") ||
+		    fixture_write(path, "status", i % 2 ? "on" : "off") ||
+		    fixture_write(path, "state", i % 2 ? "enabled" :
+				  "disabled") ||
+		    fixture_write(path, "num_users", "%d", i % 4) ||
+		    fixture_write(path, "microvolts", "%d",
+				  800000 + (i % 20) * 50000) ||
+		    fixture_write(path, "min_microvolts", "%d", 800000) ||
+		    fixture_write(path, "max_microvolts", "%d", 3300000) ||
+		    fixture_write(path, "uevent", ""))
+			return -1;
+
+		/* only some regulators provide the current attributes */
+		if (i % 4)
+			continue;
+
+		if (fixture_write(path, "opmode", "normal") ||
+		    fixture_write(path, "microamps", "%d", i * 10) ||
+		    fixture_write(path, "requested_microamps", "%d", i * 10))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Create a symbolic link, the target is relative to the directory of
+ * the link as in sysfs.
+ *
+ * @path   : the directory containing the link
+ * @name   : the name of the link
+ * @target : the path the link points to
+ * Returns 0 on success, -1 otherwise
+ */
+static int fixture_link(const char *path, const char *name,
+			const char *target)
+{
+	char rpath[PATH_MAX];
+
+	snprintf(rpath, sizeof(rpath), "%s/%s", path, name);
+
+	return symlink(target, rpath);
+}
+
+/*
+ * Create the hwmon devices as sysfs does, the class directory holds
+ * links to the devices and a device links back to its parent device
+ * and to the class, which makes loops of links.
+ */
+static int fixture_sensors(const char *root, const struct fixture *fx)
+{
+	char path[PATH_MAX];
+	char name[NAME_MAX];
+	char target[PATH_MAX];
+	int i, j;
+
+	snprintf(path, sizeof(path), "%s/sys/class/hwmon", root);
+
+	if (fixture_mkdir(path))
+		return -1;
+
+	for (i = 0; i < fx->sensors; i++) {
+
+		snprintf(path, sizeof(path),
+			 "%s/sys/devices/platform/sensor%d/hwmon/hwmon%d",
+			 root, i, i);
+
+		if (fixture_mkdir(path))
+			return -1;
+
+		if (fixture_link(path, "device", "../..") ||
+		    fixture_link(path, "subsystem",
+				 "../../../../../class/hwmon"))
+			return -1;
+
+		snprintf(name, sizeof(name), "hwmon%d", i);
+		snprintf(target, sizeof(target),
+			 "../../devices/platform/sensor%d/hwmon/hwmon%d", i, i);
+		snprintf(path, sizeof(path), "%s/sys/class/hwmon", root);
+
+		if (fixture_link(path, name, target))
+			return -1;
+
+		snprintf(path, sizeof(path), "%s/sys/class/hwmon/hwmon%d",
+			 root, i);
+
+		if (fixture_write(path, "name", "sensor%d", i) ||
+		    fixture_write(path, "uevent", ""))
+			return -1;
+
+		for (j = 1; j <= fx->channels; j++) {
+
+			snprintf(name, sizeof(name), "temp%d_input", j);
+			if (fixture_write(path, name, "%d", 30000 + j * 500))
+				return -1;
+		}
+
+		/* a fan for four temperature inputs */
+		for (j = 1; j <= fx->channels / 4; j++) {
+
+			snprintf(name, sizeof(name), "fan%d_input", j);
+			if (fixture_write(path, name, "%d", 1200 + j * 100))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int fixture_gpios(const char *root, const struct fixture *fx)
+{
+	char path[PATH_MAX];
+	int i;
+
+	snprintf(path, sizeof(path), "%s/sys/class/gpio", root);
+
+	if (fixture_mkdir(path) ||
+	    fixture_write(path, "export", "") ||
+	    fixture_write(path, "unexport", ""))
+		return -1;
+
+	for (i = 0; i < fx->gpios; i++) {
+
+		snprintf(path, sizeof(path), "%s/sys/class/gpio/gpio%d",
+			 root, i);
+
+		if (fixture_mkdir(path))
+			return -1;
+
+		if (fixture_write(path, "value", "%d", i % 2) ||
+		    fixture_write(path, "active_low", "0") ||
+		    fixture_write(path, "edge", "none") ||
+		    fixture_write(path, "direction", i % 3 ? "in" : "out") ||
+		    fixture_write(path, "uevent", ""))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Create synthetic sysfs and debugfs trees, in the layout powerdebug
+ * expects, so it can be run and measured with the --root option on a
+ * machine without these devices.
+ *
+ * @root : the directory where the trees are created
+ * @fx   : the description of the trees
+ * Returns 0 on success, -1 otherwise
+ */
+int fixture_create(const char *root, const struct fixture *fx)
+{
+	if (fixture_clocks(root, fx))
+		return -1;
+
+	if (fixture_regulators(root, fx))
+		return -1;
+
+	if (fixture_sensors(root, fx))
+		return -1;
+
+	return fixture_gpios(root, fx);
+}
+
+static int fixture_rm_cb(const char *path, const struct stat *s,
+			 int flag, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+/*
+ * Remove the trees created by fixture_create.
+ *
+ * @root : the directory containing the trees, removed as well
+ * Returns 0 on success, -1 otherwise
+ */
+int fixture_remove(const char *root)
+{
+	return nftw(root, fixture_rm_cb, 16, FTW_DEPTH | FTW_PHYS);
+}
@@ -0,0 +1,37 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+/*
+ * Structure describing the synthetic sysfs and debugfs trees
+ *
+ * clocks     : the number of clocks in debugfs
+ * fanout     : the maximum number of children of a clock
+ * depth      : the maximum depth of the clock tree
+ * regulators : the number of regulators
+ * sensors    : the number of hwmon devices
+ * channels   : the number of temperature inputs of a hwmon device
+ * gpios      : the number of exported gpios
+ * ccf        : the clocks are laid out as the common clock framework does
+ */
+struct fixture {
+	int clocks;
+	int fanout;
+	int depth;
+	int regulators;
+	int sensors;
+	int channels;
+	int gpios;
+	bool ccf;
+};
+
+extern int fixture_create(const char *root, const struct fixture *fx);
+extern int fixture_remove(const char *root);
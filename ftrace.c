@@ -0,0 +1,911 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "mainloop.h"
+#include "utils.h"
+#include "ftrace.h"
+
+/* Maximum number of events followed */
+#define FTRACE_HANDLERS 16
+
+/* Name of the tracing instance holding the buffers of powerdebug */
+#define FTRACE_INSTANCE "powerdebug"
+
+/* Maximum number of pages decoded each time a buffer wakes up the mainloop */
+#define FTRACE_PAGES 64
+
+/* Flags stored by the kernel in the length of the data of a page */
+#define FTRACE_MISSED_EVENTS (1ULL << 31)
+#define FTRACE_MISSED_STORED (1ULL << 30)
+
+/* Types of the entries of a page, the records use the types up to 28 */
+#define FTRACE_PADDING		29
+#define FTRACE_TIME_EXTEND	30
+#define FTRACE_TIME_STAMP	31
+
+/* The time since the previous entry is given on 27 bits, extended above */
+#define FTRACE_TS_SHIFT		27
+#define FTRACE_TS_MSB		(~0ULL << 59)
+
+enum { FIELD_INT, FIELD_STRING, FIELD_DATA_LOC, FIELD_REL_LOC };
+
+/*
+ * Structure describing a field of a record, as given by a format file
+ *
+ * kind   : FIELD_INT, FIELD_STRING for a char array, FIELD_DATA_LOC or
+ *          FIELD_REL_LOC for a string stored after the fixed fields
+ * offset : the offset of the field in the record
+ * size   : the size of the field, 0 for an array up to the end of the record
+ * sign   : the integer is signed
+ */
+struct ftrace_field {
+	int kind;
+	int offset;
+	int size;
+	bool sign;
+};
+
+/*
+ * Structure describing an event followed
+ *
+ * system  : the name of the system of the event, "clk", "regulator", ...
+ * event   : the name of the event
+ * names   : the names of the fields decoded, NULL terminated
+ * cb      : the function called for each record
+ * data    : a pointer passed to the function
+ * id      : the type of the records of the event, -1 if not enabled
+ * nrfields : the number of fields decoded
+ * fields  : the fields decoded
+ * pending : records were passed since the end of the last read
+ * lost    : records were lost since the system was last checked
+ */
+struct ftrace_handler {
+	const char *system;
+	const char *event;
+	const char *const *names;
+	ftrace_callback_t cb;
+	void *data;
+	int id;
+	int nrfields;
+	struct ftrace_field fields[FTRACE_FIELDS];
+	bool pending;
+	bool lost;
+};
+
+/*
+ * Structure describing the trace buffer of a cpu
+ *
+ * cpu  : the number of the cpu
+ * fd   : the file descriptor of trace_pipe_raw
+ * pipe : the pipe the full pages are spliced in
+ */
+struct ftrace_cpu {
+	int cpu;
+	int fd;
+	int pipe[2];
+};
+
+static struct ftrace_handler handlers[FTRACE_HANDLERS];
+static int nrhandlers;
+
+static struct ftrace_cpu *cpus;
+static int nrcpus;
+
+/* The directory of the instance */
+static char ftrace_dir[PATH_MAX];
+
+/* The header of the pages and the type of the records */
+static struct ftrace_field page_time, page_commit, page_data;
+static struct ftrace_field record_type;
+
+/* The buffer the pages are read in */
+static char *ftrace_buf;
+static size_t ftrace_pagesize;
+
+/* The records are stamped with the CLOCK_MONOTONIC clock */
+static bool ftrace_mono;
+
+static bool ftrace_active;
+
+/*
+ * Register a function to be called for the records of an event, the
+ * events are enabled by ftrace_init.
+ *
+ * @system : the name of the system of the event, "clk", "regulator", ...
+ * @event  : the name of the event
+ * @fields : the names of the fields to be decoded, NULL terminated
+ * @cb     : the function to call
+ * @data   : a pointer passed to the function
+ * Returns 0 on success, -1 otherwise
+ */
+int ftrace_register(const char *system, const char *event,
+		    const char *const *fields, ftrace_callback_t cb, void *data)
+{
+	struct ftrace_handler *h;
+	int i;
+
+	/* the subsystems may be initialized again */
+	for (i = 0; i < nrhandlers; i++)
+		if (!strcmp(handlers[i].system, system) &&
+		    !strcmp(handlers[i].event, event) &&
+		    handlers[i].cb == cb && handlers[i].data == data)
+			return 0;
+
+	if (nrhandlers == FTRACE_HANDLERS)
+		return -1;
+
+	for (i = 0; fields[i]; i++)
+		if (i == FTRACE_FIELDS)
+			return -1;
+
+	h = &handlers[nrhandlers++];
+
+	memset(h, 0, sizeof(*h));
+	h->system = system;
+	h->event = event;
+	h->names = fields;
+	h->nrfields = i;
+	h->cb = cb;
+	h->data = data;
+	h->id = -1;
+
+	return 0;
+}
+
+/*
+ * Check if the values changed by the events of a system are followed
+ * with the trace buffers, so they do not need to be read again. The
+ * check fails once after some records were lost.
+ *
+ * @system : the name of the system
+ * Returns true if all the events of the system are followed
+ */
+bool ftrace_traced(const char *system)
+{
+	bool traced = false, lost = false;
+	int i;
+
+	if (!ftrace_active)
+		return false;
+
+	for (i = 0; i < nrhandlers; i++) {
+
+		if (strcmp(handlers[i].system, system))
+			continue;
+
+		if (handlers[i].id < 0)
+			return false;
+
+		traced = true;
+		lost |= handlers[i].lost;
+		handlers[i].lost = false;
+	}
+
+	return traced && !lost;
+}
+
+/*
+ * Write a value to a file of the instance.
+ * Returns 0 on success, -1 otherwise
+ */
+static int ftrace_write(const char *name, const char *value)
+{
+	char path[PATH_MAX];
+	ssize_t len;
+	int fd;
+
+	if (snprintf(path, sizeof(path), "%s/%s", ftrace_dir,
+		     name) >= sizeof(path))
+		return -1;
+
+	fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	len = write(fd, value, strlen(value));
+
+	close(fd);
+
+	return len == strlen(value) ? 0 : -1;
+}
+
+/*
+ * Parse a line of a format file describing a field, as:
+ *
+ *	field:__data_loc char[] name;	offset:8;	size:4;	signed:0;
+ *
+ * the name ends the declaration, maybe followed by the size of an array.
+ *
+ * @line  : the line, modified in place
+ * @field : the field to fill
+ * Returns the name of the field, NULL if the line is not a field
+ */
+static const char *ftrace_parse_field(char *line, struct ftrace_field *field)
+{
+	char *decl, *end, *name, *s;
+	bool array = false;
+	int sign;
+
+	decl = strstr(line, "field:");
+	if (!decl)
+		return NULL;
+	decl += 6;
+
+	end = strchr(decl, ';');
+	if (!end)
+		return NULL;
+	*end++ = '\0';
+
+	s = strstr(end, "offset:");
+	if (!s || parse_int(s + 7, &field->offset))
+		return NULL;
+
+	s = strstr(end, "size:");
+	if (!s || parse_int(s + 5, &field->size))
+		return NULL;
+
+	s = strstr(end, "signed:");
+	field->sign = s && !parse_int(s + 7, &sign) && sign;
+
+	s = decl + strlen(decl);
+	while (s > decl && s[-1] == ' ')
+		*--s = '\0';
+
+	if (s > decl && s[-1] == ']') {
+		s = strrchr(decl, '[');
+		if (!s)
+			return NULL;
+		*s = '\0';
+		array = true;
+	}
+
+	name = strrchr(decl, ' ');
+	name = name ? name + 1 : decl;
+
+	if (!strncmp(decl, "__data_loc", 10))
+		field->kind = FIELD_DATA_LOC;
+	else if (!strncmp(decl, "__rel_loc", 9))
+		field->kind = FIELD_REL_LOC;
+	else if (array && strstr(decl, "char"))
+		field->kind = FIELD_STRING;
+	else
+		field->kind = FIELD_INT;
+
+	return name;
+}
+
+/*
+ * Read a format file of the instance, the type of the records is given
+ * by the ID line followed by the fields.
+ *
+ * @path   : the path of the format file
+ * @names  : the names of the fields to look for, NULL terminated
+ * @fields : the fields found, in the order of the names
+ * Returns the type of the records, -1 if a field is missing
+ */
+static int ftrace_format(const char *path, const char *const *names,
+			 struct ftrace_field *fields)
+{
+	struct ftrace_field field;
+	unsigned long found = 0;
+	char line[256];
+	const char *name;
+	int i, nr, id = -1;
+	FILE *f;
+
+	for (nr = 0; names[nr]; nr++)
+		;
+
+	f = fopen(path, "re");
+	if (!f)
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+
+		if (!strncmp(line, "ID:", 3)) {
+			parse_int(line + 3, &id);
+			continue;
+		}
+
+		name = ftrace_parse_field(line, &field);
+		if (!name)
+			continue;
+
+		if (!strcmp(name, "common_type"))
+			record_type = field;
+
+		for (i = 0; i < nr; i++) {
+			if (!strcmp(name, names[i])) {
+				fields[i] = field;
+				found |= 1UL << i;
+			}
+		}
+	}
+
+	fclose(f);
+
+	return found == (1UL << nr) - 1 ? id : -1;
+}
+
+/*
+ * Read the header of the pages of the ring buffer, the data of a page
+ * follows the header up to the end of the page.
+ * Returns 0 on success, -1 otherwise
+ */
+static int ftrace_header(void)
+{
+	static const char *const names[] = {
+		"timestamp", "commit", "data", NULL
+	};
+	struct ftrace_field fields[3] = { { 0 } };
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/events/header_page",
+		     ftrace_dir) >= sizeof(path))
+		return -1;
+
+	/* the header has no ID line */
+	ftrace_format(path, names, fields);
+
+	page_time = fields[0];
+	page_commit = fields[1];
+	page_data = fields[2];
+
+	if (page_time.kind != FIELD_INT || page_commit.kind != FIELD_INT ||
+	    !page_time.size || !page_commit.size ||
+	    page_data.offset <= 0 || page_data.size <= 0)
+		return -1;
+
+	ftrace_pagesize = page_data.offset + page_data.size;
+
+	return 0;
+}
+
+static uint64_t ftrace_int(const char *rec, const struct ftrace_field *field)
+{
+	uint8_t u8;
+	uint16_t u16;
+	uint32_t u32;
+	uint64_t u64;
+
+	switch (field->size) {
+	case 1:
+		memcpy(&u8, rec + field->offset, sizeof(u8));
+		return field->sign ? (uint64_t)(int8_t)u8 : u8;
+	case 2:
+		memcpy(&u16, rec + field->offset, sizeof(u16));
+		return field->sign ? (uint64_t)(int16_t)u16 : u16;
+	case 4:
+		memcpy(&u32, rec + field->offset, sizeof(u32));
+		return field->sign ? (uint64_t)(int32_t)u32 : u32;
+	case 8:
+		memcpy(&u64, rec + field->offset, sizeof(u64));
+		return u64;
+	}
+
+	return 0;
+}
+
+/*
+ * Look for a string field of a record, the string must be terminated
+ * within the record.
+ *
+ * @rec   : the record
+ * @len   : the length of the record
+ * @field : the field
+ * Returns the string, NULL if it is not valid
+ */
+static const char *ftrace_string(const char *rec, int len,
+				 const struct ftrace_field *field)
+{
+	uint32_t loc;
+	int offset, size;
+
+	if (field->offset + field->size > len)
+		return NULL;
+
+	switch (field->kind) {
+	case FIELD_STRING:
+		offset = field->offset;
+		size = field->size ? field->size : len - offset;
+		break;
+	case FIELD_DATA_LOC:
+	case FIELD_REL_LOC:
+		loc = ftrace_int(rec, field);
+		offset = loc & 0xffff;
+		size = loc >> 16;
+		if (field->kind == FIELD_REL_LOC)
+			offset += field->offset + field->size;
+		break;
+	default:
+		return NULL;
+	}
+
+	if (size <= 0 || offset + size > len)
+		return NULL;
+
+	if (!memchr(rec + offset, '\0', size))
+		return NULL;
+
+	return rec + offset;
+}
+
+/*
+ * Decode a record and pass it to the functions registered for its event.
+ *
+ * @rec  : the record
+ * @len  : the length of the record
+ * @time : the time of the record
+ * @cpu  : the cpu the record was written on
+ */
+static void ftrace_record(const char *rec, int len, uint64_t time, int cpu)
+{
+	struct ftrace_record record;
+	struct ftrace_handler *h;
+	struct ftrace_field *field;
+	struct timespec ts;
+	bool valid;
+	int i, type;
+
+	if (record_type.offset + record_type.size > len)
+		return;
+
+	type = ftrace_int(rec, &record_type);
+
+	for (h = handlers; h < handlers + nrhandlers; h++) {
+
+		if (h->id != type)
+			continue;
+
+		if (!ftrace_mono) {
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			time = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		}
+
+		record.time = time;
+		record.cpu = cpu;
+
+		for (i = 0, valid = true; i < h->nrfields; i++) {
+
+			field = &h->fields[i];
+
+			record.values[i] = 0;
+			record.strings[i] = NULL;
+
+			if (field->kind != FIELD_INT) {
+				record.strings[i] = ftrace_string(rec, len, field);
+				if (!record.strings[i])
+					valid = false;
+			} else if (field->offset + field->size <= len)
+				record.values[i] = ftrace_int(rec, field);
+		}
+
+		/*
+		 * Only this record is skipped, the next ones are decoded,
+		 * and the values are read again as the record is lost
+		 */
+		if (!valid) {
+			h->lost = true;
+			continue;
+		}
+
+		h->cb(&record, h->data);
+		h->pending = true;
+	}
+}
+
+/*
+ * Decode a page of a trace buffer, made of a header giving the time of
+ * the first entry and the length of the data, then of the entries. An
+ * entry starts with a 32 bits word giving its type, the length of the
+ * small records in words, and the time elapsed since the previous entry.
+ *
+ * @page : the page
+ * @len  : the length read
+ * @cpu  : the cpu the page was written on
+ */
+static void ftrace_page(const char *page, size_t len, int cpu)
+{
+	const char *data, *end;
+	uint32_t header, array;
+	uint64_t time, commit;
+	int i, type, delta;
+	size_t size;
+
+	if (len < page_data.offset)
+		return;
+
+	time = ftrace_int(page, &page_time);
+	commit = ftrace_int(page, &page_commit);
+
+	/* the overwritten records are lost, the values have to be read */
+	if (commit & FTRACE_MISSED_EVENTS)
+		for (i = 0; i < nrhandlers; i++)
+			handlers[i].lost = true;
+
+	commit &= ~(FTRACE_MISSED_EVENTS | FTRACE_MISSED_STORED);
+
+	data = page + page_data.offset;
+	end = page + len;
+	if (commit < end - data)
+		end = data + commit;
+
+	for (; data + sizeof(header) <= end; data += size) {
+
+		memcpy(&header, data, sizeof(header));
+		type = header & 0x1f;
+		delta = header >> 5;
+
+		array = 0;
+		if (data + sizeof(header) + sizeof(array) <= end)
+			memcpy(&array, data + sizeof(header), sizeof(array));
+
+		switch (type) {
+		case FTRACE_PADDING:
+			/* the rest of the page is empty */
+			if (!delta)
+				return;
+			time += delta;
+			size = sizeof(header) + array;
+			break;
+		case FTRACE_TIME_EXTEND:
+			time += ((uint64_t)array << FTRACE_TS_SHIFT) + delta;
+			size = sizeof(header) + sizeof(array);
+			break;
+		case FTRACE_TIME_STAMP:
+			time = ((uint64_t)array << FTRACE_TS_SHIFT | delta) |
+				(time & FTRACE_TS_MSB);
+			size = sizeof(header) + sizeof(array);
+			break;
+		case 0:
+			/* the length of the big records is in the first word */
+			time += delta;
+			size = sizeof(header) + array;
+			if (array < sizeof(array) || data + size > end)
+				return;
+			ftrace_record(data + sizeof(header) + sizeof(array),
+				      array - sizeof(array), time, cpu);
+			break;
+		default:
+			time += delta;
+			size = sizeof(header) + type * 4;
+			if (data + size > end)
+				return;
+			ftrace_record(data + sizeof(header), type * 4, time, cpu);
+			break;
+		}
+
+		if (size <= sizeof(header))
+			return;
+	}
+}
+
+/*
+ * Tell the functions which received records that all the records read
+ * at once have been passed, once for each function.
+ */
+static void ftrace_flush(void)
+{
+	struct ftrace_handler *h, *other;
+
+	for (h = handlers; h < handlers + nrhandlers; h++) {
+
+		if (!h->pending)
+			continue;
+
+		for (other = h; other < handlers + nrhandlers; other++)
+			if (other->cb == h->cb)
+				other->pending = false;
+
+		h->cb(NULL, h->data);
+	}
+}
+
+/*
+ * Read the pages of the buffer of a cpu, the full pages are spliced to
+ * a pipe then read from the pipe without being copied by the kernel
+ * before. The page being written is copied when there is no full page
+ * left, so the records are passed as soon as they are written.
+ */
+static int ftrace_cpu_cb(int fd, void *data)
+{
+	struct ftrace_cpu *cpu = data;
+	ssize_t len;
+	int i;
+
+	for (i = 0; i < FTRACE_PAGES; i++) {
+
+		len = splice(fd, NULL, cpu->pipe[1], NULL, ftrace_pagesize,
+			     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (len > 0)
+			len = read(cpu->pipe[0], ftrace_buf, ftrace_pagesize);
+		else
+			len = read(fd, ftrace_buf, ftrace_pagesize);
+
+		if (len <= 0)
+			break;
+
+		ftrace_page(ftrace_buf, len, cpu->cpu);
+	}
+
+	ftrace_flush();
+
+	return 0;
+}
+
+static void ftrace_close_cpus(void)
+{
+	int i;
+
+	for (i = 0; i < nrcpus; i++) {
+		mainloop_del(cpus[i].fd);
+		close(cpus[i].fd);
+		close(cpus[i].pipe[0]);
+		close(cpus[i].pipe[1]);
+	}
+
+	free(cpus);
+	cpus = NULL;
+	nrcpus = 0;
+}
+
+static int ftrace_open_cpu(int nr)
+{
+	struct ftrace_cpu *cpu = &cpus[nrcpus];
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/per_cpu/cpu%d/trace_pipe_raw",
+		     ftrace_dir, nr) >= sizeof(path))
+		return -1;
+
+	cpu->cpu = nr;
+
+	cpu->fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (cpu->fd < 0)
+		return -1;
+
+	if (pipe2(cpu->pipe, O_CLOEXEC))
+		goto out_close;
+
+	/* a pipe holds 16 pages by default, the pages may be bigger */
+	if (ftrace_pagesize > 16 * getpagesize() &&
+	    fcntl(cpu->pipe[1], F_SETPIPE_SZ, ftrace_pagesize) < 0)
+		goto out_close_pipe;
+
+	if (mainloop_add(cpu->fd, ftrace_cpu_cb, cpu))
+		goto out_close_pipe;
+
+	nrcpus++;
+
+	return 0;
+
+out_close_pipe:
+	close(cpu->pipe[0]);
+	close(cpu->pipe[1]);
+out_close:
+	close(cpu->fd);
+	return -1;
+}
+
+/*
+ * Watch the buffer of each cpu of the instance from the mainloop.
+ * Returns 0 on success, -1 otherwise
+ */
+static int ftrace_open_cpus(void)
+{
+	char path[PATH_MAX];
+	struct dirent *d;
+	DIR *dir;
+	int nr, max = 0;
+
+	if (snprintf(path, sizeof(path), "%s/per_cpu",
+		     ftrace_dir) >= sizeof(path))
+		return -1;
+
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	while ((d = readdir(dir)))
+		if (!strncmp(d->d_name, "cpu", 3))
+			max++;
+
+	cpus = calloc(max, sizeof(*cpus));
+	if (!cpus)
+		goto out_close;
+
+	rewinddir(dir);
+
+	while ((d = readdir(dir)) && nrcpus < max) {
+
+		if (strncmp(d->d_name, "cpu", 3) ||
+		    parse_int(d->d_name + 3, &nr))
+			continue;
+
+		if (ftrace_open_cpu(nr))
+			goto out_close;
+	}
+
+	closedir(dir);
+
+	return nrcpus ? 0 : -1;
+
+out_close:
+	closedir(dir);
+	ftrace_close_cpus();
+	return -1;
+}
+
+static int ftrace_enable(struct ftrace_handler *h, bool enable)
+{
+	char name[PATH_MAX];
+
+	if (snprintf(name, sizeof(name), "events/%s/%s/enable", h->system,
+		     h->event) >= sizeof(name))
+		return -1;
+
+	return ftrace_write(name, enable ? "1" : "0");
+}
+
+/*
+ * Look for tracefs, mounted on its own or in debugfs by the old kernels.
+ *
+ * @path : the buffer to store the path of the tracefs directory
+ * @size : the size of the buffer
+ * Returns 0 on success, -1 if tracefs is not found
+ */
+static int ftrace_locate(char *path, size_t size)
+{
+	static const char *const dirs[] = {
+		"/sys/kernel/tracing", "/sys/kernel/debug/tracing",
+	};
+	char instances[PATH_MAX];
+	int i;
+
+	for (i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+
+		if (file_root_path(path, size, dirs[i]))
+			return -1;
+
+		if (snprintf(instances, sizeof(instances), "%s/instances",
+			     path) >= sizeof(instances))
+			return -1;
+
+		if (!access(instances, F_OK))
+			return 0;
+	}
+
+	return -1;
+}
+
+/*
+ * Enable the events registered with ftrace_register in a tracing
+ * instance of powerdebug, so the buffers are not shared with the other
+ * users of tracefs, and read the records from the mainloop. An instance
+ * left by a previous run is taken over.
+ *
+ * Returns 0 on success, -1 otherwise
+ */
+int ftrace_init(void)
+{
+	char tracefs[PATH_MAX];
+	char path[PATH_MAX];
+	struct ftrace_handler *h;
+	int nr = 0;
+
+	if (!nrhandlers || ftrace_active)
+		return -1;
+
+	if (ftrace_locate(tracefs, sizeof(tracefs)))
+		return -1;
+
+	if (snprintf(ftrace_dir, sizeof(ftrace_dir), "%s/instances/%s",
+		     tracefs, FTRACE_INSTANCE) >= sizeof(ftrace_dir))
+		return -1;
+
+	if (mkdir(ftrace_dir, 0755) && errno != EEXIST)
+		return -1;
+
+	if (ftrace_header())
+		goto out_rmdir;
+
+	ftrace_buf = malloc(ftrace_pagesize);
+	if (!ftrace_buf)
+		goto out_rmdir;
+
+	/* the records are then stamped as the samples of the history */
+	ftrace_mono = !ftrace_write("trace_clock", "mono");
+
+	/* wake up the mainloop as soon as a record is written */
+	ftrace_write("buffer_percent", "0");
+
+	for (h = handlers; h < handlers + nrhandlers; h++) {
+
+		h->id = -1;
+
+		if (snprintf(path, sizeof(path), "%s/events/%s/%s/format",
+			     ftrace_dir, h->system, h->event) >= sizeof(path))
+			continue;
+
+		h->id = ftrace_format(path, h->names, h->fields);
+		if (h->id < 0)
+			continue;
+
+		if (ftrace_enable(h, true)) {
+			h->id = -1;
+			continue;
+		}
+
+		nr++;
+	}
+
+	if (!nr || ftrace_open_cpus())
+		goto out_disable;
+
+	ftrace_active = true;
+
+	return 0;
+
+out_disable:
+	for (h = handlers; h < handlers + nrhandlers; h++) {
+		if (h->id >= 0)
+			ftrace_enable(h, false);
+		h->id = -1;
+	}
+	free(ftrace_buf);
+	ftrace_buf = NULL;
+out_rmdir:
+	rmdir(ftrace_dir);
+	return -1;
+}
+
+/*
+ * Stop reading the trace buffers and remove the instance.
+ */
+void ftrace_fini(void)
+{
+	struct ftrace_handler *h;
+
+	if (!ftrace_active)
+		return;
+
+	ftrace_close_cpus();
+
+	for (h = handlers; h < handlers + nrhandlers; h++) {
+		if (h->id >= 0)
+			ftrace_enable(h, false);
+		h->id = -1;
+	}
+
+	free(ftrace_buf);
+	ftrace_buf = NULL;
+
+	rmdir(ftrace_dir);
+
+	ftrace_active = false;
+}
@@ -0,0 +1,46 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+/* Maximum number of fields decoded in the records of an event */
+#define FTRACE_FIELDS 4
+
+/*
+ * Structure describing a record read from the trace buffers
+ *
+ * time    : the time of the record in ns, on the CLOCK_MONOTONIC clock
+ * cpu     : the cpu the record was written on
+ * values  : the integer fields, in the order of the names registered
+ * strings : the string fields, NULL for the integer ones
+ */
+struct ftrace_record {
+	uint64_t time;
+	int cpu;
+	uint64_t values[FTRACE_FIELDS];
+	const char *strings[FTRACE_FIELDS];
+};
+
+/*
+ * Function called for each record of an event, then once with a NULL
+ * record when all the records read at once have been passed, so the
+ * display is updated once
+ *
+ * rec  : the record, NULL at the end of the records read at once
+ * data : the pointer given to ftrace_register
+ */
+typedef int (*ftrace_callback_t)(const struct ftrace_record *rec, void *data);
+
+extern int ftrace_register(const char *system, const char *event,
+			   const char *const *fields, ftrace_callback_t cb,
+			   void *data);
+extern bool ftrace_traced(const char *system);
+extern int ftrace_init(void);
+extern void ftrace_fini(void);
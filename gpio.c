@@ -22,47 +22,75 @@
 #include <mntent.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/param.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
 
 #include "powerdebug.h"
 #include "display.h"
 #include "tree.h"
 #include "utils.h"
+#include "attr.h"
+#include "mainloop.h"
+#include "uevent.h"
+#include "row.h"
 
 #define SYSFS_GPIO "/sys/class/gpio"
 
+/*
+ * Attributes of a gpio:
+ * X(field, type, ctype, dim, header, width, flags)
+ */
+#define GPIO_ATTRS(X)							\
+	X(value,      VALUE_INT,    int,  ,            "Value",      10,	\
+	  ATTR_SHOW_DUMP)						\
+	X(active_low, VALUE_INT,    int,  ,            "Active_low", 10,	\
+	  ATTR_SHOW_DUMP)						\
+	X(edge,       VALUE_STRING, char, [VALUE_MAX], "Edge",       10,	\
+	  ATTR_SHOW_DUMP)						\
+	X(direction,  VALUE_STRING, char, [VALUE_MAX], "Direction",  10,	\
+	  ATTR_SHOW_DUMP)
+
 struct gpio_info {
+	GPIO_ATTRS(ATTR_FIELD)
+	attr_mask_t present;
+	int valuefd;
 	bool expanded;
-	int active_low;
-	int value;
-	int direction;
-	int edge;
 	char *prefix;
 } *gpios_info;
 
+#define GPIO_INDEX(field, ...) GPIO_ATTR_##field,
+
+enum { GPIO_ATTRS(GPIO_INDEX) };
+
+#define GPIO_DESC(...) ATTR_DESC(gpio_info, __VA_ARGS__)
+
+static const struct attr gpio_attrs[] = {
+	GPIO_ATTRS(GPIO_DESC)
+};
+
 static struct tree *gpio_tree = NULL;
 
-static struct gpio_info *gpio_alloc(void)
+static struct gpio_info *gpio_alloc(struct tree *t)
 {
 	struct gpio_info *gi;
 
-	gi = malloc(sizeof(*gi));
-	if (gi) {
-		memset(gi, -1, sizeof(*gi));
-		gi->prefix = NULL;
-	}
+	gi = tree_alloc_private(t, sizeof(*gi));
+	if (gi)
+		gi->valuefd = -1;
 
 	return gi;
 }
 
 static int gpio_filter_cb(const char *name)
 {
-	/* let's ignore some directories in order to avoid to be
-	 * pulled inside the sysfs circular symlinks mess/hell
-	 * (choose the word which fit better)
+	/* the links are followed without looping, but the device link
+	 * leads to the gpio controller, out of the gpio, and the
+	 * subsystem and the driver links lead to the other devices of
+	 * the bus, none of them is a gpio
 	 */
 	if (!strcmp(name, "device"))
 		return 1;
@@ -87,29 +115,30 @@ static int gpio_filter_cb(const char *name)
 static inline int read_gpio_cb(struct tree *t, void *data)
 {
 	struct gpio_info *gpio = t->private;
-	int gpio_num;
-	file_read_value(t->path, "base", "%d", &gpio_num);
-    file_write_value("/sys/class/gpio", "export","%d", gpio_num);
+	attr_mask_t mask = gpio->present;
 
+	/* the value of a watched gpio is updated by gpio_value_cb */
+	if (gpio->valuefd >= 0)
+		mask &= ~(1UL << GPIO_ATTR_value);
 
-	file_read_value(t->path, "active_low", "%d", &gpio->active_low);
-	file_read_value(t->path, "value", "%d", &gpio->value);
-	file_read_value(t->path, "edge", "%d", &gpio->edge);
-	file_read_value(t->path, "direction", "%d", &gpio->direction);
-
-	return 0;
+	return attr_batch(t, gpio_attrs, ATTR_COUNT(gpio_attrs), gpio, mask);
 }
 
 static int read_gpio_info(struct tree *tree)
 {
-	return tree_for_each(tree, read_gpio_cb, NULL);
+	if (tree_for_each(tree, read_gpio_cb, NULL))
+		return -1;
+
+	file_batch_submit();
+
+	return 0;
 }
 
 static int fill_gpio_cb(struct tree *t, void *data)
 {
 	struct gpio_info *gpio;
 
-	gpio = gpio_alloc();
+	gpio = gpio_alloc(t);
 	if (!gpio)
 		return -1;
 	t->private = gpio;
@@ -120,13 +149,22 @@ static int fill_gpio_cb(struct tree *t, void *data)
 		return 0;
 	}
 
+	gpio->present = attr_probe(t, gpio_attrs, ATTR_COUNT(gpio_attrs),
+				   attr_mask(gpio_attrs, ATTR_COUNT(gpio_attrs),
+					     ATTR_SHOW | ATTR_DUMP));
+
 	return read_gpio_cb(t, data);
 
 }
 
 static int fill_gpio_tree(void)
 {
-	return tree_for_each(gpio_tree, fill_gpio_cb, NULL);
+	if (tree_for_each(gpio_tree, fill_gpio_cb, NULL))
+		return -1;
+
+	file_batch_submit();
+
+	return 0;
 }
 
 static int dump_gpio_cb(struct tree *t, void *data)
@@ -147,19 +185,10 @@ static int dump_gpio_cb(struct tree *t, void *data)
 			     t->depth > 1 ? "   ": "", t->next ? "|" : " ") < 0)
 			return -1;
 
-	printf("%s%s-- %s (", gpio->prefix,  !t->next ? "`" : "", t->name);
-
-	if (gpio->active_low != -1)
-		printf(" active_low:%d", gpio->active_low);
-
-	if (gpio->value != -1)
-		printf(", value:%d", gpio->value);
+	printf("%s%s-- %s ( ", gpio->prefix,  !t->next ? "`" : "", t->name);
 
-	if (gpio->edge != -1)
-		printf(", edge:%d", gpio->edge);
-
-	if (gpio->direction != -1)
-		printf(", direction:%d", gpio->direction);
+	attr_dump(gpio_attrs, ATTR_COUNT(gpio_attrs), gpio, gpio->present,
+		  &attr_style_inline);
 
 	printf(" )\n");
 
@@ -183,37 +212,31 @@ int gpio_dump(void)
 	return ret;
 }
 
-static char *gpio_line(struct tree *t)
+static void gpio_line(struct tree *t, struct row *row)
 {
 	struct gpio_info *gpio = t->private;
-	char *gpioline;
 
-	if (asprintf(&gpioline, "%-20s %-10d %-10d %-10d %-10d", t-> name,
-		     gpio->value, gpio->active_low, gpio->edge, gpio->direction) < 0)
-		return NULL;
+	row_column(row, t->name, 20);
 
-	return gpioline;
+	attr_line(row, gpio_attrs, ATTR_COUNT(gpio_attrs), gpio,
+		  gpio->present);
 }
 
 static int _gpio_print_info_cb(struct tree *t, void *data)
 {
+	struct row *row = display_row(GPIO);
 	int *line = data;
-	char *buffer;
 
         /* we skip the root node of the tree */
 	if (!t->parent)
 		return 0;
 
-	buffer = gpio_line(t);
-	if (!buffer)
-		return -1;
+	gpio_line(t, row);
 
-	display_print_line(GPIO, *line, buffer, 0, t);
+	display_print_line(GPIO, *line, row, 0, t);
 
 	(*line)++;
 
-	free(buffer);
-
 	return 0;
 }
 
@@ -228,18 +251,15 @@ static int gpio_print_info_cb(struct tree *t, void *data)
 
 static int gpio_print_header(void)
 {
-	char *buf;
-	int ret;
-
-	if (asprintf(&buf, "%-20s %-10s %-10s %-10s %-10s",
-		     "Name", "Value", "Active_low", "Edge", "Direction") < 0)
-		return -1;
+	char buf[256];
+	int len;
 
-	ret = display_column_name(buf);
+	len = snprintf(buf, sizeof(buf), "%-20s ", "Name");
 
-	free(buf);
+	attr_header(buf + len, sizeof(buf) - len, gpio_attrs,
+		    ATTR_COUNT(gpio_attrs));
 
-	return ret;
+	return display_column_name(buf);
 }
 
 static int gpio_print_info(struct tree *tree)
@@ -269,18 +289,116 @@ static struct display_ops gpio_ops = {
 	.display = gpio_display,
 };
 
+#ifdef NCURES
+static int gpio_value_cb(int fd, void *data)
+{
+	struct tree *t = data;
+	struct gpio_info *gpio = t->private;
+
+	if (file_pread_value(fd, VALUE_INT, &gpio->value, sizeof(gpio->value)))
+		return 0;
+
+	display_update(GPIO);
+
+	return 0;
+}
+
+/*
+ * The value file of a gpio having an edge configured can be polled,
+ * the kernel signals a change with POLLPRI and POLLERR. These gpios
+ * are watched from the mainloop, their value is read when it changes
+ * instead of at each refresh.
+ */
+static int gpio_watch_cb(struct tree *t, void *data)
+{
+	struct gpio_info *gpio = t->private;
+	int fd;
+
+	if (!(gpio->present & (1UL << GPIO_ATTR_edge)) ||
+	    !(gpio->present & (1UL << GPIO_ATTR_value)))
+		return 0;
+
+	if (!strcmp(gpio->edge, "none"))
+		return 0;
+
+	fd = tree_open(t, "value");
+	if (fd < 0)
+		return 0;
+
+	if (mainloop_add_events(fd, EPOLLPRI | EPOLLERR, gpio_value_cb, t)) {
+		close(fd);
+		return 0;
+	}
+
+	gpio->valuefd = fd;
+
+	return 0;
+}
+#endif
+
+static int gpio_release_cb(struct tree *t, void *data)
+{
+	struct gpio_info *gpio = t->private;
+
+	if (!gpio)
+		return 0;
+
+	if (gpio->valuefd >= 0) {
+		mainloop_del(gpio->valuefd);
+		close(gpio->valuefd);
+	}
+
+	free(gpio->prefix);
+	tree_free_private(t, gpio, sizeof(*gpio));
+
+	return 0;
+}
+
+static int gpio_uevent_cb(int action, const char *name, void *data)
+{
+	struct tree *t;
+
+	if (action == UEVENT_REMOVE) {
+		if (tree_del(gpio_tree, name, gpio_release_cb, NULL))
+			return 0;
+		return display_update(GPIO);
+	}
+
+	t = tree_add(gpio_tree, name, gpio_filter_cb, true);
+	if (!t || t->private)
+		return 0;
+
+	if (tree_for_each(t, fill_gpio_cb, NULL))
+		return -1;
+
+	file_batch_submit();
+#ifdef NCURES
+	tree_for_each(t, gpio_watch_cb, NULL);
+#endif
+	return display_update(GPIO);
+}
+
 /*
  * Initialize the gpio framework
  */
 int gpio_init(void)
 {
-	gpio_tree = tree_load(SYSFS_GPIO, gpio_filter_cb, false);
+	char path[PATH_MAX];
+
+	if (file_root_path(path, sizeof(path), SYSFS_GPIO))
+		return -1;
+
+	gpio_tree = tree_load(path, gpio_filter_cb, true);
 	if (!gpio_tree)
 		return -1;
 
 	if (fill_gpio_tree())
 		return -1;
+
+	uevent_register("gpio", gpio_uevent_cb, NULL);
 #ifdef NCURES
+	tree_for_each(gpio_tree, gpio_watch_cb, NULL);
+
 	return display_register(GPIO, &gpio_ops);
 #else
 	return 0;
@@ -0,0 +1,379 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <time.h>
+
+#include "attr.h"
+#include "row.h"
+#include "utils.h"
+#include "history.h"
+
+/* Number of samples kept for each value, no history when zero */
+static int history_size;
+
+/*
+ * Set the number of samples kept in the history of each value, it has
+ * to be called before the trees are filled.
+ *
+ * @nr : the number of samples, zero to keep no history
+ * Returns 0 on success, -1 if the number is not valid
+ */
+int history_set_size(int nr)
+{
+	if (nr < 0)
+		return -1;
+
+	history_size = nr;
+
+	return 0;
+}
+
+bool history_enabled(void)
+{
+	return history_size > 0;
+}
+
+/*
+ * Allocate the history of a value, all the memory is allocated here so
+ * the samples are added without allocation.
+ * Returns the history, NULL if there is no history or on error
+ */
+struct history *history_alloc(void)
+{
+	struct history *h;
+
+	if (!history_size)
+		return NULL;
+
+	h = calloc(1, sizeof(*h) + history_size * sizeof(h->samples[0]));
+	if (!h)
+		return NULL;
+
+	h->size = history_size;
+
+	return h;
+}
+
+void history_free(struct history *h)
+{
+	free(h);
+}
+
+/*
+ * Returns the time of the samples in ns
+ */
+uint64_t history_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Look for the bin of a value, a bin is taken for a new value while
+ * there are some left, then the last bin is shared by the other values.
+ */
+static struct history_bin *history_bin(struct history *h, uint64_t value)
+{
+	int i;
+
+	for (i = 0; i < h->nrbins && i < HISTORY_BINS - 1; i++)
+		if (h->bins[i].value == value)
+			return &h->bins[i];
+
+	if (h->nrbins < HISTORY_BINS - 1) {
+		h->bins[h->nrbins].value = value;
+		return &h->bins[h->nrbins++];
+	}
+
+	h->nrbins = HISTORY_BINS;
+
+	return &h->bins[HISTORY_BINS - 1];
+}
+
+/*
+ * Add a sample to the history of a value, the time since the previous
+ * sample is counted for the previous value.
+ *
+ * @h     : the history of the value
+ * @time  : the time of the sample, as given by history_now
+ * @value : the value read
+ * @on    : the device is on
+ */
+void history_add(struct history *h, uint64_t time, uint64_t value, bool on)
+{
+	struct history_sample *prev;
+	uint64_t elapsed;
+
+	if (!h->nr) {
+		h->first = time;
+		h->min = h->max = value;
+	} else {
+		prev = &h->samples[(h->head + h->size - 1) % h->size];
+
+		/* the trace buffers of the cpus are not read in time order */
+		if (time < h->last)
+			time = h->last;
+
+		elapsed = time - h->last;
+
+		h->area += (double)prev->value * elapsed;
+		history_bin(h, prev->value)->time += elapsed;
+
+		if (value != prev->value)
+			h->changes++;
+
+		if (on != h->on)
+			h->toggles++;
+
+		if (value < h->min)
+			h->min = value;
+
+		if (value > h->max)
+			h->max = value;
+	}
+
+	h->last = time;
+	h->on = on;
+
+	h->samples[h->head].time = time;
+	h->samples[h->head].value = value;
+
+	h->head = (h->head + 1) % h->size;
+	if (h->nr < h->size)
+		h->nr++;
+}
+
+/*
+ * Returns the mean of the value weighted by the time spent at each
+ * value, the last value when the history covers no time
+ */
+double history_mean(struct history *h)
+{
+	if (h->last == h->first)
+		return h->samples[(h->head + h->size - 1) % h->size].value;
+
+	return h->area / (h->last - h->first);
+}
+
+/*
+ * Format a value of the history with the type of the attribute it is
+ * read from.
+ */
+static int history_format(char *buf, size_t size, const struct attr *attr,
+			  uint64_t value)
+{
+	int v = value;
+
+	if (attr->type == VALUE_INT)
+		return attr_format_value(buf, size, attr, &v);
+
+	return attr_format_value(buf, size, attr, &value);
+}
+
+/*
+ * Returns the share of the time spent in a bin, in percent
+ */
+static double history_share(struct history *h, struct history_bin *bin)
+{
+	if (h->last == h->first)
+		return 100;
+
+	return 100.0 * bin->time / (h->last - h->first);
+}
+
+/*
+ * Format the value of a bin and the share of the time spent at it.
+ */
+static int history_residency(char *buf, size_t size, struct history *h,
+			     const struct attr *attr, struct history_bin *bin)
+{
+	int len;
+
+	if (bin == &h->bins[HISTORY_BINS - 1] && h->nrbins == HISTORY_BINS)
+		len = snprintf(buf, size, "other");
+	else
+		len = history_format(buf, size, attr, bin->value);
+
+	if (len >= size)
+		return len;
+
+	return len + snprintf(buf + len, size - len, "=%.1f%%",
+			      history_share(h, bin));
+}
+
+/*
+ * Format the names of the columns of the history.
+ *
+ * @buf  : the buffer to store the line
+ * @size : the size of the buffer
+ * Returns the length of the line
+ */
+int history_header(char *buf, size_t size)
+{
+	return snprintf(buf, size, "%-10s %-10s %-10s %-7s %-16s ",
+			"Min", "Max", "Mean", "Toggles", "Residency");
+}
+
+/*
+ * Append a value of the history to a line, with the type of the
+ * attribute it is read from.
+ */
+static void history_row_value(struct row *row, const struct attr *attr,
+			      uint64_t value)
+{
+	int v = value;
+
+	if (attr->type == VALUE_INT)
+		attr_row_value(row, attr, &v);
+	else
+		attr_row_value(row, attr, &value);
+}
+
+/*
+ * Append the columns of the history to a line, the residency column
+ * gives the value the most time was spent at.
+ *
+ * @row  : the line
+ * @h    : the history, NULL if there is none
+ * @attr : the description of the attribute the values are read from
+ */
+void history_line(struct row *row, struct history *h, const struct attr *attr)
+{
+	struct history_bin *top = NULL;
+	int i, start;
+
+	if (!h || !h->nr) {
+		row_column(row, "-", 10);
+		row_column(row, "-", 10);
+		row_column(row, "-", 10);
+		row_column(row, "-", 7);
+		row_column(row, "-", 16);
+		return;
+	}
+
+	for (i = 0; i < h->nrbins; i++)
+		if (!top || h->bins[i].time > top->time)
+			top = &h->bins[i];
+
+	start = row->len;
+	history_row_value(row, attr, h->min);
+	row_pad(row, start, 10);
+
+	start = row->len;
+	history_row_value(row, attr, h->max);
+	row_pad(row, start, 10);
+
+	start = row->len;
+	history_row_value(row, attr, history_mean(h));
+	row_pad(row, start, 10);
+
+	start = row->len;
+	row_u64(row, h->toggles);
+	row_pad(row, start, 7);
+
+	start = row->len;
+
+	/* no time is counted before the second sample */
+	if (!top) {
+		row_str(row, "-");
+	} else {
+		if (top == &h->bins[HISTORY_BINS - 1] &&
+		    h->nrbins == HISTORY_BINS)
+			row_str(row, "other");
+		else
+			history_row_value(row, attr, top->value);
+
+		row_str(row, "=");
+		row_fixed(row, history_share(h, top), 1);
+		row_str(row, "%");
+	}
+
+	row_pad(row, start, 16);
+}
+
+/*
+ * Print the history to be dumped on the standard output, with the time
+ * spent at each value and the samples kept.
+ *
+ * @h    : the history, nothing is printed if NULL
+ * @attr  : the description of the attribute the values are read from
+ * @style : how the entries are printed
+ */
+void history_dump(struct history *h, const struct attr *attr,
+		  const struct attr_style *style)
+{
+	char value[NAME_MAX];
+	char buf[HISTORY_BINS * NAME_MAX];
+	struct history_sample *sample;
+	int i, len;
+
+	if (!h || !h->nr)
+		return;
+
+	history_format(value, sizeof(value), attr, h->min);
+	attr_dump_entry(style, "min", value);
+	printf("%s", style->sep);
+
+	history_format(value, sizeof(value), attr, h->max);
+	attr_dump_entry(style, "max", value);
+	printf("%s", style->sep);
+
+	history_format(value, sizeof(value), attr, history_mean(h));
+	attr_dump_entry(style, "mean", value);
+	printf("%s", style->sep);
+
+	snprintf(value, sizeof(value), "%u", h->changes);
+	attr_dump_entry(style, "changes", value);
+	printf("%s", style->sep);
+
+	snprintf(value, sizeof(value), "%u", h->toggles);
+	attr_dump_entry(style, "toggles", value);
+
+	for (i = 0, len = 0; i < h->nrbins && len < sizeof(buf); i++) {
+		len += snprintf(buf + len, sizeof(buf) - len, "%s", i ? " " : "");
+		if (len < sizeof(buf))
+			len += history_residency(buf + len, sizeof(buf) - len,
+						 h, attr, &h->bins[i]);
+	}
+
+	if (len) {
+		printf("%s", style->sep);
+		attr_dump_entry(style, "residency", buf);
+	}
+
+	printf("%s", style->sep);
+
+	/* the samples from the oldest, the time relative to the first one */
+	for (i = 0, len = 0; i < h->nr && len < sizeof(buf); i++) {
+
+		sample = &h->samples[(h->head + h->size - h->nr + i) % h->size];
+
+		len += snprintf(buf + len, sizeof(buf) - len, "%s", i ? " " : "");
+		if (len < sizeof(buf))
+			len += history_format(buf + len, sizeof(buf) - len,
+					      attr, sample->value);
+		if (len < sizeof(buf))
+			len += snprintf(buf + len, sizeof(buf) - len, "@%.3fs",
+					(sample->time - h->first) / 1e9);
+	}
+
+	attr_dump_entry(style, "samples", buf);
+}
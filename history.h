@@ -0,0 +1,91 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+struct attr;
+struct attr_style;
+struct row;
+
+/* Number of distinct values the time spent at is counted for */
+#define HISTORY_BINS 8
+
+/*
+ * Structure describing a value read at some time
+ *
+ * time  : the time of the read in ns
+ * value : the value read
+ */
+struct history_sample {
+	uint64_t time;
+	uint64_t value;
+};
+
+/*
+ * Structure describing the time spent at a value
+ *
+ * value : the value
+ * time  : the time spent at the value in ns
+ */
+struct history_bin {
+	uint64_t value;
+	uint64_t time;
+};
+
+/*
+ * Structure describing the history of a value, the statistics cover
+ * all the samples while the ring only keeps the last ones
+ *
+ * min     : the smallest value
+ * max     : the biggest value
+ * area    : the sum of the values weighted by the time spent at them
+ * first   : the time of the first sample
+ * last    : the time of the last sample
+ * changes : the number of times the value changed
+ * toggles : the number of times the device was switched on or off
+ * on      : the device was on at the last sample
+ * head    : the position of the next sample in the ring
+ * nr      : the number of samples in the ring
+ * size    : the number of samples the ring holds
+ * nrbins  : the number of bins used, the last bin counts the time spent
+ *           at the values without a bin when they are all used
+ * bins    : the time spent at each value
+ * samples : the ring of the last samples
+ */
+struct history {
+	uint64_t min;
+	uint64_t max;
+	double area;
+	uint64_t first;
+	uint64_t last;
+	unsigned int changes;
+	unsigned int toggles;
+	bool on;
+	int head;
+	int nr;
+	int size;
+	int nrbins;
+	struct history_bin bins[HISTORY_BINS];
+	struct history_sample samples[];
+};
+
+extern int history_set_size(int nr);
+extern bool history_enabled(void);
+extern struct history *history_alloc(void);
+extern void history_free(struct history *h);
+extern uint64_t history_now(void);
+extern void history_add(struct history *h, uint64_t time, uint64_t value,
+			bool on);
+extern double history_mean(struct history *h);
+extern int history_header(char *buf, size_t size);
+extern void history_line(struct row *row, struct history *h,
+			 const struct attr *attr);
+extern void history_dump(struct history *h, const struct attr *attr,
+			 const struct attr_style *style);
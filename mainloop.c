@@ -60,10 +60,20 @@ int mainloop(unsigned int timeout)
 	}
 }
 
-int mainloop_add(int fd, mainloop_callback_t cb, void *data)
+/*
+ * Call a function when some events occur on a file descriptor.
+ *
+ * @fd     : the file descriptor to watch
+ * @events : the epoll events to wait for, EPOLLIN, EPOLLPRI, ...
+ * @cb     : the function to call
+ * @data   : a pointer passed to the function
+ * Returns 0 on success, -1 otherwise
+ */
+int mainloop_add_events(int fd, unsigned int events,
+			mainloop_callback_t cb, void *data)
 {
 	struct epoll_event ev = {
-		.events = EPOLLIN,
+		.events = events,
 	};
 
 	struct mainloop_data *md;
@@ -94,6 +104,11 @@ int mainloop_add(int fd, mainloop_callback_t cb, void *data)
 	return 0;
 }
 
+int mainloop_add(int fd, mainloop_callback_t cb, void *data)
+{
+	return mainloop_add_events(fd, EPOLLIN, cb, data);
+}
+
 int mainloop_del(int fd)
 {
 	if (fd >= nrhandler)
@@ -17,6 +17,8 @@ typedef int (*mainloop_callback_t)(int fd, void *data);
 
 extern int mainloop(unsigned int timeout);
 extern int mainloop_add(int fd, mainloop_callback_t cb, void *data);
+extern int mainloop_add_events(int fd, unsigned int events,
+			       mainloop_callback_t cb, void *data);
 extern int mainloop_del(int fd);
 extern int mainloop_init(void);
 extern void mainloop_fini(void);
@@ -15,6 +15,7 @@
 
 #include <getopt.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -28,6 +29,12 @@
 #include "sensor.h"
 #include "gpio.h"
 #include "mainloop.h"
+#include "uevent.h"
+#include "utils.h"
+#include "tree.h"
+#include "snapshot.h"
+#include "history.h"
+#include "ftrace.h"
 #include "powerdebug.h"
 
 void usage(void)
@@ -44,6 +51,15 @@ void usage(void)
 	printf("  -p, --findparents	Show all parents for a particular"
 		" clock\n");
 	printf("  -t, --time		Set ticktime in seconds (eg. 10.0)\n");
+	printf("  -R, --root		Look for sysfs and debugfs in a"
+		" directory\n");
+	printf("  -C, --cache		Keep the trees in a directory, empty"
+		" to disable\n");
+	printf("  -H, --history		Keep the last samples of the clock rates"
+		" and the\n\t\t\tregulator voltages (eg. 64)\n");
+	printf("  -T, --trace		Follow the clocks, the regulators and"
+		" the cpu\n\t\t\tfrequencies with the kernel"
+		" tracepoints\n");
 	printf("  -d, --dump		Dump information once (no refresh)\n");
 	printf("  -v, --verbose		Verbose mode (use with -r and/or"
 		" -s)\n");
@@ -64,6 +80,10 @@ void version()
  * -g, --gpio           : gpios
  * -p, --findparents    : clockname whose parents have to be found
  * -t, --time		: ticktime
+ * -R, --root		: directory containing the sysfs and debugfs trees
+ * -C, --cache		: directory where the trees are kept between runs
+ * -H, --history	: number of samples kept for each clock and regulator
+ * -T, --trace		: follow the clocks, regulators and cpu frequencies
  * -d, --dump		: dump
  * -v, --verbose	: verbose
  * -V, --version	: version
@@ -78,6 +98,10 @@ static struct option long_options[] = {
 	{ "gpio",  0, 0, 'g' },
 	{ "findparents", 1, 0, 'p' },
 	{ "time", 1, 0, 't' },
+	{ "root", 1, 0, 'R' },
+	{ "cache", 1, 0, 'C' },
+	{ "history", 1, 0, 'H' },
+	{ "trace", 0, 0, 'T' },
 	{ "dump", 0, 0, 'd' },
 	{ "verbose", 0, 0, 'v' },
 	{ "version", 0, 0, 'V' },
@@ -95,6 +119,10 @@ struct powerdebug_options {
 	unsigned int ticktime;
 	int selectedwindow;
 	char *clkname;
+	char *root;
+	char *cache;
+	int history;
+	bool trace;
 };
 
 int getoptions(int argc, char *argv[], struct powerdebug_options *options)
@@ -108,7 +136,7 @@ int getoptions(int argc, char *argv[], struct powerdebug_options *options)
 	while (1) {
 		int optindex = 0;
 
-		c = getopt_long(argc, argv, "rscgp:t:dvVh",
+		c = getopt_long(argc, argv, "rscgp:t:R:C:H:TdvVh",
 				long_options, &optindex);
 		if (c == -1)
 			break;
@@ -142,6 +170,18 @@ int getoptions(int argc, char *argv[], struct powerdebug_options *options)
 		case 't':
 			options->ticktime = atoi(optarg);
 			break;
+		case 'R':
+			options->root = optarg;
+			break;
+		case 'C':
+			options->cache = optarg;
+			break;
+		case 'H':
+			options->history = atoi(optarg);
+			break;
+		case 'T':
+			options->trace = true;
+			break;
 		case 'd':
 			options->dump = true;
 			break;
@@ -190,15 +230,25 @@ static int powerdebug_dump(struct powerdebug_options *options)
 #ifdef NCURES
 static int powerdebug_display(struct powerdebug_options *options)
 {
+	int ret;
+
 	if (display_init(options->selectedwindow)) {
 		printf("failed to initialize display\n");
 		return -1;
 	}
 
-	if (mainloop(options->ticktime * 1000))
-		return -1;
+	/* without the hotplug events, the devices added later are not shown */
+	uevent_init();
 
-	return 0;
+	/* the values traced are no longer read, polling them is the fallback */
+	if (options->trace)
+		ftrace_init();
+
+	ret = mainloop(options->ticktime * 1000);
+
+	ftrace_fini();
+
+	return ret ? -1 : 0;
 }
 #endif
 
@@ -231,6 +281,17 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (file_set_root(options->root)) {
+		fprintf(stderr, "invalid root directory\n");
+		return 1;
+	}
+
+	if (snapshot_set_dir(options->cache))
+		fprintf(stderr, "invalid cache directory, not used\n");
+
+	if (history_set_size(options->history))
+		fprintf(stderr, "invalid history size, no history kept\n");
+
 	if (mainloop_init()) {
 		fprintf(stderr, "failed to initialize the mainloop\n");
 		return 1;
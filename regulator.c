@@ -18,92 +18,201 @@
 #include "regulator.h"
 
 #define SYSFS_REGULATOR "/sys/class/regulator"
-#define VALUE_MAX 16
 
 #define _GNU_SOURCE
 #include <stdio.h>
 #undef _GNU_SOURCE
 #include <sys/types.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <dirent.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include "display.h"
 #include "powerdebug.h"
 #include "tree.h"
 #include "utils.h"
+#include "attr.h"
+#include "snapshot.h"
+#include "uevent.h"
+#include "history.h"
+#include "ftrace.h"
+#include "row.h"
+
+/*
+ * Attributes of a regulator:
+ * X(field, type, ctype, dim, header, width, flags)
+ */
+#define REGULATOR_ATTRS(X)						\
+	X(name,           VALUE_STRING, char, [NAME_MAX],  "Name",        11,	\
+	  ATTR_SHOW_DUMP | ATTR_STATIC)					\
+	X(status,         VALUE_STRING, char, [VALUE_MAX], "Status",      11,	\
+	  ATTR_SHOW_DUMP)						\
+	X(state,          VALUE_STRING, char, [VALUE_MAX], "State",       11,	\
+	  ATTR_SHOW_DUMP)						\
+	X(type,           VALUE_STRING, char, [VALUE_MAX], "Type",        11,	\
+	  ATTR_SHOW_DUMP | ATTR_STATIC)					\
+	X(num_users,      VALUE_INT,    int,  ,            "Users",       11,	\
+	  ATTR_SHOW_DUMP)						\
+	X(microvolts,     VALUE_INT,    int,  ,            "Microvolts",  11,	\
+	  ATTR_SHOW_DUMP)						\
+	X(min_microvolts, VALUE_INT,    int,  ,            "Min u-volts", 11,	\
+	  ATTR_SHOW_DUMP | ATTR_STATIC)					\
+	X(max_microvolts, VALUE_INT,    int,  ,            "Max u-volts", 12,	\
+	  ATTR_SHOW_DUMP | ATTR_STATIC)					\
+	X(opmode,         VALUE_STRING, char, [VALUE_MAX], "Opmode",      11,	\
+	  ATTR_DUMP)							\
+	X(microamps,      VALUE_INT,    int,  ,            "Microamps",   11,	\
+	  ATTR_DUMP)							\
+	X(min_microamps,  VALUE_INT,    int,  ,            "Min u-amps",  11,	\
+	  ATTR_DUMP | ATTR_STATIC)					\
+	X(max_microamps,  VALUE_INT,    int,  ,            "Max u-amps",  11,	\
+	  ATTR_DUMP | ATTR_STATIC)					\
+	X(requested_microamps,						\
+			  VALUE_INT,    int,  ,            "Req u-amps",  11,	\
+	  ATTR_DUMP)
 
 struct regulator_info {
-	char name[NAME_MAX];
-	char state[VALUE_MAX];
-	char status[VALUE_MAX];
-	char type[VALUE_MAX];
-	char opmode[VALUE_MAX];
-	int microvolts;
-	int min_microvolts;
-	int max_microvolts;
-	int microamps;
-	int min_microamps;
-	int max_microamps;
-	int requested_microamps;
-	int num_users;
+	REGULATOR_ATTRS(ATTR_FIELD)
+	attr_mask_t present;
+	struct history *history;
 };
 
-struct regulator_data {
-	const char *name;
-	const char *ifmt;
-	const char *ofmt;
-	bool derefme;
-};
+#define REGULATOR_INDEX(field, ...) REGULATOR_ATTR_##field,
+
+enum { REGULATOR_ATTRS(REGULATOR_INDEX) };
+
+/* Attributes changed by the events of the regulator framework */
+#define REGULATOR_TRACED \
+	(1UL << REGULATOR_ATTR_state | 1UL << REGULATOR_ATTR_microvolts)
+
+#define REGULATOR_DESC(...) ATTR_DESC(regulator_info, __VA_ARGS__)
 
-static struct regulator_data regdata[] = {
-	{ "name",           "%s", "\tname: %s\n"                 },
-	{ "status",         "%s", "\tstatus: %s\n"               },
-	{ "state",          "%s", "\tstate: %s\n"                },
-	{ "type",           "%s", "\ttype: %s\n"                 },
-	{ "num_users",      "%d", "\tnum_users: %d\n",      true },
-	{ "microvolts",     "%d", "\tmicrovolts: %d\n",     true },
-	{ "max_microvolts", "%d", "\tmax_microvolts: %d\n", true },
-	{ "min_microvolts", "%d", "\tmin_microvolts: %d\n", true },
+static const struct attr regulator_attrs[] = {
+	REGULATOR_ATTRS(REGULATOR_DESC)
 };
 
 static struct tree *reg_tree;
 
-static struct regulator_info *regulator_alloc(void)
+/*
+ * The regulators having a name, sorted by name. The array is built at
+ * the first lookup after the tree changed.
+ */
+static struct tree **reg_names;
+static int reg_nrnames;
+static bool reg_names_valid;
+
+/* The attribute whose values are kept in the history of the regulators */
+static const struct attr *regulator_voltage;
+
+/* Attributes not read again when the regulators are refreshed */
+static attr_mask_t regulator_static;
+
+/* Attributes updated from the trace buffers, not read by the refreshes */
+static attr_mask_t regulator_traced;
+static bool regulator_tracing;
+
+enum { REGULATOR_TRACE_ENABLE, REGULATOR_TRACE_DISABLE,
+       REGULATOR_TRACE_VOLTAGE };
+
+static const char *const regulator_name_fields[] = { "name", NULL };
+static const char *const regulator_voltage_fields[] = { "name", "val", NULL };
+
+/*
+ * Events of the regulator framework changing a regulator, they are
+ * traced when the hardware is switched or set
+ *
+ * name   : the name of the event
+ * fields : the fields of the records, the name of the regulator first
+ * action : REGULATOR_TRACE_*
+ */
+static const struct regulator_event {
+	const char *name;
+	const char *const *fields;
+	int action;
+} regulator_events[] = {
+	{ "regulator_enable_complete",      regulator_name_fields,
+	  REGULATOR_TRACE_ENABLE },
+	{ "regulator_disable_complete",     regulator_name_fields,
+	  REGULATOR_TRACE_DISABLE },
+	{ "regulator_set_voltage_complete", regulator_voltage_fields,
+	  REGULATOR_TRACE_VOLTAGE },
+};
+
+static struct regulator_info *regulator_alloc(struct tree *t)
 {
-	struct regulator_info *regi;
+	return tree_alloc_private(t, sizeof(struct regulator_info));
+}
 
-	regi = malloc(sizeof(*regi));
-	if (regi)
-		memset(regi, 0, sizeof(*regi));
+static inline int read_regulator_cb(struct tree *t, void *data)
+{
+	struct regulator_info *reg = t->private;
+	attr_mask_t skip = regulator_static | regulator_traced;
 
-	return regi;
+	return attr_batch(t, regulator_attrs, ATTR_COUNT(regulator_attrs),
+			  reg, reg->present & ~skip);
+}
+
+static int regulator_history_cb(struct tree *t, void *data)
+{
+	struct regulator_info *reg = t->private;
+	uint64_t *now = data;
+
+	if (reg->history)
+		history_add(reg->history, *now, reg->microvolts,
+			    !strcmp(reg->state, "enabled"));
+
+	return 0;
+}
+
+static int read_regulator_info(struct tree *tree)
+{
+	bool tracing = ftrace_traced("regulator");
+	uint64_t now;
+
+	/* the values are read again when tracing starts or records are lost */
+	regulator_traced = tracing && regulator_tracing ? REGULATOR_TRACED : 0;
+	regulator_tracing = tracing;
+
+	if (tree_for_each(tree, read_regulator_cb, NULL))
+		return -1;
+
+	file_batch_submit();
+
+	/* the histories are fed by the records of the trace buffers */
+	if (regulator_traced || !history_enabled())
+		return 0;
+
+	now = history_now();
+
+	return tree_for_each(tree, regulator_history_cb, &now);
 }
 
 static int regulator_dump_cb(struct tree *tree, void *data)
 {
-	int i;
-	char buffer[NAME_MAX];
-	size_t nregdata = sizeof(regdata) / sizeof(regdata[0]);
+	struct regulator_info *reg = tree->private;
 
 	if (!strncmp("regulator.", tree->name, strlen("regulator.")))
 		printf("\n%s:\n", tree->name);
 
-	for (i = 0; i < nregdata; i++) {
+	/* the nodes without name are not regulators */
+	if (!strlen(reg->name))
+		return 0;
 
-		if (file_read_value(tree->path, regdata[i].name,
-				    regdata[i].ifmt, buffer))
-			continue;
+	attr_dump(regulator_attrs, ATTR_COUNT(regulator_attrs), reg,
+		  reg->present, &attr_style_lines);
 
-		printf(regdata[i].ofmt, regdata[i].derefme ?
-		       *((int *)buffer) : buffer);
-	}
+	history_dump(reg->history, regulator_voltage, &attr_style_lines);
 
 	return 0;
 }
 
 int regulator_dump(void)
 {
+	if (read_regulator_info(reg_tree))
+		return -1;
+
 	printf("\nRegulator Information:\n");
 	printf("*********************\n\n");
 
@@ -113,8 +222,8 @@ int regulator_dump(void)
 static int regulator_display_cb(struct tree *t, void *data)
 {
 	struct regulator_info *reg = t->private;
+	struct row *row = display_row(REGULATOR);
 	int *line = data;
-	char *buf;
 
         /* we skip the root node of the tree */
 	if (!t->parent)
@@ -123,43 +232,40 @@ static int regulator_display_cb(struct tree *t, void *data)
 	if (!strlen(reg->name))
 		return 0;
 
-	if (asprintf(&buf, "%-11s %-11s %-11s %-11s %-11d %-11d %-11d %-12d",
-		     reg->name, reg->status, reg->state, reg->type,
-		     reg->num_users, reg->microvolts, reg->min_microvolts,
-		     reg->max_microvolts) < 0)
-		return -1;
+	attr_line(row, regulator_attrs, ATTR_COUNT(regulator_attrs), reg,
+		  reg->present);
 
-	display_print_line(REGULATOR, *line, buf, reg->num_users, t);
+	if (history_enabled())
+		history_line(row, reg->history, regulator_voltage);
 
-	(*line)++;
+	display_print_line(REGULATOR, *line, row, reg->num_users, t);
 
-	free(buf);
+	(*line)++;
 
 	return 0;
 }
 
 static int regulator_print_header(void)
 {
-	char *buf;
-	int ret;
-
-	if (asprintf(&buf, "%-11s %-11s %-11s %-11s %-11s %-11s %-11s %-12s",
-		     "Name", "Status", "State", "Type", "Users", "Microvolts",
-		     "Min u-volts", "Max u-volts") < 0)
-		return -1;
+	char buf[256];
+	int len;
 
-	ret = display_column_name(buf);
+	len = attr_header(buf, sizeof(buf), regulator_attrs,
+			  ATTR_COUNT(regulator_attrs));
 
-	free(buf);
-
-	return ret;
+	if (history_enabled() && len < sizeof(buf))
+		history_header(buf + len, sizeof(buf) - len);
 
+	return display_column_name(buf);
 }
 
 static int regulator_display(bool refresh)
 {
 	int ret, line = 0;
 
+	if (refresh && read_regulator_info(reg_tree))
+		return -1;
+
 	display_reset_cursor(REGULATOR);
 
 	regulator_print_header();
@@ -173,9 +279,10 @@ static int regulator_display(bool refresh)
 
 static int regulator_filter_cb(const char *name)
 {
-	/* let's ignore some directories in order to avoid to be
-	 * pulled inside the sysfs circular symlinks mess/hell
-	 * (choose the word which fit better)
+	/* the links are followed without looping, but the device link
+	 * leads to the parent device, out of the regulator, and the
+	 * subsystem and the driver links lead to the other devices of
+	 * the bus, none of them is a regulator
 	 */
 	if (!strcmp(name, "device"))
 		return 1;
@@ -189,45 +296,230 @@ static int regulator_filter_cb(const char *name)
 	return 0;
 }
 
-static inline int read_regulator_cb(struct tree *t, void *data)
+/*
+ * Allocate the private data of a regulator and read its attributes.
+ *
+ * @t    : the node of the regulator
+ * @data : the snapshot the tree was loaded from, giving the attributes
+ *         found in the directory, or NULL to look for them
+ * Returns 0 on success, < 0 otherwise
+ */
+static int fill_regulator_cb(struct tree *t, void *data)
+{
+	struct snapshot *snap = data;
+	struct regulator_info *reg;
+
+	reg = regulator_alloc(t);
+	if (!reg)
+		return -1;
+	t->private = reg;
+
+        /* we skip the root node but we set it expanded for its children */
+	if (!t->parent)
+		return 0;
+
+	if (snap)
+		reg->present = snapshot_mask(snap, t);
+	else
+		reg->present = attr_probe(t, regulator_attrs,
+					  ATTR_COUNT(regulator_attrs),
+					  attr_mask(regulator_attrs,
+						    ATTR_COUNT(regulator_attrs),
+						    ATTR_SHOW | ATTR_DUMP));
+
+	if (history_enabled()) {
+		reg->history = history_alloc();
+		if (!reg->history)
+			return -1;
+	}
+
+	return attr_batch(t, regulator_attrs, ATTR_COUNT(regulator_attrs),
+			  reg, reg->present);
+}
+
+static unsigned long regulator_mask_cb(struct tree *t)
 {
 	struct regulator_info *reg = t->private;
 
-	file_read_value(t->path, "name", "%s", reg->name);
-	file_read_value(t->path, "state", "%s", reg->state);
-	file_read_value(t->path, "status", "%s", reg->status);
-	file_read_value(t->path, "type", "%s", reg->type);
-	file_read_value(t->path, "opmode", "%s", reg->opmode);
-	file_read_value(t->path, "num_users", "%d", &reg->num_users);
-	file_read_value(t->path, "microvolts", "%d", &reg->microvolts);
-	file_read_value(t->path, "min_microvolts", "%d", &reg->min_microvolts);
-	file_read_value(t->path, "max_microvolts", "%d", &reg->max_microvolts);
-	file_read_value(t->path, "microamps", "%d", &reg->microamps);
-	file_read_value(t->path, "min_microamps", "%d", &reg->min_microamps);
-	file_read_value(t->path, "max_microamps", "%d", &reg->max_microamps);
+	return reg->present;
+}
+
+static int fill_regulator_tree(struct snapshot *snap)
+{
+	regulator_static = attr_mask(regulator_attrs,
+				     ATTR_COUNT(regulator_attrs), ATTR_STATIC);
+
+	if (tree_for_each(reg_tree, fill_regulator_cb, snap))
+		return -1;
+
+	file_batch_submit();
 
 	return 0;
 }
 
-static int fill_regulator_cb(struct tree *t, void *data)
+static int regulator_release_cb(struct tree *t, void *data)
 {
-	struct regulator_info *reg;
+	struct regulator_info *reg = t->private;
 
-	reg = regulator_alloc();
 	if (!reg)
-		return -1;
-	t->private = reg;
+		return 0;
 
-        /* we skip the root node but we set it expanded for its children */
-	if (!t->parent)
+	history_free(reg->history);
+	tree_free_private(t, reg, sizeof(*reg));
+
+	return 0;
+}
+
+static int regulator_uevent_cb(int action, const char *name, void *data)
+{
+	struct tree *t;
+
+	/* the nodes sorted by name may be freed or be missing one */
+	reg_names_valid = false;
+
+	if (action == UEVENT_REMOVE) {
+		if (tree_del(reg_tree, name, regulator_release_cb, NULL))
+			return 0;
+		return display_update(REGULATOR);
+	}
+
+	t = tree_add(reg_tree, name, regulator_filter_cb, true);
+	if (!t || t->private)
 		return 0;
 
-	return read_regulator_cb(t, data);
+	if (tree_for_each(t, fill_regulator_cb, NULL))
+		return -1;
+
+	file_batch_submit();
+
+	return display_update(REGULATOR);
 }
 
-static int fill_regulator_tree(void)
+static int regulator_count_cb(struct tree *t, void *data)
 {
-	return tree_for_each(reg_tree, fill_regulator_cb, NULL);
+	int *nr = data;
+
+	(*nr)++;
+
+	return 0;
+}
+
+static int regulator_names_cb(struct tree *t, void *data)
+{
+	struct regulator_info *reg = t->private;
+
+	if (t->parent && reg->name[0])
+		reg_names[reg_nrnames++] = t;
+
+	return 0;
+}
+
+static int regulator_names_cmp(const void *a, const void *b)
+{
+	const struct tree *ta = *(struct tree *const *)a;
+	const struct tree *tb = *(struct tree *const *)b;
+	const struct regulator_info *ra = ta->private;
+	const struct regulator_info *rb = tb->private;
+
+	return strcmp(ra->name, rb->name);
+}
+
+static int regulator_name_cmp(const void *key, const void *elem)
+{
+	const struct tree *t = *(struct tree *const *)elem;
+	const struct regulator_info *reg = t->private;
+
+	return strcmp(key, reg->name);
+}
+
+/*
+ * Sort the regulators by their name, to look up the regulator of a
+ * record of the trace buffers.
+ * Returns 0 on success, -1 otherwise
+ */
+static int regulator_names_build(void)
+{
+	struct tree **names;
+	int nr = 0;
+
+	tree_for_each(reg_tree, regulator_count_cb, &nr);
+
+	names = realloc(reg_names, nr * sizeof(*names));
+	if (nr && !names)
+		return -1;
+
+	reg_names = names;
+	reg_nrnames = 0;
+
+	tree_for_each(reg_tree, regulator_names_cb, NULL);
+
+	qsort(reg_names, reg_nrnames, sizeof(*reg_names),
+	      regulator_names_cmp);
+
+	reg_names_valid = true;
+
+	return 0;
+}
+
+/*
+ * Find a regulator by its name, the records give the name of the
+ * regulator and not the name of its directory.
+ *
+ * @name : the name of the regulator
+ * Returns the node of the regulator, NULL if not found
+ */
+static struct tree *regulator_find(const char *name)
+{
+	struct tree **t;
+
+	if (!reg_names_valid && regulator_names_build())
+		return NULL;
+
+	t = bsearch(name, reg_names, reg_nrnames, sizeof(*reg_names),
+		    regulator_name_cmp);
+
+	return t ? *t : NULL;
+}
+
+/*
+ * Apply a record of the trace buffers to its regulator.
+ *
+ * @rec  : the record, NULL when all the records read at once are applied
+ * @data : the event of the record
+ * Returns 0 on success, < 0 otherwise
+ */
+static int regulator_trace_cb(const struct ftrace_record *rec, void *data)
+{
+	const struct regulator_event *event = data;
+	struct regulator_info *reg;
+	struct tree *t;
+
+	if (!rec)
+		return display_update(REGULATOR);
+
+	t = regulator_find(rec->strings[0]);
+	if (!t)
+		return 0;
+
+	reg = t->private;
+
+	switch (event->action) {
+	case REGULATOR_TRACE_ENABLE:
+		snprintf(reg->state, sizeof(reg->state), "enabled");
+		break;
+	case REGULATOR_TRACE_DISABLE:
+		snprintf(reg->state, sizeof(reg->state), "disabled");
+		break;
+	case REGULATOR_TRACE_VOLTAGE:
+		reg->microvolts = rec->values[1];
+		break;
+	}
+
+	if (reg->history)
+		history_add(reg->history, rec->time, reg->microvolts,
+			    !strcmp(reg->state, "enabled"));
+
+	return 0;
 }
 
 static struct display_ops regulator_ops = {
@@ -236,12 +528,40 @@ static struct display_ops regulator_ops = {
 
 int regulator_init(void)
 {
-	reg_tree = tree_load(SYSFS_REGULATOR, regulator_filter_cb, false);
+	char path[PATH_MAX];
+	struct snapshot *snap;
+	unsigned int key;
+	int i, ret;
+
+	if (file_root_path(path, sizeof(path), SYSFS_REGULATOR))
+		return -1;
+
+	reg_names_valid = false;
+
+	key = attr_key(regulator_attrs, ATTR_COUNT(regulator_attrs));
+
+	for (i = 0; i < ATTR_COUNT(regulator_attrs); i++)
+		if (!strcmp(regulator_attrs[i].name, "microvolts"))
+			regulator_voltage = &regulator_attrs[i];
+
+	for (i = 0; i < ATTR_COUNT(regulator_events); i++)
+		ftrace_register("regulator", regulator_events[i].name,
+				regulator_events[i].fields, regulator_trace_cb,
+				(void *)&regulator_events[i]);
+
+	reg_tree = snapshot_load("regulator", path, key, regulator_filter_cb,
+				 true, &snap);
 	if (!reg_tree)
 		return -1;
 
-	if (fill_regulator_tree())
+	ret = fill_regulator_tree(snap);
+
+	snapshot_save(snap, "regulator", reg_tree, key, regulator_mask_cb);
+
+	if (ret)
 		return -1;
+
+	uevent_register("regulator", regulator_uevent_cb, NULL);
 #ifdef NCURES
 	return display_register(REGULATOR, &regulator_ops);
 #else
@@ -0,0 +1,274 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "row.h"
+
+/*
+ * The lines of the panels are formatted by hand instead of snprintf, a
+ * refresh formats every line shown and the format strings are parsed
+ * again for each value.
+ */
+
+static void row_append(struct row *row, const char *s, int len)
+{
+	if (len > ROW_MAX - 1 - row->len)
+		len = ROW_MAX - 1 - row->len;
+
+	memcpy(row->buf + row->len, s, len);
+	row->len += len;
+	row->buf[row->len] = '\0';
+}
+
+void row_str(struct row *row, const char *s)
+{
+	row_append(row, s, strlen(s));
+}
+
+/*
+ * Append a character several times, for the padding and the indentation.
+ */
+void row_chars(struct row *row, char c, int nr)
+{
+	if (nr > ROW_MAX - 1 - row->len)
+		nr = ROW_MAX - 1 - row->len;
+
+	if (nr <= 0)
+		return;
+
+	memset(row->buf + row->len, c, nr);
+	row->len += nr;
+	row->buf[row->len] = '\0';
+}
+
+/*
+ * End a column of the line, the column is padded to its width with
+ * spaces then followed by a space, as "%-*s " does.
+ *
+ * @row   : the line
+ * @start : the length of the line when the column was started
+ * @width : the width of the column
+ */
+void row_pad(struct row *row, int start, int width)
+{
+	row_chars(row, ' ', start + width - row->len);
+	row_chars(row, ' ', 1);
+}
+
+/*
+ * Append a string as a column of the line.
+ *
+ * @row   : the line
+ * @s     : the string
+ * @width : the width of the column
+ */
+void row_column(struct row *row, const char *s, int width)
+{
+	int start = row->len;
+
+	row_str(row, s);
+	row_pad(row, start, width);
+}
+
+void row_u64(struct row *row, uint64_t value)
+{
+	char digits[20];
+	int i = sizeof(digits);
+
+	do {
+		digits[--i] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	row_append(row, digits + i, sizeof(digits) - i);
+}
+
+void row_int(struct row *row, int value)
+{
+	if (value < 0) {
+		row_chars(row, '-', 1);
+		row_u64(row, -(int64_t)value);
+		return;
+	}
+
+	row_u64(row, value);
+}
+
+/*
+ * Append an hexadecimal integer with the 0x prefix, as "0x%x" does.
+ */
+void row_hex(struct row *row, unsigned int value)
+{
+	static const char hex[] = "0123456789abcdef";
+	char digits[2 + sizeof(value) * 2];
+	int i = sizeof(digits);
+
+	do {
+		digits[--i] = hex[value & 0xf];
+		value >>= 4;
+	} while (value);
+
+	digits[--i] = 'x';
+	digits[--i] = '0';
+
+	row_append(row, digits + i, sizeof(digits) - i);
+}
+
+/*
+ * Append a number with a fixed number of decimals, as "%.*f" does.
+ *
+ * @row      : the line
+ * @value    : the number
+ * @decimals : the number of decimals, up to 9
+ */
+void row_fixed(struct row *row, double value, int decimals)
+{
+	uint64_t scale = 1, v;
+	char digits[24];
+	double x;
+	int i;
+
+	for (i = 0; i < decimals; i++)
+		scale *= 10;
+
+	x = value < 0 ? -value * scale : value * scale;
+
+	/*
+	 * The big numbers, the nan and the halves, rounded to the even
+	 * digit, are left to the libc
+	 */
+	if (!(x < 1e15) || x - (uint64_t)x == 0.5) {
+		i = snprintf(digits, sizeof(digits), "%.*f", decimals, value);
+		row_append(row, digits, i < sizeof(digits) ? i : 0);
+		return;
+	}
+
+	v = x + 0.5;
+
+	/* "-0.0" is printed for the negative numbers rounded to zero */
+	if (value < 0)
+		row_chars(row, '-', 1);
+
+	row_u64(row, v / scale);
+
+	if (!decimals)
+		return;
+
+	v %= scale;
+
+	for (i = decimals; i > 0; i--) {
+		digits[i] = '0' + v % 10;
+		v /= 10;
+	}
+	digits[0] = '.';
+
+	row_append(row, digits, decimals + 1);
+}
+
+static void row_ratio_libc(struct row *row, uint64_t value, uint64_t div)
+{
+	char digits[24];
+	int len;
+
+	len = snprintf(digits, sizeof(digits), "%g", (double)value / div);
+	row_append(row, digits, len < sizeof(digits) ? len : 0);
+}
+
+/*
+ * Append the quotient of an integer by a power of ten with at most six
+ * significant digits and without the trailing zeros, as "%g" does for
+ * the frequencies given in a unit.
+ *
+ * @row   : the line
+ * @value : the integer
+ * @div   : the power of ten, up to 10^18
+ */
+void row_ratio(struct row *row, uint64_t value, uint64_t div)
+{
+	uint64_t q, r, p = 1, max = 1000000;
+	int i, n = 0, zeros = 0, decimals;
+	char digits[24];
+	int len;
+
+	for (q = value / div; q; q /= 10)
+		n++;
+
+	for (q = div; q > 1; q /= 10)
+		zeros++;
+
+	/*
+	 * The exponent form of %g and the integers too big to be exact in
+	 * a double are left to the libc
+	 */
+	if (n > 6 || (!n && value) || value >= 1ULL << 52) {
+		row_ratio_libc(row, value, div);
+		return;
+	}
+
+	if (!value) {
+		row_chars(row, '0', 1);
+		return;
+	}
+
+	/* the digits below the sixth significant one are rounded */
+	decimals = 6 - n < zeros ? 6 - n : zeros;
+
+	for (i = 0; i < zeros - decimals; i++)
+		p *= 10;
+
+	q = value / p;
+	r = value % p;
+
+	/* the libc rounds the halves to the even digit of the double */
+	if (p > 1 && r * 2 == p) {
+		row_ratio_libc(row, value, div);
+		return;
+	}
+
+	if (p > 1 && r * 2 > p)
+		q++;
+
+	for (i = 0; i < decimals; i++)
+		max *= 10;
+
+	/* the rounding adds a digit to 999999.5 */
+	if (q >= max) {
+		row_ratio_libc(row, value, div);
+		return;
+	}
+
+	len = sizeof(digits);
+
+	/* the trailing zeros of the decimals are not shown */
+	while (decimals && !(q % 10)) {
+		q /= 10;
+		decimals--;
+	}
+
+	for (i = 0; i < decimals; i++) {
+		digits[--len] = '0' + q % 10;
+		q /= 10;
+	}
+
+	if (decimals)
+		digits[--len] = '.';
+
+	do {
+		digits[--len] = '0' + q % 10;
+		q /= 10;
+	} while (q);
+
+	row_append(row, digits + len, sizeof(digits) - len);
+}
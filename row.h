@@ -0,0 +1,42 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+/* Size of the lines of the panels */
+#define ROW_MAX 512
+
+/*
+ * Structure describing a line of a panel being formatted, the values
+ * are appended and the line is truncated to the size of the buffer
+ *
+ * len : the length of the line
+ * buf : the line, nul terminated
+ */
+struct row {
+	int len;
+	char buf[ROW_MAX];
+};
+
+static inline void row_reset(struct row *row)
+{
+	row->len = 0;
+	row->buf[0] = '\0';
+}
+
+extern void row_str(struct row *row, const char *s);
+extern void row_chars(struct row *row, char c, int nr);
+extern void row_pad(struct row *row, int start, int width);
+extern void row_column(struct row *row, const char *s, int width);
+extern void row_u64(struct row *row, uint64_t value);
+extern void row_int(struct row *row, int value);
+extern void row_hex(struct row *row, unsigned int value);
+extern void row_fixed(struct row *row, double value, int decimals);
+extern void row_ratio(struct row *row, uint64_t value, uint64_t div);
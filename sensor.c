@@ -18,20 +18,47 @@
 #undef _GNU_SOURCE
 #include <sys/types.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <dirent.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
 
 #include "powerdebug.h"
 #include "display.h"
 #include "sensor.h"
 #include "tree.h"
 #include "utils.h"
+#include "uevent.h"
+#include "attr.h"
+#include "ftrace.h"
+#include "row.h"
 
 #define SYSFS_SENSOR "/sys/class/hwmon"
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+/* Bound of the cpu numbers given by the records */
+#define SENSOR_CPU_MAX 8192
 
 static struct tree *sensor_tree;
 
+/*
+ * The frequencies of the cpus in Hz, followed with the cpu_frequency
+ * tracepoint, zero when not known
+ */
+static uint64_t *sensor_freqs;
+static int sensor_nrfreqs;
+static bool sensor_tracing;
+
+static const char *const sensor_freq_fields[] = { "state", "cpu_id", NULL };
+
+static const struct attr sensor_freq_attr = {
+	.name  = "scaling_cur_freq",
+	.type  = VALUE_U64,
+	.flags = ATTR_HZ,
+};
+
 struct temp_info {
 	char name[NAME_MAX];
 	int temp;
@@ -79,32 +106,29 @@ int sensor_dump(void)
 	return tree_for_each(sensor_tree, sensor_dump_cb, NULL);
 }
 
-static struct sensor_info *sensor_alloc(void)
+static struct sensor_info *sensor_alloc(struct tree *t)
 {
-	struct sensor_info *sensor;
-
-	sensor = malloc(sizeof(*sensor));
-	if (sensor)
-		memset(sensor, 0, sizeof(*sensor));
-
-	return sensor;
+	return tree_alloc_private(t, sizeof(struct sensor_info));
 }
 
 static int read_sensor_cb(struct tree *tree, void *data)
 {
 	DIR *dir;
-	int value;
+	int i, ret = -1;
         struct dirent dirent, *direntp;
 	struct sensor_info *sensor = tree->private;
+	struct temp_info *temps = NULL, *ptemps;
+	struct fan_info *fans = NULL, *pfans;
 
 	int nrtemps = 0;
 	int nrfans = 0;
 
-	dir = opendir(tree->path);
+	dir = tree_opendir(tree);
 	if (!dir)
 		return -1;
 
-	file_read_value(tree->path, "name", "%s", sensor->name);
+	tree_batch_value(tree, "name", VALUE_STRING, sensor->name,
+			 sizeof(sensor->name));
 
 	while (!readdir_r(dir, &dirent, &direntp)) {
 
@@ -116,56 +140,77 @@ static int read_sensor_cb(struct tree *tree, void *data)
 
 		if (!strncmp(direntp->d_name, "temp", 4)) {
 
-			if (file_read_value(tree->path, direntp->d_name, "%d",
-					    &value))
-				continue;
-
-			sensor->temperatures =
-				realloc(sensor->temperatures,
-					sizeof(struct temp_info) * (nrtemps + 1));
-			if (!sensor->temperatures)
+			ptemps = realloc(temps, sizeof(*temps) * (nrtemps + 1));
+			if (!ptemps)
 				continue;
+			temps = ptemps;
 
-			strcpy(sensor->temperatures[nrtemps].name,
-			       direntp->d_name);
-			sensor->temperatures[nrtemps].temp = value;
+			strcpy(temps[nrtemps].name, direntp->d_name);
+			temps[nrtemps].temp = 0;
 
 			nrtemps++;
 		}
 
 		if (!strncmp(direntp->d_name, "fan", 3)) {
 
-			if (file_read_value(tree->path, direntp->d_name, "%d",
-					    &value))
-				continue;
-
-			sensor->fans =
-				realloc(sensor->fans,
-					sizeof(struct temp_info) * (nrfans + 1));
-			if (!sensor->fans)
+			pfans = realloc(fans, sizeof(*fans) * (nrfans + 1));
+			if (!pfans)
 				continue;
+			fans = pfans;
 
-			strcpy(sensor->fans[nrfans].name,
-			       direntp->d_name);
-			sensor->fans[nrfans].rpms = value;
+			strcpy(fans[nrfans].name, direntp->d_name);
+			fans[nrfans].rpms = 0;
 
 			nrfans++;
 		}
 	}
 
-	sensor->nrtemps = nrtemps;
-	sensor->nrfans = nrfans;
-
 	closedir(dir);
 
-	return 0;
+	/* the arrays live as long as the tree, they go in its arena */
+	if (nrtemps) {
+		sensor->temperatures = tree_alloc_private(tree,
+							  sizeof(*temps) *
+							  nrtemps);
+		if (!sensor->temperatures)
+			goto out;
+		memcpy(sensor->temperatures, temps, sizeof(*temps) * nrtemps);
+		sensor->nrtemps = nrtemps;
+	}
+
+	if (nrfans) {
+		sensor->fans = tree_alloc_private(tree,
+						  sizeof(*fans) * nrfans);
+		if (!sensor->fans)
+			goto out;
+		memcpy(sensor->fans, fans, sizeof(*fans) * nrfans);
+		sensor->nrfans = nrfans;
+	}
+
+	/* the arrays are complete, we can queue the reads of the values */
+	for (i = 0; i < nrtemps; i++)
+		tree_batch_value(tree, sensor->temperatures[i].name, VALUE_INT,
+				 &sensor->temperatures[i].temp,
+				 sizeof(sensor->temperatures[i].temp));
+
+	for (i = 0; i < nrfans; i++)
+		tree_batch_value(tree, sensor->fans[i].name, VALUE_INT,
+				 &sensor->fans[i].rpms,
+				 sizeof(sensor->fans[i].rpms));
+
+	ret = 0;
+out:
+	free(temps);
+	free(fans);
+
+	return ret;
 }
 
 static int fill_sensor_cb(struct tree *t, void *data)
 {
 	struct sensor_info *sensor;
 
-	sensor = sensor_alloc();
+	sensor = sensor_alloc(t);
 	if (!sensor)
 		return -1;
 
@@ -179,14 +224,20 @@ static int fill_sensor_cb(struct tree *t, void *data)
 
 static int fill_sensor_tree(void)
 {
-	return tree_for_each(sensor_tree, fill_sensor_cb, NULL);
+	if (tree_for_each(sensor_tree, fill_sensor_cb, NULL))
+		return -1;
+
+	file_batch_submit();
+
+	return 0;
 }
 
 static int sensor_filter_cb(const char *name)
 {
-	/* let's ignore some directories in order to avoid to be
-	 * pulled inside the sysfs circular symlinks mess/hell
-	 * (choose the word which fit better)
+	/* the links are followed without looping, the hwmon directory of
+	 * the device leads back to the sensor and it is cut by the tree,
+	 * but the subsystem and the driver links lead out of the device
+	 * to the other devices of the bus
 	 */
 	if (!strcmp(name, "subsystem"))
 		return 1;
@@ -194,9 +245,6 @@ static int sensor_filter_cb(const char *name)
 	if (!strcmp(name, "driver"))
 		return 1;
 
-	if (!strcmp(name, "hwmon"))
-		return 1;
-
 	if (!strcmp(name, "power"))
 		return 1;
 
@@ -206,35 +254,145 @@ static int sensor_filter_cb(const char *name)
 static int sensor_display_cb(struct tree *t, void *data)
 {
 	struct sensor_info *sensor = t->private;
+	struct row *row;
 	int *line = data;
-	char buf[1024];
 	int i;
 
 	if (!strlen(sensor->name))
 		return 0;
 
-	sprintf(buf, "%s", sensor->name);
-	display_print_line(SENSOR, *line, buf, 1, t);
+	row = display_row(SENSOR);
+	row_str(row, sensor->name);
+	display_print_line(SENSOR, *line, row, 1, t);
 
 	(*line)++;
 
 	for (i = 0; i < sensor->nrtemps; i++) {
-		sprintf(buf, " %-35s%.1f", sensor->temperatures[i].name,
-		       (float)sensor->temperatures[i].temp / 1000);
-		display_print_line(SENSOR, *line, buf, 0, t);
+		row = display_row(SENSOR);
+		row_str(row, " ");
+		row_str(row, sensor->temperatures[i].name);
+		row_chars(row, ' ', 36 - row->len);
+		row_fixed(row, (float)sensor->temperatures[i].temp / 1000, 1);
+		display_print_line(SENSOR, *line, row, 0, t);
 		(*line)++;
 	}
 
 	for (i = 0; i < sensor->nrfans; i++) {
-		sprintf(buf, " %-35s%d rpm", sensor->fans[i].name,
-			sensor->fans[i].rpms);
-		display_print_line(SENSOR, *line, buf, 0, t);
+		row = display_row(SENSOR);
+		row_str(row, " ");
+		row_str(row, sensor->fans[i].name);
+		row_chars(row, ' ', 36 - row->len);
+		row_int(row, sensor->fans[i].rpms);
+		row_str(row, " rpm");
+		display_print_line(SENSOR, *line, row, 0, t);
 		(*line)++;
 	}
 
 	return 0;
 }
 
+/*
+ * Store the frequency of a cpu, the array grows with the cpu numbers.
+ *
+ * @cpu : the number of the cpu
+ * @khz : the frequency in kHz
+ * Returns 0 on success, -1 otherwise
+ */
+static int sensor_freq_set(int cpu, uint64_t khz)
+{
+	uint64_t *freqs;
+
+	if (cpu < 0 || cpu >= SENSOR_CPU_MAX)
+		return -1;
+
+	if (cpu >= sensor_nrfreqs) {
+		freqs = realloc(sensor_freqs, sizeof(*freqs) * (cpu + 1));
+		if (!freqs)
+			return -1;
+
+		memset(freqs + sensor_nrfreqs, 0,
+		       sizeof(*freqs) * (cpu + 1 - sensor_nrfreqs));
+
+		sensor_freqs = freqs;
+		sensor_nrfreqs = cpu + 1;
+	}
+
+	sensor_freqs[cpu] = khz * 1000;
+
+	return 0;
+}
+
+/*
+ * Read the frequencies of the cpus, the records of the tracepoint only
+ * give the changes. The cpus without cpufreq are skipped.
+ */
+static void sensor_freq_read(void)
+{
+	char dir[PATH_MAX], path[PATH_MAX];
+	uint64_t khz;
+	int cpu;
+
+	if (file_root_path(dir, sizeof(dir), SYSFS_CPU))
+		return;
+
+	for (cpu = 0; cpu < SENSOR_CPU_MAX; cpu++) {
+
+		if (snprintf(path, sizeof(path), "%s/cpu%d", dir, cpu) >=
+		    sizeof(path) || access(path, F_OK))
+			return;
+
+		strcat(path, "/cpufreq");
+
+		if (!file_read_value(path, "scaling_cur_freq", VALUE_U64,
+				     &khz, sizeof(khz)))
+			sensor_freq_set(cpu, khz);
+	}
+}
+
+static int sensor_trace_cb(const struct ftrace_record *rec, void *data)
+{
+	if (!rec)
+		return display_update(SENSOR);
+
+	if (rec->values[1] < SENSOR_CPU_MAX)
+		sensor_freq_set(rec->values[1], rec->values[0]);
+
+	return 0;
+}
+
+/*
+ * Show the frequencies of the cpus after the sensors, they are only
+ * known when the cpu_frequency tracepoint is followed.
+ */
+static void sensor_freq_display(int *line)
+{
+	struct row *row;
+	int cpu;
+
+	if (!sensor_nrfreqs)
+		return;
+
+	row = display_row(SENSOR);
+	row_str(row, "cpu_frequency");
+	display_print_line(SENSOR, *line, row, 1, NULL);
+
+	(*line)++;
+
+	for (cpu = 0; cpu < sensor_nrfreqs; cpu++) {
+
+		if (!sensor_freqs[cpu])
+			continue;
+
+		row = display_row(SENSOR);
+		row_str(row, " cpu");
+		row_int(row, cpu);
+		row_chars(row, ' ', 36 - row->len);
+		attr_row_value(row, &sensor_freq_attr, &sensor_freqs[cpu]);
+		display_print_line(SENSOR, *line, row, 0, NULL);
+		(*line)++;
+	}
+}
+
 static int sensor_print_header(void)
 {
 	char *buf;
@@ -252,31 +410,87 @@ static int sensor_print_header(void)
 
 static int sensor_display(bool refresh)
 {
+	bool tracing = ftrace_traced("power");
 	int ret, line = 0;
 
+	/* the frequencies are read when tracing starts or records are lost */
+	if (tracing && !sensor_tracing)
+		sensor_freq_read();
+	sensor_tracing = tracing;
+
 	display_reset_cursor(SENSOR);
 
 	sensor_print_header();
 
 	ret = tree_for_each(sensor_tree, sensor_display_cb, &line);
 
+	sensor_freq_display(&line);
+
 	display_refresh_pad(SENSOR);
 
 	return ret;
 }
 
+static int sensor_release_cb(struct tree *t, void *data)
+{
+	struct sensor_info *sensor = t->private;
+
+	if (sensor) {
+		tree_free_private(t, sensor->temperatures,
+				  sizeof(*sensor->temperatures) *
+				  sensor->nrtemps);
+		tree_free_private(t, sensor->fans,
+				  sizeof(*sensor->fans) * sensor->nrfans);
+		tree_free_private(t, sensor, sizeof(*sensor));
+	}
+
+	return 0;
+}
+
+static int sensor_uevent_cb(int action, const char *name, void *data)
+{
+	struct tree *t;
+
+	if (action == UEVENT_REMOVE) {
+		if (tree_del(sensor_tree, name, sensor_release_cb, NULL))
+			return 0;
+		return display_update(SENSOR);
+	}
+
+	t = tree_add(sensor_tree, name, sensor_filter_cb, true);
+	if (!t || t->private)
+		return 0;
+
+	if (tree_for_each(t, fill_sensor_cb, NULL))
+		return -1;
+
+	file_batch_submit();
+
+	return display_update(SENSOR);
+}
+
 static struct display_ops sensor_ops = {
 	.display = sensor_display,
 };
 
 int sensor_init(void)
 {
-	sensor_tree = tree_load(SYSFS_SENSOR, sensor_filter_cb, false);
+	char path[PATH_MAX];
+
+	if (file_root_path(path, sizeof(path), SYSFS_SENSOR))
+		return -1;
+
+	sensor_tree = tree_load(path, sensor_filter_cb, true);
 	if (!sensor_tree)
 		return -1;
 
 	if (fill_sensor_tree())
 		return -1;
+
+	uevent_register("hwmon", sensor_uevent_cb, NULL);
+
+	ftrace_register("power", "cpu_frequency", sensor_freq_fields,
+			sensor_trace_cb, NULL);
 #ifdef NCURES
 	return display_register(SENSOR, &sensor_ops);
 #else
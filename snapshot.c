@@ -0,0 +1,568 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#undef _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+
+#include "tree.h"
+#include "snapshot.h"
+
+/* Version of the file format, to be changed with the structures below */
+#define SNAPSHOT_VERSION 3
+
+#define SNAPSHOT_MAGIC "PDSNAP"
+
+/* File giving the identifier of the current boot */
+#define SNAPSHOT_BOOT_ID "/proc/sys/kernel/random/boot_id"
+
+/* Size of the identifier of a boot, the new line included */
+#define SNAPSHOT_BOOT_ID_SIZE 40
+
+/*
+ * Structure at the beginning of a snapshot file, followed by the nodes
+ * and by their names. The file only holds offsets and indexes, so it
+ * is used where it is mapped.
+ *
+ * magic    : SNAPSHOT_MAGIC
+ * version  : SNAPSHOT_VERSION
+ * key      : the key of the description of the attributes of the nodes
+ * nrnodes  : the number of nodes, the root node included
+ * namesize : the size of the names following the nodes
+ * dev      : the device of the root directory
+ * ino      : the inode of the root directory
+ * mtime    : the modification time of the root directory in ns
+ * boot_id  : the identifier of the boot the tree was saved during
+ */
+struct snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t key;
+	uint32_t nrnodes;
+	uint32_t namesize;
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t mtime;
+	char boot_id[SNAPSHOT_BOOT_ID_SIZE];
+};
+
+/*
+ * Structure describing a node in a snapshot file, the nodes are saved
+ * in preorder
+ *
+ * parent : the index of the parent node, zero for the root node
+ * name   : the offset of the name in the names, the root node has the
+ *          path of the tree
+ * mask   : the bitmap of the attributes found in the directory
+ * mtime  : the modification time of the directory in ns, it changes
+ *          when an entry is removed from the directory
+ * nlink  : the number of links of the directory, it changes when a
+ *          subdirectory is added, debugfs does not update the mtime
+ */
+struct snapshot_node {
+	uint32_t parent;
+	uint32_t name;
+	uint64_t mask;
+	uint64_t mtime;
+	uint64_t nlink;
+};
+
+/*
+ * Structure describing a snapshot file mapped in memory
+ *
+ * map    : the address of the mapping
+ * size   : the size of the file
+ * header : the header of the file
+ * nodes  : the nodes of the tree
+ * names  : the names of the nodes
+ */
+struct snapshot {
+	void *map;
+	size_t size;
+	const struct snapshot_header *header;
+	const struct snapshot_node *nodes;
+	const char *names;
+};
+
+/*
+ * Structure used to save a tree
+ *
+ * nodes    : the nodes saved so far
+ * names    : the names of the nodes
+ * nr       : the number of nodes
+ * namesize : the size of the names
+ * mask     : a callback giving the bitmap of the attributes of a node
+ */
+struct snapshot_writer {
+	struct snapshot_node *nodes;
+	char *names;
+	int nr;
+	size_t namesize;
+	snapshot_mask_t mask;
+};
+
+/* Directory of the snapshot files, empty when there are no snapshots */
+static char snapshot_dir[PATH_MAX];
+
+/*
+ * Set the directory where the trees are saved between two runs.
+ *
+ * @dir : the directory, NULL for the cache directory of the user, an
+ *        empty string to disable the snapshots
+ * Returns 0 on success, -1 otherwise
+ */
+int snapshot_set_dir(const char *dir)
+{
+	const char *env;
+	int len;
+
+	if (dir)
+		len = snprintf(snapshot_dir, sizeof(snapshot_dir), "%s", dir);
+	else if ((env = getenv("XDG_CACHE_HOME")) && *env)
+		len = snprintf(snapshot_dir, sizeof(snapshot_dir),
+			       "%s/powerdebug", env);
+	else if ((env = getenv("HOME")) && *env)
+		len = snprintf(snapshot_dir, sizeof(snapshot_dir),
+			       "%s/.cache/powerdebug", env);
+	else
+		len = snprintf(snapshot_dir, sizeof(snapshot_dir), "%s", "");
+
+	if (len >= sizeof(snapshot_dir)) {
+		snapshot_dir[0] = '\0';
+		return -1;
+	}
+
+	return 0;
+}
+
+static int snapshot_path(char *buf, size_t size, const char *name)
+{
+	if (!snapshot_dir[0])
+		return -1;
+
+	if (snprintf(buf, size, "%s/%s.snap", snapshot_dir, name) >= size)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Fill the fields of a header which tell if a snapshot may still be
+ * valid, a snapshot saved during another boot or before a change of the
+ * root directory is dropped before the tree is built from it. The sysfs
+ * trees are not saved: their directories are mostly symbolic links,
+ * which change neither the mtime nor the number of links of the class
+ * directories.
+ *
+ * @header : the header to be filled
+ * @path   : the path of the root directory of the tree
+ * Returns 0 on success, -1 otherwise
+ */
+static int snapshot_stamp(struct snapshot_header *header, const char *path)
+{
+	struct statfs fs;
+	struct stat s;
+	ssize_t len;
+	int fd;
+
+	if (statfs(path, &fs) || fs.f_type == SYSFS_MAGIC)
+		return -1;
+
+	if (stat(path, &s))
+		return -1;
+
+	header->dev = s.st_dev;
+	header->ino = s.st_ino;
+	header->mtime = (uint64_t)s.st_mtim.tv_sec * 1000000000 +
+		s.st_mtim.tv_nsec;
+
+	memset(header->boot_id, 0, sizeof(header->boot_id));
+
+	fd = open(SNAPSHOT_BOOT_ID, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	len = read(fd, header->boot_id, sizeof(header->boot_id) - 1);
+
+	close(fd);
+
+	return len > 0 ? 0 : -1;
+}
+
+/*
+ * Get the modification time and the number of links of the directory
+ * of a node, through its O_PATH descriptor when it has one.
+ *
+ * @t     : the node
+ * @mtime : a pointer to store the modification time in ns
+ * @nlink : a pointer to store the number of links
+ * Returns 0 on success, -1 otherwise
+ */
+static int snapshot_stat(struct tree *t, uint64_t *mtime, uint64_t *nlink)
+{
+	struct stat s;
+
+	if (t->dirfd >= 0 ? fstat(t->dirfd, &s) : stat(t->path, &s))
+		return -1;
+
+	*mtime = (uint64_t)s.st_mtim.tv_sec * 1000000000 + s.st_mtim.tv_nsec;
+	*nlink = s.st_nlink;
+
+	return 0;
+}
+
+static void snapshot_close(struct snapshot *snap)
+{
+	if (!snap)
+		return;
+
+	munmap(snap->map, snap->size);
+	free(snap);
+}
+
+/*
+ * Map the snapshot of a tree and check it was saved with the same
+ * attributes, during the same boot and since the last change of the
+ * root directory, the other directories are checked by snapshot_load.
+ *
+ * @name : the name of the snapshot
+ * @path : the path of the root directory of the tree
+ * @key  : the key of the description of the attributes
+ * Returns the snapshot, NULL if there is none or if it is not valid
+ */
+static struct snapshot *snapshot_open(const char *name, const char *path,
+				      unsigned int key)
+{
+	const struct snapshot_header *header;
+	struct snapshot_header stamp;
+	struct snapshot *snap;
+	char file[PATH_MAX];
+	struct stat s;
+	void *map;
+	int fd;
+
+	if (snapshot_path(file, sizeof(file), name))
+		return NULL;
+
+	if (snapshot_stamp(&stamp, path))
+		return NULL;
+
+	fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &s) || s.st_size < sizeof(*header)) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return NULL;
+
+	header = map;
+
+	if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) ||
+	    header->version != SNAPSHOT_VERSION || header->key != key)
+		goto out_unmap;
+
+	if (header->dev != stamp.dev || header->ino != stamp.ino ||
+	    header->mtime != stamp.mtime ||
+	    memcmp(header->boot_id, stamp.boot_id, sizeof(stamp.boot_id)))
+		goto out_unmap;
+
+	if (!header->nrnodes || !header->namesize ||
+	    header->nrnodes > (s.st_size - sizeof(*header)) /
+	    sizeof(struct snapshot_node) ||
+	    s.st_size != sizeof(*header) + header->namesize +
+	    (size_t)header->nrnodes * sizeof(struct snapshot_node))
+		goto out_unmap;
+
+	snap = malloc(sizeof(*snap));
+	if (!snap)
+		goto out_unmap;
+
+	snap->map = map;
+	snap->size = s.st_size;
+	snap->header = header;
+	snap->nodes = (const struct snapshot_node *)(header + 1);
+	snap->names = (const char *)(snap->nodes + header->nrnodes);
+
+	/* the names are terminated, the last one included */
+	if (snap->names[header->namesize - 1] ||
+	    snap->nodes[0].name >= header->namesize ||
+	    strcmp(snap->names + snap->nodes[0].name, path)) {
+		snapshot_close(snap);
+		return NULL;
+	}
+
+	return snap;
+
+out_unmap:
+	munmap(map, s.st_size);
+	return NULL;
+}
+
+static int snapshot_node_cb(int index, const char **name, void *data)
+{
+	struct snapshot *snap = data;
+	const struct snapshot_node *node = &snap->nodes[index];
+	const char *s;
+
+	if (node->name >= snap->header->namesize)
+		return -1;
+
+	s = snap->names + node->name;
+
+	if (!*s || s[0] == '.' || strchr(s, '/'))
+		return -1;
+
+	*name = s;
+
+	return node->parent > INT_MAX ? -1 : node->parent;
+}
+
+/*
+ * Check a directory was not modified since the snapshot was saved, an
+ * entry added to a directory is not seen from the root directory.
+ */
+static int snapshot_check_cb(struct tree *t, void *data)
+{
+	struct snapshot *snap = data;
+	uint64_t mtime, nlink;
+
+	if (t->index < 0 || t->index >= snap->header->nrnodes)
+		return -1;
+
+	if (snapshot_stat(t, &mtime, &nlink))
+		return -1;
+
+	return mtime != snap->nodes[t->index].mtime ||
+		nlink != snap->nodes[t->index].nlink;
+}
+
+/*
+ * Load a tree from its snapshot when there is a valid one, by browsing
+ * the directories otherwise. When the snapshot is used, the directories
+ * are not browsed and the attribute files are not looked up, the
+ * bitmaps of the attributes are given by snapshot_mask. The snapshot is
+ * not used if one of its directories was modified since it was saved.
+ *
+ * @name   : the name of the snapshot
+ * @path   : the path of the root directory of the tree
+ * @key    : the key of the description of the attributes
+ * @filter : a callback to filter out the directories
+ * @follow : follow the symbolic links
+ * @snap   : a pointer to store the snapshot the tree was loaded from,
+ *           NULL if the directories were browsed, to be given to
+ *           snapshot_save once the tree is filled
+ * Returns the tree on success, NULL otherwise
+ */
+struct tree *snapshot_load(const char *name, const char *path,
+			   unsigned int key, tree_filter_t filter,
+			   bool follow, struct snapshot **snap)
+{
+	struct tree *tree = NULL;
+
+	*snap = snapshot_open(name, path, key);
+	if (*snap) {
+		tree = tree_build(path, (*snap)->header->nrnodes,
+				  snapshot_node_cb, *snap);
+		if (tree && tree_for_each(tree, snapshot_check_cb, *snap)) {
+			tree_destroy(tree);
+			tree = NULL;
+		}
+		if (!tree) {
+			snapshot_close(*snap);
+			*snap = NULL;
+		}
+	}
+
+	if (!tree)
+		tree = tree_load(path, filter, follow);
+
+	return tree;
+}
+
+/*
+ * Get the bitmap of the attributes of a node saved in a snapshot.
+ *
+ * @snap : the snapshot the tree was loaded from
+ * @t    : the node
+ * Returns the bitmap of the attributes
+ */
+unsigned long snapshot_mask(struct snapshot *snap, struct tree *t)
+{
+	if (t->index < 0 || t->index >= snap->header->nrnodes)
+		return 0;
+
+	return snap->nodes[t->index].mask;
+}
+
+static int snapshot_count_cb(struct tree *t, void *data)
+{
+	struct snapshot_writer *w = data;
+
+	w->nr++;
+	w->namesize += strlen(t->parent ? t->name : t->path) + 1;
+
+	return 0;
+}
+
+static int snapshot_node_save_cb(struct tree *t, void *data)
+{
+	struct snapshot_writer *w = data;
+	struct snapshot_node *node = &w->nodes[w->nr];
+	const char *name = t->parent ? t->name : t->path;
+
+	/* the nodes are browsed in the order of their index */
+	if (t->index != w->nr)
+		return -1;
+
+	node->parent = t->parent ? t->parent->index : 0;
+	node->name = w->namesize;
+	node->mask = t->parent ? w->mask(t) : 0;
+
+	if (snapshot_stat(t, &node->mtime, &node->nlink))
+		return -1;
+
+	strcpy(w->names + w->namesize, name);
+
+	w->namesize += strlen(name) + 1;
+	w->nr++;
+
+	return 0;
+}
+
+/*
+ * Write a snapshot file, in a temporary file renamed once complete, so
+ * a snapshot being read is never a partial one.
+ *
+ * @file   : the path of the snapshot file
+ * @header : the header of the file
+ * @w      : the nodes and the names
+ * Returns 0 on success, -1 otherwise
+ */
+static int snapshot_write(const char *file, struct snapshot_header *header,
+			  struct snapshot_writer *w)
+{
+	char tmp[PATH_MAX];
+	FILE *f;
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file) >= sizeof(tmp))
+		return -1;
+
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return -1;
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		goto out_unlink;
+	}
+
+	if (fwrite(header, sizeof(*header), 1, f) != 1 ||
+	    fwrite(w->nodes, sizeof(*w->nodes), w->nr, f) != w->nr ||
+	    fwrite(w->names, 1, w->namesize, f) != w->namesize) {
+		fclose(f);
+		goto out_unlink;
+	}
+
+	if (fclose(f) || rename(tmp, file))
+		goto out_unlink;
+
+	return 0;
+
+out_unlink:
+	unlink(tmp);
+	return -1;
+}
+
+/*
+ * Save a tree in its snapshot unless it was loaded from it, then close
+ * the snapshot. The bitmaps of the attributes are given by a callback,
+ * as they belong to the private data of the nodes.
+ *
+ * @snap : the snapshot the tree was loaded from, or NULL
+ * @name : the name of the snapshot
+ * @tree : the root node of the tree
+ * @key  : the key of the description of the attributes
+ * @mask : a callback giving the bitmap of the attributes of a node
+ * Returns 0 on success, -1 otherwise
+ */
+int snapshot_save(struct snapshot *snap, const char *name,
+		  struct tree *tree, unsigned int key, snapshot_mask_t mask)
+{
+	struct snapshot_writer w = { .mask = mask };
+	struct snapshot_header header = { .magic = SNAPSHOT_MAGIC };
+	char file[PATH_MAX];
+	int ret = -1;
+
+	if (snap) {
+		snapshot_close(snap);
+		return 0;
+	}
+
+	if (snapshot_path(file, sizeof(file), name))
+		return -1;
+
+	if (snapshot_stamp(&header, tree->path))
+		return -1;
+
+	if (mkdir(snapshot_dir, 0755) && errno != EEXIST)
+		return -1;
+
+	tree_for_each(tree, snapshot_count_cb, &w);
+
+	if (w.namesize > UINT32_MAX)
+		return -1;
+
+	header.version = SNAPSHOT_VERSION;
+	header.key = key;
+	header.nrnodes = w.nr;
+	header.namesize = w.namesize;
+
+	w.nodes = malloc(sizeof(*w.nodes) * w.nr);
+	w.names = malloc(w.namesize);
+	if (!w.nodes || !w.names)
+		goto out_free;
+
+	w.nr = 0;
+	w.namesize = 0;
+
+	if (tree_for_each(tree, snapshot_node_save_cb, &w))
+		goto out_free;
+
+	ret = snapshot_write(file, &header, &w);
+out_free:
+	free(w.nodes);
+	free(w.names);
+
+	return ret;
+}
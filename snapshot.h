@@ -0,0 +1,24 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+struct snapshot;
+
+typedef unsigned long (*snapshot_mask_t)(struct tree *t);
+
+extern int snapshot_set_dir(const char *dir);
+extern struct tree *snapshot_load(const char *name, const char *path,
+				  unsigned int key, tree_filter_t filter,
+				  bool follow, struct snapshot **snap);
+extern unsigned long snapshot_mask(struct snapshot *snap, struct tree *t);
+extern int snapshot_save(struct snapshot *snap, const char *name,
+			 struct tree *tree, unsigned int key,
+			 snapshot_mask_t mask);
@@ -19,34 +19,537 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
 
 #include "tree.h"
+#include "arena.h"
+#include "utils.h"
+
+/* Size of the buffer receiving the directory entries */
+#define TREE_DIRENT_BUF 32768
+
+/* Initial number of directories waiting to be browsed */
+#define TREE_STACK_SIZE 64
+
+/* Number of nodes found before the scan is spread over the threads */
+#define TREE_PARALLEL_NODES 1024
+
+/* Maximum number of narrowed results kept by a search */
+#define TREE_SEARCH_LEVELS 64
+
+/* Maximum number of threads browsing a tree */
+#define TREE_WORKERS_MAX 8
+
+/* Initial number of slots of the directories found by a scan */
+#define TREE_VISIT_SIZE 256
+
+/* Maximum number of links followed by a scan */
+#define TREE_VISIT_LINKS 16384
+
+/*
+ * Structure of a directory entry returned by getdents64, the libc
+ * does not always provide it
+ */
+struct tree_dirent {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
 
 /*
- * Allocate a tree structure and initialize the different fields.
+ * Structure describing a node in the preorder array of a tree, a
+ * subtree is the range of the array starting at its node
  *
- * @path  : the absolute path to the directory
- * @depth : the depth in the tree
- * Returns a tree structure on success, NULL otherwise
+ * node   : the node
+ * parent : the index of the parent, -1 for the root node
+ * child  : the index of the first child, -1 if none
+ * size   : the number of nodes of the subtree, the node included
+ * depth  : the depth of the node
+ * same   : the index of the next node in preorder with the same name,
+ *          -1 if none
+ */
+struct tree_flat {
+	struct tree *node;
+	int parent;
+	int child;
+	int size;
+	int depth;
+	int same;
+};
+
+/*
+ * Structure describing a slot of the name index, the names are not
+ * copied, the nodes keep them in the arena
+ *
+ * hash : the hash of the name
+ * head : the index of the first node in preorder with the name, -1 if
+ *        the slot is free
+ * tail : the index of the last node with the name
+ */
+struct tree_hash {
+	unsigned int hash;
+	int head;
+	int tail;
+};
+
+/*
+ * Structure describing an entry of the sorted name index
+ *
+ * name  : the name of the node
+ * index : the index of the node in the preorder array
+ */
+struct tree_name {
+	const char *name;
+	int index;
+};
+
+/*
+ * Structure describing the result of a search for a prefix
+ *
+ * len   : the length of the prefix
+ * nr    : the number of nodes found
+ * nodes : the nodes found, in preorder
+ */
+struct tree_level {
+	int len;
+	int nr;
+	struct tree **nodes;
+};
+
+/*
+ * Structure describing a search typed character after character, each
+ * new character narrows the last result which is kept in a stack, so
+ * removing the character goes back to the previous result
+ *
+ * tree     : the node where the search began
+ * mode     : the kind of match of the search
+ * prefix   : the last name searched
+ * nrlevels : the number of results in the stack
+ * levels   : the results for the successive prefixes
+ */
+struct tree_search {
+	struct tree *tree;
+	int mode;
+	char prefix[NAME_MAX + 1];
+	int nrlevels;
+	struct tree_level levels[TREE_SEARCH_LEVELS];
+};
+
+/*
+ * Structure identifying a directory, whatever the path it is reached by
+ *
+ * dev : the device of the directory
+ * ino : the inode of the directory, zero for a free slot
+ */
+struct tree_id {
+	dev_t dev;
+	ino_t ino;
+};
+
+/*
+ * Structure describing the directories found by a scan following the
+ * symbolic links, a directory found again through another path is left
+ * out, so the loops of links are cut and a directory is browsed once
+ *
+ * lock  : protects the other fields, the set is shared by the workers
+ * ids   : an open addressing table of the directories
+ * nr    : the number of directories found
+ * size  : the number of slots of the table, a power of two
+ * links : the number of directories found through a link
+ */
+struct tree_visit {
+	pthread_mutex_t lock;
+	struct tree_id *ids;
+	int nr;
+	int size;
+	int links;
+};
+
+/*
+ * Structure allocated by tree_load, the root node is embedded first so
+ * the root node pointer given to the callers is the structure pointer
+ *
+ * tree   : the root node of the tree
+ * arena  : the memory of the nodes, their paths and their private data
+ * flat   : the nodes in preorder, rebuilt when the tree changed
+ * nrflat : the number of nodes in the array
+ * size   : the size of the array
+ * dirty  : nodes were added or removed since the array was built
+ * hash   : the name index, an open addressing table built with the
+ *          array once tree_find was called
+ * nrhash : the number of slots of the table, a power of two
+ * hashed : the name index is wanted
+ * names  : the nodes sorted by name, built with the array once
+ *          tree_search was called
+ * lower  : the names in lowercase one after the other in preorder,
+ *          built with the array once tree_search was called
+ * offsets: the position of each name in the lowercase names
+ * search : the search in progress
+ */
+struct tree_root {
+	struct tree tree;
+	struct arena arena;
+	struct tree_flat *flat;
+	int nrflat;
+	int size;
+	bool dirty;
+	struct tree_hash *hash;
+	int nrhash;
+	bool hashed;
+	struct tree_name *names;
+	char *lower;
+	int *offsets;
+	struct tree_search search;
+};
+
+/*
+ * Get the root structure of the tree a node belongs to.
+ *
+ * @t : a node of a tree loaded with tree_load
+ * Returns the root structure of the tree
  */
-static inline struct tree *tree_alloc(const char *path, int depth)
+static struct tree_root *tree_root(struct tree *t)
 {
-	struct tree *t;
+	while (t->parent)
+		t = t->parent;
 
-	t = malloc(sizeof(*t));
-	if (!t)
+	return (struct tree_root *)t;
+}
+
+static inline struct arena *tree_arena(struct tree *t)
+{
+	return &tree_root(t)->arena;
+}
+
+/*
+ * Get the next node in preorder, without going out of the subtrees of
+ * the siblings of a node.
+ *
+ * @t    : the current node
+ * @stop : the parent of the node where the walk began
+ * Returns the next node, NULL at the end of the walk
+ */
+static struct tree *tree_next(struct tree *t, struct tree *stop)
+{
+	if (t->child)
+		return t->child;
+
+	for (; t != stop; t = t->parent)
+		if (t->next)
+			return t->next;
+
+	return NULL;
+}
+
+static inline unsigned int tree_hash_name(const char *name)
+{
+	unsigned int hash = 2166136261U;
+
+	/* FNV-1a */
+	for (; *name; name++)
+		hash = (hash ^ (unsigned char)*name) * 16777619U;
+
+	return hash;
+}
+
+/*
+ * Find the slot of a name in the name index.
+ *
+ * @root : the root structure of the tree
+ * @name : the name to look for
+ * @hash : the hash of the name
+ * Returns the slot of the name, or the free slot where it goes
+ */
+static struct tree_hash *tree_hash_slot(struct tree_root *root,
+					const char *name, unsigned int hash)
+{
+	unsigned int mask = root->nrhash - 1;
+	struct tree_hash *slot;
+
+	for (slot = &root->hash[hash & mask]; slot->head >= 0;
+	     slot = &root->hash[(slot - root->hash + 1) & mask]) {
+
+		if (slot->hash == hash &&
+		    !strcmp(root->flat[slot->head].node->name, name))
+			break;
+	}
+
+	return slot;
+}
+
+/*
+ * Build the name index from the preorder array. The nodes sharing a
+ * name are chained in preorder, so the first one found from a node is
+ * the one a depth first search would find.
+ *
+ * @root : the root structure of the tree, with an up to date array
+ * Returns 0 on success, -1 otherwise
+ */
+static int tree_hash_build(struct tree_root *root)
+{
+	struct tree_hash *slot;
+	const char *name;
+	unsigned int hash;
+	int i, size = TREE_STACK_SIZE;
+
+	/* keep the table half empty, the probe sequences stay short */
+	while (size < root->nrflat * 2)
+		size *= 2;
+
+	if (size != root->nrhash) {
+		slot = realloc(root->hash, sizeof(*slot) * size);
+		if (!slot) {
+			free(root->hash);
+			root->hash = NULL;
+			root->nrhash = 0;
+			return -1;
+		}
+		root->hash = slot;
+		root->nrhash = size;
+	}
+
+	for (i = 0; i < size; i++)
+		root->hash[i].head = -1;
+
+	for (i = 0; i < root->nrflat; i++) {
+
+		name = root->flat[i].node->name;
+		hash = tree_hash_name(name);
+
+		root->flat[i].same = -1;
+
+		slot = tree_hash_slot(root, name, hash);
+		if (slot->head >= 0) {
+			root->flat[slot->tail].same = i;
+			slot->tail = i;
+			continue;
+		}
+
+		slot->hash = hash;
+		slot->head = slot->tail = i;
+	}
+
+	return 0;
+}
+
+static int tree_name_cmp(const void *a, const void *b)
+{
+	const struct tree_name *na = a, *nb = b;
+	int ret = strcmp(na->name, nb->name);
+
+	return ret ? ret : na->index - nb->index;
+}
+
+/*
+ * Build the sorted name index from the preorder array.
+ *
+ * @root : the root structure of the tree, with an up to date array
+ * Returns 0 on success, -1 otherwise
+ */
+static int tree_names_build(struct tree_root *root)
+{
+	struct tree_name *names;
+	int i;
+
+	names = realloc(root->names, sizeof(*names) * root->nrflat);
+	if (!names)
+		return -1;
+
+	for (i = 0; i < root->nrflat; i++) {
+		names[i].name = root->flat[i].node->name;
+		names[i].index = i;
+	}
+
+	qsort(names, root->nrflat, sizeof(*names), tree_name_cmp);
+
+	root->names = names;
+
+	return 0;
+}
+
+/*
+ * Build the table of the names in lowercase, the names are stored one
+ * after the other in preorder, so a substring can be looked for in all
+ * the names with a single scan.
+ *
+ * @root : the root structure of the tree, with an up to date array
+ * Returns 0 on success, -1 otherwise
+ */
+static int tree_lower_build(struct tree_root *root)
+{
+	const char *name;
+	size_t size = 0, pos = 0;
+	char *lower;
+	int *offsets;
+	int i;
+
+	for (i = 0; i < root->nrflat; i++)
+		size += strlen(root->flat[i].node->name) + 1;
+
+	offsets = realloc(root->offsets, sizeof(*offsets) * (root->nrflat + 1));
+	if (!offsets)
+		goto out_free;
+	root->offsets = offsets;
+
+	lower = realloc(root->lower, size + 1);
+	if (!lower)
+		goto out_free;
+	root->lower = lower;
+
+	for (i = 0; i < root->nrflat; i++) {
+
+		offsets[i] = pos;
+
+		for (name = root->flat[i].node->name; *name; name++)
+			lower[pos++] = tolower((unsigned char)*name);
+
+		lower[pos++] = '\0';
+	}
+
+	offsets[i] = pos;
+
+	return 0;
+
+out_free:
+	free(root->offsets);
+	free(root->lower);
+	root->offsets = NULL;
+	root->lower = NULL;
+	return -1;
+}
+
+/*
+ * Forget the results of the search in progress, they point to nodes
+ * which may have been removed.
+ *
+ * @search : the search
+ */
+static void tree_search_reset(struct tree_search *search)
+{
+	while (search->nrlevels)
+		free(search->levels[--search->nrlevels].nodes);
+
+	search->tree = NULL;
+	search->prefix[0] = '\0';
+}
+
+/*
+ * Build the array of the nodes in preorder. The tree is walked with
+ * the links of the nodes and without recursion, so the stack does not
+ * grow with the number of siblings.
+ *
+ * @root : the root structure of the tree
+ * Returns 0 on success, -1 otherwise
+ */
+static int tree_flatten(struct tree_root *root)
+{
+	struct tree_flat *flat;
+	struct tree *t = &root->tree;
+	int nr = 0, size;
+
+	while (t) {
+
+		if (nr == root->size) {
+			size = root->size ? root->size * 2 : TREE_STACK_SIZE;
+			flat = realloc(root->flat, sizeof(*flat) * size);
+			if (!flat)
+				return -1;
+			root->flat = flat;
+			root->size = size;
+		}
+
+		flat = &root->flat[nr];
+		flat->node = t;
+		flat->parent = t->parent ? t->parent->index : -1;
+		flat->child = -1;
+		flat->size = 1;
+		flat->depth = t->depth;
+		flat->same = -1;
+
+		if (t->parent && root->flat[flat->parent].child < 0)
+			root->flat[flat->parent].child = nr;
+
+		t->index = nr++;
+
+		if (t->child) {
+			t = t->child;
+			continue;
+		}
+
+		/* the subtrees ending with this node are complete */
+		for (; t; t = t->parent) {
+			root->flat[t->index].size = nr - t->index;
+			if (t->next) {
+				t = t->next;
+				break;
+			}
+		}
+	}
+
+	root->nrflat = nr;
+	root->dirty = false;
+
+	/* the indexes are not needed to browse the tree, they can be missing */
+	if (root->hashed)
+		tree_hash_build(root);
+
+	if (root->names && tree_names_build(root)) {
+		free(root->names);
+		root->names = NULL;
+	}
+
+	if (root->lower)
+		tree_lower_build(root);
+
+	tree_search_reset(&root->search);
+
+	return 0;
+}
+
+/*
+ * Get the preorder array of the tree a node belongs to, the array is
+ * built again if the tree changed since the last call.
+ *
+ * @t : a node of the tree
+ * Returns the root structure with an up to date array, NULL if the
+ * array can not be built
+ */
+static struct tree_root *tree_flat(struct tree *t)
+{
+	struct tree_root *root = tree_root(t);
+
+	if (root->dirty && tree_flatten(root))
 		return NULL;
 
+	return root;
+}
+
+/*
+ * Initialize the different fields of a tree structure.
+ *
+ * @t     : the tree structure to be initialized
+ * @path  : the full path name, owned by the node
+ * @depth : the depth in the tree
+ * @fd    : an O_PATH file descriptor on the directory or -1
+ */
+static void tree_init(struct tree *t, char *path, int depth, int fd)
+{
 	/* Full pathname */
-	t->path = strdup(path);
-	if (!t->path) {
-		free(t);
-		return NULL;
-	}
+	t->path = path;
 
 	/* Basename pointer on the full path name */
 	t->name = strrchr(t->path, '/') + 1;
@@ -58,21 +561,98 @@ static inline struct tree *tree_alloc(const char *path, int depth)
 	t->next = NULL;
 	t->prev = NULL;
 	t->private = NULL;
+	t->handles = NULL;
+	t->dirfd = fd;
 	t->nrchild = 0;
+	t->index = -1;
+}
+
+/*
+ * Allocate a tree structure in an arena and initialize the different
+ * fields.
+ *
+ * @arena : the arena of the tree
+ * @path  : the absolute path to the directory
+ * @depth : the depth in the tree
+ * @fd    : an O_PATH file descriptor on the directory or -1, the node
+ *          takes the ownership of the file descriptor
+ * Returns a tree structure on success, NULL otherwise
+ */
+static inline struct tree *tree_alloc(struct arena *arena, const char *path,
+				      int depth, int fd)
+{
+	struct tree *t;
+	char *p;
+
+	t = arena_alloc(arena, sizeof(*t));
+	if (!t)
+		goto out_close;
+
+	p = arena_strdup(arena, path);
+	if (!p) {
+		arena_free(arena, t, sizeof(*t));
+		goto out_close;
+	}
+
+	tree_init(t, p, depth, fd);
 
 	return t;
+
+out_close:
+	file_closedir(fd);
+	return NULL;
+}
+
+/*
+ * Close the files kept opened by a node.
+ *
+ * @t : the node
+ */
+static inline void tree_close(struct tree *t)
+{
+	file_close_cached(&t->handles);
+	file_closedir(t->dirfd);
+	t->dirfd = -1;
 }
 
 /*
  * Free a tree structure and the fields we allocated in the
- * tree_alloc function.
+ * tree_alloc function, the memory goes back to the arena to be reused.
+ *
+ * @arena : the arena of the tree
+ * @t     : the tree structure to be freed
+ */
+static inline void tree_free(struct arena *arena, struct tree *t)
+{
+	tree_close(t);
+	arena_free(arena, t->path, strlen(t->path) + 1);
+	arena_free(arena, t, sizeof(*t));
+}
+
+/*
+ * Free a list of nodes with their subtrees.
  *
- * @t : the tree structure to be freed
+ * @arena   : the arena of the tree
+ * @t       : the first node of the list
+ * @release : a callback called for each node before it is freed, or NULL
+ * @data    : some private data to be passed to the callback
  */
-static inline void tree_free(struct tree *t)
+static void tree_free_all(struct arena *arena, struct tree *t,
+			  tree_cb_t release, void *data)
 {
-	free(t->path);
-	free(t);
+	struct tree *next;
+
+	for (; t; t = next) {
+
+		next = t->next;
+
+		tree_free_all(arena, t->child, release, data);
+
+		if (release)
+			release(t, data);
+
+		tree_free(arena, t);
+	}
 }
 
 /*
@@ -105,127 +685,1504 @@ static inline void tree_add_child(struct tree *parent, struct tree *child)
 }
 
 /*
- * This function will browse the directory structure and build a
- * tree reflecting the content of the directory tree.
+ * Remove a child from the list of its parent, the subtree of the child
+ * is left untouched.
  *
- * @tree   : the root node of the tree
- * @filter : a callback to filter out the directories
- * Returns 0 on success, -1 otherwise
+ * @parent : the parent of the child
+ * @t      : the child to be removed
  */
-static int tree_scan(struct tree *tree, tree_filter_t filter, bool follow)
+static void tree_unlink(struct tree *parent, struct tree *t)
 {
-	DIR *dir;
-	char *basedir, *newpath;
-	struct dirent dirent, *direntp;
-	struct stat s;
-	int ret = 0;
+	struct tree *head = parent->child;
 
-	dir = opendir(tree->path);
-	if (!dir)
-		return -1;
+	if (t == head) {
+		parent->child = t->next;
+		if (t->next) {
+			t->next->tail = t->tail;
+			t->next->prev = NULL;
+		}
+	} else {
+		t->prev->next = t->next;
+		if (t->next)
+			t->next->prev = t->prev;
+		else
+			head->tail = t->prev;
+	}
 
-	while (!readdir_r(dir, &dirent, &direntp)) {
+	parent->nrchild--;
 
-		struct tree *child;
+	t->next = NULL;
+	t->prev = NULL;
+	t->tail = t;
+}
 
-                if (!direntp)
-                        break;
+/*
+ * Open the directory of a node for reading, relatively to the file
+ * descriptor of the node when there is one, so the kernel does not
+ * walk the full path again.
+ *
+ * @t : the node to be browsed
+ * Returns a file descriptor on success, -1 otherwise
+ */
+static int tree_open_dir(struct tree *t)
+{
+	if (t->dirfd < 0)
+		return open(t->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 
-                if (direntp->d_name[0] == '.')
-                        continue;
+	return openat(t->dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
 
-		if (filter && filter(direntp->d_name))
-			continue;
+/*
+ * Open the directory of a node in order to browse its content.
+ *
+ * @t : the node to be browsed
+ * Returns a directory stream on success, NULL otherwise
+ */
+DIR *tree_opendir(struct tree *t)
+{
+	DIR *dir;
+	int fd;
 
-		ret = asprintf(&basedir, "%s", tree->path);
-		if (ret < 0)
-			return -1;
+	fd = tree_open_dir(t);
+	if (fd < 0)
+		return NULL;
 
-		ret = basename(basedir) ? 0 : -1;
-		if (ret < 0)
-			goto out_free_basedir;
+	dir = fdopendir(fd);
+	if (!dir)
+		close(fd);
 
-		ret = asprintf(&newpath, "%s/%s", basedir, direntp->d_name);
-		if (ret < 0)
-			goto out_free_basedir;
+	return dir;
+}
 
-		ret = stat(newpath, &s);
-		if (ret)
-			goto out_free_newpath;
+/*
+ * Check if a directory entry is a directory to be added to the tree.
+ * The type given by the kernel is trusted, the entry is only looked up
+ * when the type is unknown or when it is a symbolic link, in order to
+ * know if the link points to a directory.
+ *
+ * @fd : the directory containing the entry
+ * @d  : the directory entry
+ * Returns true if the entry is a directory, false otherwise
+ */
+static bool tree_is_dir(int fd, struct tree_dirent *d, struct stat *s)
+{
+	if (d->d_type == DT_DIR)
+		return true;
+
+	if (d->d_type != DT_UNKNOWN && d->d_type != DT_LNK)
+		return false;
+
+	if (fstatat(fd, d->d_name, s, 0))
+		return false;
+
+	return S_ISDIR(s->st_mode);
+}
+
+static inline unsigned int tree_visit_hash(dev_t dev, ino_t ino)
+{
+	uint64_t h = ((uint64_t)dev << 32 ^ ino) * 0x9e3779b97f4a7c15ULL;
+
+	return h >> 32;
+}
+
+/*
+ * Look up the slot of a directory in the table of the directories
+ * found by a scan, the table is never full.
+ *
+ * @ids  : the table
+ * @size : the number of slots, a power of two
+ * @dev  : the device of the directory
+ * @ino  : the inode of the directory
+ * Returns the slot of the directory or the free slot where it goes
+ */
+static struct tree_id *tree_visit_slot(struct tree_id *ids, int size,
+				       dev_t dev, ino_t ino)
+{
+	unsigned int i = tree_visit_hash(dev, ino) & (size - 1);
+
+	while (ids[i].ino && (ids[i].ino != ino || ids[i].dev != dev))
+		i = (i + 1) & (size - 1);
+
+	return &ids[i];
+}
+
+static int tree_visit_grow(struct tree_visit *visit)
+{
+	struct tree_id *ids, *id;
+	int i, size = visit->size ? visit->size * 2 : TREE_VISIT_SIZE;
+
+	ids = calloc(size, sizeof(*ids));
+	if (!ids)
+		return -1;
+
+	for (i = 0; i < visit->size; i++) {
+
+		id = &visit->ids[i];
+		if (id->ino)
+			*tree_visit_slot(ids, size, id->dev, id->ino) = *id;
+	}
+
+	free(visit->ids);
+	visit->ids = ids;
+	visit->size = size;
+
+	return 0;
+}
+
+/*
+ * Record a directory in the directories found by a scan.
+ *
+ * @visit : the directories found by the scan
+ * @dev   : the device of the directory
+ * @ino   : the inode of the directory
+ * @link  : the directory is found through a link
+ * Returns 0 if the directory was not found yet, 1 if it was or if the
+ * scan followed TREE_VISIT_LINKS links already, -1 otherwise
+ */
+static int tree_visit_add(struct tree_visit *visit, dev_t dev, ino_t ino,
+			  bool link)
+{
+	struct tree_id *id;
+	int ret = 1;
+
+	pthread_mutex_lock(&visit->lock);
+
+	if (link && visit->links >= TREE_VISIT_LINKS)
+		goto out;
+
+	if (visit->nr * 2 >= visit->size && tree_visit_grow(visit)) {
+		ret = -1;
+		goto out;
+	}
+
+	id = tree_visit_slot(visit->ids, visit->size, dev, ino);
+	if (id->ino)
+		goto out;
+
+	id->dev = dev;
+	id->ino = ino;
+	visit->nr++;
+	visit->links += link;
+	ret = 0;
+out:
+	pthread_mutex_unlock(&visit->lock);
+
+	return ret;
+}
+
+/*
+ * Record the directory a directory entry points to in the directories
+ * found by a scan. The inode of a subdirectory is given by the entry,
+ * only the targets of the links were looked up by tree_is_dir.
+ *
+ * @visit : the directories found by the scan
+ * @dir   : the status of the directory containing the entry
+ * @d     : the directory entry
+ * @s     : the status of the target of the entry
+ * Returns 0 if the directory was not found yet, 1 if it is left out,
+ * -1 otherwise
+ */
+static int tree_visit_entry(struct tree_visit *visit, struct stat *dir,
+			    struct tree_dirent *d, struct stat *s)
+{
+	if (d->d_type == DT_DIR)
+		return tree_visit_add(visit, dir->st_dev, d->d_ino, false);
+
+	return tree_visit_add(visit, s->st_dev, s->st_ino,
+			      d->d_type == DT_LNK);
+}
+
+static void tree_visit_init(struct tree_visit *visit)
+{
+	pthread_mutex_init(&visit->lock, NULL);
+	visit->ids = NULL;
+	visit->nr = 0;
+	visit->size = 0;
+	visit->links = 0;
+}
+
+/*
+ * Record the directory of a node in the directories found by a scan.
+ *
+ * @visit : the directories found by the scan
+ * @t     : the node
+ * Returns 0 if the directory was not found yet, 1 if it is left out,
+ * -1 otherwise
+ */
+static int tree_visit_node(struct tree_visit *visit, struct tree *t)
+{
+	struct stat s;
+
+	if (t->dirfd >= 0 ? fstat(t->dirfd, &s) : stat(t->path, &s))
+		return errno == ENOENT ? 1 : -1;
 
-		if (S_ISDIR(s.st_mode) || (S_ISLNK(s.st_mode) && follow)) {
+	return tree_visit_add(visit, s.st_dev, s.st_ino, false);
+}
 
-			ret = -1;
+static void tree_visit_destroy(struct tree_visit *visit)
+{
+	pthread_mutex_destroy(&visit->lock);
+	free(visit->ids);
+}
 
-			child = tree_alloc(newpath, tree->depth + 1);
+/*
+ * Read the entries of the directory of a node and add a child for each
+ * subdirectory, in the order the entries are returned by the kernel.
+ * The entries are read in bulk with getdents64.
+ *
+ * @tree   : the node to be browsed
+ * @arena  : the arena where the children are allocated
+ * @filter : a callback to filter out the directories
+ * @visit  : the directories found by the scan when the links are
+ *           followed, NULL otherwise
+ * Returns 0 on success, 1 if the directory vanished, -1 otherwise
+ */
+static int tree_scan_dir(struct tree *tree, struct arena *arena,
+			 tree_filter_t filter, struct tree_visit *visit)
+{
+	char buf[TREE_DIRENT_BUF];
+	char newpath[PATH_MAX];
+	struct tree_dirent *d;
+	struct tree *child;
+	struct stat s, dir;
+	long len, pos;
+	int fd, seen, ret = -1;
+
+	fd = tree_open_dir(tree);
+	if (fd < 0)
+		return errno == ENOENT ? 1 : -1;
+
+	if (visit && fstat(fd, &dir))
+		goto out;
+
+	while ((len = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+
+		for (pos = 0; pos < len; pos += d->d_reclen) {
+
+			d = (struct tree_dirent *)(buf + pos);
+
+			if (d->d_name[0] == '.')
+				continue;
+
+			if (filter && filter(d->d_name))
+				continue;
+
+			if (!tree_is_dir(fd, d, &s))
+				continue;
+
+			/* the directory was found through another path */
+			seen = visit ? tree_visit_entry(visit, &dir, d, &s) : 0;
+			if (seen < 0)
+				goto out;
+			if (seen)
+				continue;
+
+			if (snprintf(newpath, sizeof(newpath), "%s/%s",
+				     tree->path, d->d_name) >= sizeof(newpath))
+				goto out;
+
+			child = tree_alloc(arena, newpath, tree->depth + 1,
+					   file_opendir(tree->dirfd,
+							d->d_name));
 			if (!child)
-				goto out_free_newpath;
+				goto out;
 
 			tree_add_child(tree, child);
 
 			tree->nrchild++;
+		}
+	}
+
+	if (!len)
+		ret = 0;
+
+	/* the directory was removed after it was opened */
+	if (len < 0 && errno == ENOENT)
+		ret = 1;
+out:
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * Structure describing the directories waiting to be browsed by a
+ * worker, the worker takes the last directory pushed while the other
+ * workers steal the oldest one, which is likely a bigger subtree.
+ *
+ * lock  : protects the other fields
+ * nodes : the array of the directories
+ * head  : the index of the oldest directory
+ * tail  : the index following the last directory pushed
+ * size  : the size of the array
+ */
+struct tree_deque {
+	pthread_mutex_t lock;
+	struct tree **nodes;
+	int head;
+	int tail;
+	int size;
+};
+
+/*
+ * Structure shared by the workers of a parallel scan
+ *
+ * deques  : a deque per worker
+ * nr      : the number of workers
+ * pending : the number of directories pushed and not browsed yet
+ * error   : set when a worker failed, the other ones stop
+ * filter  : a callback to filter out the directories
+ * visit   : the directories found when the links are followed, or NULL
+ */
+struct tree_pool {
+	struct tree_deque *deques;
+	int nr;
+	int pending;
+	int error;
+	tree_filter_t filter;
+	struct tree_visit *visit;
+};
+
+/*
+ * Structure describing a worker of a parallel scan
+ *
+ * pool   : the pool the worker belongs to
+ * arena  : the nodes found by the worker, merged in the arena of the
+ *          tree at the end of the scan, so the threads do not share
+ *          an allocator
+ * gone   : the directories which vanished, removed from the tree at
+ *          the end of the scan, when the lists are not browsed anymore
+ * nrgone : the number of directories which vanished
+ * id     : the index of the deque of the worker
+ */
+struct tree_worker {
+	struct tree_pool *pool;
+	struct arena arena;
+	struct tree **gone;
+	int nrgone;
+	int id;
+};
+
+/* Number of threads browsing a tree, 0 for the number of processors */
+static int tree_workers;
+
+/*
+ * Set the number of threads used to browse the big trees.
+ *
+ * @nr : the number of threads, 1 to browse the trees serially and 0 to
+ *       use a thread per processor
+ */
+void tree_set_workers(int nr)
+{
+	tree_workers = nr;
+}
+
+static int tree_nr_workers(void)
+{
+	long nr = tree_workers;
+
+	if (nr <= 0)
+		nr = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (nr > TREE_WORKERS_MAX)
+		nr = TREE_WORKERS_MAX;
+
+	return nr < 1 ? 1 : nr;
+}
+
+static int tree_deque_push(struct tree_deque *dq, struct tree *t)
+{
+	struct tree **nodes;
+	int ret = -1;
+
+	pthread_mutex_lock(&dq->lock);
+
+	if (dq->tail == dq->size) {
+
+		/* reuse the room left by the directories stolen */
+		if (dq->head) {
+			memmove(dq->nodes, dq->nodes + dq->head,
+				sizeof(*nodes) * (dq->tail - dq->head));
+			dq->tail -= dq->head;
+			dq->head = 0;
+		}
+
+		if (dq->tail == dq->size) {
+			nodes = realloc(dq->nodes, sizeof(*nodes) *
+					(dq->size ? dq->size * 2 :
+					 TREE_STACK_SIZE));
+			if (!nodes)
+				goto out;
+			dq->nodes = nodes;
+			dq->size = dq->size ? dq->size * 2 : TREE_STACK_SIZE;
+		}
+	}
+
+	dq->nodes[dq->tail++] = t;
+	ret = 0;
+out:
+	pthread_mutex_unlock(&dq->lock);
+
+	return ret;
+}
+
+/*
+ * Take a directory from a deque.
+ *
+ * @dq    : the deque
+ * @steal : take the oldest directory rather than the last one
+ * Returns a node, NULL if the deque is empty
+ */
+static struct tree *tree_deque_pop(struct tree_deque *dq, bool steal)
+{
+	struct tree *t = NULL;
+
+	pthread_mutex_lock(&dq->lock);
+
+	if (dq->head != dq->tail)
+		t = steal ? dq->nodes[dq->head++] : dq->nodes[--dq->tail];
+
+	if (dq->head == dq->tail)
+		dq->head = dq->tail = 0;
+
+	pthread_mutex_unlock(&dq->lock);
+
+	return t;
+}
+
+static void *tree_worker(void *arg)
+{
+	struct tree_worker *w = arg;
+	struct tree_pool *pool = w->pool;
+	struct tree *t, *child, **gone;
+	int i, ret;
+
+	while (!__atomic_load_n(&pool->error, __ATOMIC_RELAXED)) {
+
+		t = tree_deque_pop(&pool->deques[w->id], false);
+
+		for (i = 1; !t && i < pool->nr; i++)
+			t = tree_deque_pop(&pool->deques[(w->id + i) %
+							 pool->nr], true);
+		if (!t) {
+			if (!__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE))
+				break;
+			sched_yield();
+			continue;
+		}
+
+		/*
+		 * The children of a directory are only added by the worker
+		 * browsing it, so they are in the same order as with the
+		 * serial scan.
+		 */
+		ret = tree_scan_dir(t, &w->arena, pool->filter, pool->visit);
+		if (ret < 0)
+			goto error;
+
+		if (ret) {
+			gone = realloc(w->gone, sizeof(*gone) * (w->nrgone + 1));
+			if (!gone)
+				goto error;
+			w->gone = gone;
+			w->gone[w->nrgone++] = t;
+		}
+
+		for (child = t->child ? t->child->tail : NULL; child;
+		     child = child->prev) {
+
+			__atomic_add_fetch(&pool->pending, 1, __ATOMIC_RELEASE);
+
+			if (tree_deque_push(&pool->deques[w->id], child))
+				goto error;
+		}
+
+		__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+error:
+	__atomic_store_n(&pool->error, 1, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/*
+ * Browse the directories left in the stack of a serial scan with a pool
+ * of threads, each one having its own deque of directories. The caller
+ * is the first worker.
+ *
+ * @stack  : the directories to be browsed
+ * @nr     : the number of directories
+ * @arena  : the arena of the tree
+ * @filter : a callback to filter out the directories
+ * @visit  : the directories found when the links are followed, or NULL
+ * @nrw    : the number of workers
+ * Returns 0 on success, -1 otherwise
+ */
+static int tree_scan_parallel(struct tree **stack, int nr,
+			      struct arena *arena, tree_filter_t filter,
+			      struct tree_visit *visit, int nrw)
+{
+	struct tree_deque deques[TREE_WORKERS_MAX] = { 0 };
+	struct tree_worker workers[TREE_WORKERS_MAX];
+	pthread_t threads[TREE_WORKERS_MAX];
+	struct tree_pool pool = {
+		.deques  = deques,
+		.nr      = nrw,
+		.pending = nr,
+		.filter  = filter,
+		.visit   = visit,
+	};
+	struct tree *t;
+	int i, j, nrthreads = 0;
+
+	for (i = 0; i < nrw; i++) {
+		pthread_mutex_init(&deques[i].lock, NULL);
+		workers[i].pool = &pool;
+		workers[i].id = i;
+		workers[i].gone = NULL;
+		workers[i].nrgone = 0;
+		arena_init(&workers[i].arena);
+	}
+
+	for (i = 0; i < nr; i++)
+		if (tree_deque_push(&deques[i % nrw], stack[i]))
+			pool.error = 1;
+
+	for (i = 1; i < nrw && !pool.error; i++, nrthreads++)
+		if (pthread_create(&threads[i], NULL, tree_worker,
+				   &workers[i]))
+			break;
+
+	tree_worker(&workers[0]);
+
+	for (i = 1; i <= nrthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < nrw; i++) {
+		pthread_mutex_destroy(&deques[i].lock);
+		free(deques[i].nodes);
+		arena_merge(arena, &workers[i].arena);
+	}
+
+	for (i = 0; i < nrw; i++) {
+		for (j = 0; j < workers[i].nrgone; j++) {
+			t = workers[i].gone[j];
+			tree_unlink(t->parent, t);
+			tree_free_all(arena, t, NULL, NULL);
+		}
+		free(workers[i].gone);
+	}
+
+	return pool.error ? -1 : 0;
+}
+
+/*
+ * This function will browse the directory structure and build a
+ * tree reflecting the content of the directory tree. The directories
+ * waiting to be browsed are kept in a stack rather than browsed
+ * recursively, so only one directory is opened at a time. When the
+ * tree grows beyond TREE_PARALLEL_NODES, the directories left are
+ * browsed by a pool of threads.
+ *
+ * A directory removed while the tree is browsed is left out of the
+ * tree.
+ *
+ * When the symbolic links are followed, a directory is added once to
+ * the tree, at the first path it is found with, so the loops are cut.
+ * With several threads, the path kept for a directory found through
+ * different links depends on the order the threads reach it.
+ *
+ * @tree   : the root node of the tree
+ * @arena  : the arena of the tree
+ * @filter : a callback to filter out the directories
+ * @visit  : the directories found when the links are followed, with the
+ *           root directory already in, or NULL
+ * Returns 0 on success, 1 if the root directory vanished, -1 otherwise
+ */
+static int tree_scan(struct tree *tree, struct arena *arena,
+		     tree_filter_t filter, struct tree_visit *visit)
+{
+	struct tree **stack, **tmp, *t;
+	int nr = 0, size = TREE_STACK_SIZE, nodes = 1, ret = -1;
+	int nrw = tree_nr_workers();
+
+	stack = malloc(sizeof(*stack) * size);
+	if (!stack)
+		return -1;
+
+	stack[nr++] = tree;
+
+	while (nr) {
+
+		if (nrw > 1 && nodes >= TREE_PARALLEL_NODES) {
+			ret = tree_scan_parallel(stack, nr, arena, filter,
+						 visit, nrw);
+			goto out_free;
+		}
+
+		t = stack[--nr];
+
+		ret = tree_scan_dir(t, arena, filter, visit);
+		if (ret < 0 || (ret && t == tree))
+			goto out_free;
+
+		if (ret) {
+			tree_unlink(t->parent, t);
+			tree_free_all(arena, t, NULL, NULL);
+			continue;
+		}
+
+		nodes += t->nrchild;
+
+		if (nr + t->nrchild > size) {
+
+			size = (nr + t->nrchild) * 2;
+
+			tmp = realloc(stack, sizeof(*stack) * size);
+			if (!tmp) {
+				ret = -1;
+				goto out_free;
+			}
+			stack = tmp;
+		}
+
+		/* pushed backward, so the first child is browsed first */
+		for (t = t->child ? t->child->tail : NULL; t; t = t->prev)
+			stack[nr++] = t;
+	}
+
+	ret = 0;
+out_free:
+	free(stack);
+
+	return ret;
+}
+
+/*
+ * Browse a directory which is not in a tree yet, when the links are
+ * followed the loops are cut inside the new subtree.
+ *
+ * @tree   : the node of the directory
+ * @arena  : the arena of the tree
+ * @filter : a callback to filter out the directories
+ * @follow : follow the symbolic links
+ * Returns 0 on success, 1 if the directory vanished, -1 otherwise
+ */
+static int tree_scan_new(struct tree *tree, struct arena *arena,
+			 tree_filter_t filter, bool follow)
+{
+	struct tree_visit visit;
+	int ret;
+
+	if (!follow)
+		return tree_scan(tree, arena, filter, NULL);
+
+	tree_visit_init(&visit);
+
+	ret = tree_visit_node(&visit, tree);
+	if (!ret)
+		ret = tree_scan(tree, arena, filter, &visit);
+
+	tree_visit_destroy(&visit);
+
+	return ret;
+}
+
+/*
+ * Allocate the root structure of a tree with its root node, the tree
+ * has no other node yet.
+ *
+ * @path : the path of the root directory
+ * Returns the root structure on success, NULL otherwise
+ */
+static struct tree_root *tree_root_alloc(const char *path)
+{
+	struct tree_root *root;
+	char *p;
+	int fd;
+
+	fd = file_opendir(AT_FDCWD, path);
+
+	root = malloc(sizeof(*root));
+	if (!root)
+		goto out_close;
+
+	arena_init(&root->arena);
+	root->flat = NULL;
+	root->nrflat = 0;
+	root->size = 0;
+	root->dirty = true;
+	root->hash = NULL;
+	root->nrhash = 0;
+	root->hashed = false;
+	root->names = NULL;
+	root->lower = NULL;
+	root->offsets = NULL;
+	memset(&root->search, 0, sizeof(root->search));
+
+	p = arena_strdup(&root->arena, path);
+	if (!p)
+		goto out_free;
+
+	tree_init(&root->tree, p, 0, fd);
+
+	return root;
+
+out_free:
+	free(root);
+out_close:
+	file_closedir(fd);
+	return NULL;
+}
+
+/*
+ * This function takes the topmost directory path and populate the
+ * directory tree structures.
+ *
+ * The symbolic links to directories are browsed in any case. Without
+ * follow, nothing prevents a loop of links and the filter has to leave
+ * them out. With follow, a directory is added once to the tree whatever
+ * the links it is found through, which cuts the loops, and the scan
+ * stops following the links after TREE_VISIT_LINKS of them.
+ *
+ * @path   : a path to the topmost directory path
+ * @filter : a callback to filter out the directories
+ * @follow : follow the symbolic links safely
+ * Returns a tree structure corresponding to the root node of the
+ * directory tree representation on success, NULL otherwise
+ */
+struct tree *tree_load(const char *path, tree_filter_t filter, bool follow)
+{
+	struct tree_root *root;
+
+	root = tree_root_alloc(path);
+	if (!root)
+		return NULL;
+
+	if (tree_scan_new(&root->tree, &root->arena, filter, follow)) {
+		tree_destroy(&root->tree);
+		return NULL;
+	}
+
+	return &root->tree;
+}
+
+/*
+ * Build a tree from the list of its nodes in preorder, as saved from a
+ * tree loaded before, rather than browsing the directories. Only the
+ * directory of each node is opened, relatively to its parent, so a
+ * directory which vanished since the list was saved is noticed. The
+ * nodes get their index in the list as index in the preorder array.
+ *
+ * @path : the path of the root directory
+ * @nr   : the number of nodes, the root node included
+ * @node : a callback giving the name and the index of the parent of the
+ *         nodes following the root node, in preorder
+ * @data : some private data to be passed to the callback
+ * Returns the root node, NULL if a directory is missing or on error
+ */
+struct tree *tree_build(const char *path, int nr, tree_node_t node,
+			void *data)
+{
+	struct tree_root *root;
+	struct tree **nodes, *parent, *t;
+	char newpath[PATH_MAX];
+	const char *name;
+	int i, index;
+
+	root = tree_root_alloc(path);
+	if (!root)
+		return NULL;
+
+	if (nr < 1)
+		goto out_destroy;
+
+	nodes = malloc(sizeof(*nodes) * nr);
+	if (!nodes)
+		goto out_destroy;
+
+	nodes[0] = &root->tree;
+
+	for (i = 1; i < nr; i++) {
+
+		index = node(i, &name, data);
+		if (index < 0 || index >= i)
+			goto out_free;
+
+		parent = nodes[index];
+
+		if (snprintf(newpath, sizeof(newpath), "%s/%s", parent->path,
+			     name) >= sizeof(newpath))
+			goto out_free;
+
+		errno = 0;
+
+		t = tree_alloc(&root->arena, newpath, parent->depth + 1,
+			       file_opendir(parent->dirfd, name));
+		if (!t)
+			goto out_free;
+
+		nodes[i] = t;
+
+		tree_add_child(parent, t);
+
+		parent->nrchild++;
+
+		/* the directory vanished, the list is stale */
+		if (t->dirfd < 0 && errno == ENOENT)
+			goto out_free;
+	}
+
+	free(nodes);
+
+	return &root->tree;
+
+out_free:
+	free(nodes);
+out_destroy:
+	tree_destroy(&root->tree);
+	return NULL;
+}
+
+static int tree_close_cb(struct tree *t, void *data)
+{
+	tree_close(t);
+
+	return 0;
+}
+
+/*
+ * Free a tree loaded with tree_load. The nodes are only browsed to
+ * close their files, the memory of the nodes and of their private data
+ * allocated with tree_alloc_private is freed at once with the arena.
+ *
+ * @tree : the root node of the tree
+ */
+void tree_destroy(struct tree *tree)
+{
+	struct tree_root *root = (struct tree_root *)tree;
+
+	tree_for_each(tree, tree_close_cb, NULL);
+
+	arena_destroy(&root->arena);
+	free(root->flat);
+	free(root->hash);
+	free(root->names);
+	free(root->lower);
+	free(root->offsets);
+	tree_search_reset(&root->search);
+	free(root);
+}
+
+/*
+ * Allocate the private data of a node in the arena of its tree, the
+ * memory is released with the tree.
+ *
+ * @t    : a node of the tree
+ * @size : the size of the private data
+ * Returns a zeroed block on success, NULL otherwise
+ */
+void *tree_alloc_private(struct tree *t, size_t size)
+{
+	return arena_alloc(tree_arena(t), size);
+}
+
+/*
+ * Give back the private data of a node removed from the tree, the
+ * memory is reused by the next allocations in the tree.
+ *
+ * @t    : the node
+ * @ptr  : the private data allocated with tree_alloc_private
+ * @size : the size given to tree_alloc_private
+ */
+void tree_free_private(struct tree *t, void *ptr, size_t size)
+{
+	arena_free(tree_arena(t), ptr, size);
+}
+
+/*
+ * Add a directory appearing after the tree was loaded, the directory
+ * is scanned and added at the end of the children of the parent. As
+ * the new node is the last one of the list, tree_for_each called on it
+ * only goes over the new subtree.
+ *
+ * @parent : the node containing the directory
+ * @name   : the name of the directory
+ * @filter : a callback to filter out the directories
+ * @follow : follow the symbolic links, the loops are cut inside the new
+ *           subtree only
+ * Returns the new node, the existing node if the directory is already
+ * in the tree, NULL if the directory is filtered out or on error
+ */
+struct tree *tree_add(struct tree *parent, const char *name,
+		      tree_filter_t filter, bool follow)
+{
+	struct arena *arena = tree_arena(parent);
+	char path[PATH_MAX];
+	struct tree *t;
+
+	for (t = parent->child; t; t = t->next)
+		if (!strcmp(t->name, name))
+			return t;
+
+	if (name[0] == '.' || (filter && filter(name)))
+		return NULL;
+
+	if (snprintf(path, sizeof(path), "%s/%s", parent->path, name) >=
+	    sizeof(path))
+		return NULL;
+
+	t = tree_alloc(arena, path, parent->depth + 1,
+		       file_opendir(parent->dirfd, name));
+	if (!t)
+		return NULL;
+
+	if (tree_scan_new(t, arena, filter, follow)) {
+		tree_free_all(arena, t, NULL, NULL);
+		return NULL;
+	}
+
+	tree_add_child(parent, t);
+
+	parent->nrchild++;
+
+	tree_root(parent)->dirty = true;
+
+	return t;
+}
+
+/*
+ * Remove a directory which disappeared from the tree, with all its
+ * subtree.
+ *
+ * @parent  : the node containing the directory
+ * @name    : the name of the directory
+ * @release : a callback called for each node removed, before the node
+ *            is freed, to release its private data
+ * @data    : some private data to be passed to the callback
+ * Returns 0 on success, -1 if the directory is not in the tree
+ */
+int tree_del(struct tree *parent, const char *name,
+	     tree_cb_t release, void *data)
+{
+	struct tree *t;
+
+	for (t = parent->child; t; t = t->next)
+		if (!strcmp(t->name, name))
+			break;
+
+	if (!t)
+		return -1;
+
+	tree_unlink(parent, t);
+	tree_free_all(tree_arena(parent), t, release, data);
+
+	tree_root(parent)->dirty = true;
+
+	return 0;
+}
+
+/*
+ * Move a node and its subtree under another parent, at the end of its
+ * children. The tree does not follow the directories anymore but the
+ * paths of the nodes are kept, so their files are still found. It is
+ * used when the hierarchy is given by the content of the files rather
+ * than by the directories.
+ *
+ * @t      : the node to be moved
+ * @parent : the new parent of the node
+ * Returns 0 on success, -1 if the parent is in the subtree of the node
+ */
+int tree_move(struct tree *t, struct tree *parent)
+{
+	struct tree *p;
+	int delta;
+
+	for (p = parent; p; p = p->parent)
+		if (p == t)
+			return -1;
+
+	if (t->parent == parent)
+		return 0;
+
+	tree_unlink(t->parent, t);
+	tree_add_child(parent, t);
+
+	parent->nrchild++;
+
+	delta = parent->depth + 1 - t->depth;
+
+	for (p = t; p; p = tree_next(p, t->parent))
+		p->depth += delta;
+
+	tree_root(parent)->dirty = true;
+
+	return 0;
+}
+
+/*
+ * Structure describing a subdirectory found when a directory is listed
+ * again by tree_reload
+ *
+ * name  : the name of the subdirectory
+ * found : the subdirectory is already in the tree
+ */
+struct tree_entry {
+	char *name;
+	bool found;
+};
+
+static void tree_entries_free(struct tree_entry *entries, int nr)
+{
+	while (nr--)
+		free(entries[nr].name);
+
+	free(entries);
+}
+
+static int tree_entry_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct tree_entry *)a)->name,
+		      ((const struct tree_entry *)b)->name);
+}
+
+/*
+ * List the subdirectories of a node, sorted by name.
+ *
+ * @t      : the node to be listed
+ * @filter : a callback to filter out the directories
+ * @ptr    : the array of the subdirectories, to be freed with the names
+ * Returns the number of subdirectories, -1 on error, -2 if the
+ * directory vanished
+ */
+static int tree_list_dir(struct tree *t, tree_filter_t filter,
+			 struct tree_entry **ptr)
+{
+	char buf[TREE_DIRENT_BUF];
+	struct tree_entry *entries = NULL, *tmp;
+	struct tree_dirent *d;
+	struct stat s;
+	long len, pos;
+	int fd, nr = 0, size = 0, ret = -1;
+
+	fd = tree_open_dir(t);
+	if (fd < 0)
+		return errno == ENOENT ? -2 : -1;
+
+	while ((len = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+
+		for (pos = 0; pos < len; pos += d->d_reclen) {
+
+			d = (struct tree_dirent *)(buf + pos);
+
+			if (d->d_name[0] == '.')
+				continue;
+
+			if (filter && filter(d->d_name))
+				continue;
+
+			if (!tree_is_dir(fd, d, &s))
+				continue;
+
+			if (nr == size) {
+				size = size ? size * 2 : TREE_STACK_SIZE;
+				tmp = realloc(entries, sizeof(*tmp) * size);
+				if (!tmp)
+					goto out_free;
+				entries = tmp;
+			}
+
+			entries[nr].name = strdup(d->d_name);
+			if (!entries[nr].name)
+				goto out_free;
+			entries[nr++].found = false;
+		}
+	}
+
+	if (len < 0) {
+		ret = errno == ENOENT ? -2 : -1;
+		goto out_free;
+	}
+
+	close(fd);
+
+	if (nr)
+		qsort(entries, nr, sizeof(*entries), tree_entry_cmp);
+
+	*ptr = entries;
+
+	return nr;
+
+out_free:
+	close(fd);
+	tree_entries_free(entries, nr);
+
+	return ret;
+}
+
+/*
+ * Compare the subdirectories of a node with its children, the children
+ * which vanished are removed from the tree and the new subdirectories
+ * are added, with their subtree, at the end of the children.
+ *
+ * @root    : the root structure of the tree
+ * @t       : the node to be compared
+ * @entries : the subdirectories of the node, sorted by name
+ * @nr      : the number of subdirectories
+ * @added   : the array where the new nodes are stored
+ * @nradded : the number of new nodes in the array
+ * @filter  : a callback to filter out the directories
+ * @visit   : the directories of the tree when the links are followed,
+ *            or NULL
+ * @removed : a callback called for each node removed, or NULL
+ * @data    : some private data to be passed to the callback
+ * Returns the number of changes on success, -1 otherwise
+ */
+static int tree_diff_dir(struct tree_root *root, struct tree *t,
+			 struct tree_entry *entries, int nr,
+			 struct tree ***added, int *nradded,
+			 tree_filter_t filter, struct tree_visit *visit,
+			 tree_cb_t removed, void *data)
+{
+	char path[PATH_MAX];
+	struct tree_entry key, *entry;
+	struct tree *child, *next, **tmp;
+	int i, ret, changes = 0;
+
+	for (child = t->child; child; child = next) {
+
+		next = child->next;
+
+		key.name = child->name;
+		entry = bsearch(&key, entries, nr, sizeof(*entries),
+				tree_entry_cmp);
+		if (entry) {
+			entry->found = true;
+			continue;
+		}
+
+		tree_unlink(t, child);
+		tree_free_all(&root->arena, child, removed, data);
+		root->dirty = true;
+		changes++;
+	}
+
+	for (i = 0; i < nr; i++) {
+
+		if (entries[i].found)
+			continue;
+
+		if (snprintf(path, sizeof(path), "%s/%s", t->path,
+			     entries[i].name) >= sizeof(path))
+			continue;
+
+		child = tree_alloc(&root->arena, path, t->depth + 1,
+				   file_opendir(t->dirfd, entries[i].name));
+		if (!child)
+			return -1;
+
+		/* a directory already in the tree through another path */
+		ret = visit ? tree_visit_node(visit, child) : 0;
+		if (!ret)
+			ret = tree_scan(child, &root->arena, filter, visit);
+		if (ret) {
+			tree_free_all(&root->arena, child, NULL, NULL);
+			if (ret < 0)
+				return -1;
+			/* it vanished in the meantime or it is left out */
+			continue;
+		}
+
+		tmp = realloc(*added, sizeof(*tmp) * (*nradded + 1));
+		if (!tmp) {
+			tree_free_all(&root->arena, child, NULL, NULL);
+			return -1;
+		}
+		*added = tmp;
+		(*added)[(*nradded)++] = child;
+
+		tree_add_child(t, child);
+		t->nrchild++;
+		root->dirty = true;
+		changes++;
+	}
+
+	return changes;
+}
+
+/*
+ * Browse again the directories of a tree and update the tree with the
+ * directories added or removed since it was loaded. The nodes which
+ * are still there are kept as they are, with their private data, so
+ * the pointers on them stay valid. The directories are listed one by
+ * one and compared with the children of their node, there is no second
+ * tree to be built.
+ *
+ * @tree    : the root node of the tree
+ * @filter  : a callback to filter out the directories
+ * @follow  : follow the symbolic links
+ * @added   : a callback called for each node added, parents first, or
+ *            NULL
+ * @removed : a callback called for each node removed, before the node
+ *            is freed, to release its private data, or NULL
+ * @data    : some private data to be passed to the callbacks
+ * Returns the number of nodes added or removed at the top of their
+ * subtree, -1 on error
+ */
+int tree_reload(struct tree *tree, tree_filter_t filter, bool follow,
+		tree_cb_t added, tree_cb_t removed, void *data)
+{
+	struct tree_root *root = tree_root(tree);
+	struct tree **stack, **tmp, **nodes = NULL, *t;
+	struct tree_visit visit, *pvisit = NULL;
+	struct tree_entry *entries;
+	int nr = 0, size = TREE_STACK_SIZE, nrnodes = 0, changes = 0;
+	int i, j, nrentries, ret = -1;
+
+	stack = malloc(sizeof(*stack) * size);
+	if (!stack)
+		return -1;
+
+	stack[nr++] = tree;
+
+	/* the directories of the tree are not added again through a link */
+	if (follow) {
+		pvisit = &visit;
+		tree_visit_init(pvisit);
+		for (t = tree; t; t = tree_next(t, NULL))
+			if (tree_visit_node(pvisit, t) < 0)
+				goto out_free;
+	}
+
+	while (nr) {
+
+		t = stack[--nr];
+
+		nrentries = tree_list_dir(t, filter, &entries);
+		if (nrentries == -2 && t != tree)
+			continue;
+		if (nrentries < 0)
+			goto out_free;
+
+		i = nrnodes;
+
+		ret = tree_diff_dir(root, t, entries, nrentries, &nodes,
+				    &nrnodes, filter, pvisit, removed, data);
+
+		tree_entries_free(entries, nrentries);
+
+		if (ret < 0)
+			goto out_free;
+
+		changes += ret;
+		ret = -1;
+
+		if (nr + t->nrchild > size) {
+
+			size = (nr + t->nrchild) * 2;
+
+			tmp = realloc(stack, sizeof(*stack) * size);
+			if (!tmp)
+				goto out_free;
+			stack = tmp;
+		}
+
+		/* the new children, at the end, were browsed when added */
+		for (j = t->nrchild - (nrnodes - i), t = t->child; j > 0;
+		     j--, t = t->next)
+			stack[nr++] = t;
+	}
+
+	ret = changes;
+out_free:
+	/* the new nodes are given to the callback once they are all in */
+	if (added && nrnodes && !tree_flat(tree))
+		ret = -1;
+	else if (added) {
+		for (i = 0; i < nrnodes; i++) {
+			t = nodes[i];
+			for (j = t->index; j < t->index +
+				     root->flat[t->index].size; j++)
+				if (added(root->flat[j].node, data))
+					ret = -1;
+		}
+	}
+
+	if (pvisit)
+		tree_visit_destroy(pvisit);
+	free(nodes);
+	free(stack);
+
+	return ret;
+}
+
+/*
+ * Read an attribute file of the node, the file is kept opened in the
+ * node, so the next reads do not have to lookup the path again.
+ *
+ * @t     : the node containing the attribute file
+ * @name  : the name of the attribute file
+ * @type  : the type of the value
+ * @value : a pointer to a variable to store the content of the file
+ * @size  : the size of the variable pointed by value
+ * Returns 0 on success, -1 otherwise
+ */
+int tree_read_value(struct tree *t, const char *name,
+		    int type, void *value, size_t size)
+{
+	return file_read_cached(&t->handles, t->dirfd, t->path,
+				name, type, value, size);
+}
+
+/*
+ * Queue the read of an attribute file of the node, the value is stored
+ * when file_batch_submit is called.
+ *
+ * @t     : the node containing the attribute file
+ * @name  : the name of the attribute file
+ * @type  : the type of the value
+ * @value : a pointer to a variable to store the content of the file
+ * @size  : the size of the variable pointed by value
+ * Returns 0 on success, -1 otherwise
+ */
+int tree_batch_value(struct tree *t, const char *name,
+		     int type, void *value, size_t size)
+{
+	return file_batch_value(&t->handles, t->dirfd, t->path,
+				name, type, value, size);
+}
+
+/*
+ * Open an attribute file of the node, the file descriptor is not part
+ * of the cache and must be closed by the caller.
+ *
+ * @t    : the node containing the attribute file
+ * @name : the name of the attribute file
+ * Returns a file descriptor on success, -1 otherwise
+ */
+int tree_open(struct tree *t, const char *name)
+{
+	char path[PATH_MAX];
+
+	if (t->dirfd >= 0)
+		return openat(t->dirfd, name, O_RDONLY | O_CLOEXEC);
+
+	snprintf(path, sizeof(path), "%s/%s", t->path, name);
+
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/*
+ * Check if an attribute file of the node exists and can be read.
+ *
+ * @t    : the node containing the attribute file
+ * @name : the name of the attribute file
+ * Returns 0 if the file can be read, -1 otherwise
+ */
+int tree_access(struct tree *t, const char *name)
+{
+	char path[PATH_MAX];
 
-			ret = tree_scan(child, filter, follow);
-		}
+	if (t->dirfd >= 0)
+		return faccessat(t->dirfd, name, R_OK, 0);
 
-	out_free_newpath:
-		free(newpath);
+	snprintf(path, sizeof(path), "%s/%s", t->path, name);
 
-	out_free_basedir:
-		free(basedir);
+	return access(path, R_OK);
+}
 
-		if (ret)
-			break;
-	}
+/*
+ * Get the range of the preorder array covering a node, its subtree and
+ * the subtrees of its next siblings, that is up to the end of the
+ * subtree of its parent.
+ *
+ * @root : the root structure of the tree, with an up to date array
+ * @t    : the node
+ * Returns the index following the range
+ */
+static inline int tree_flat_end(struct tree_root *root, struct tree *t)
+{
+	struct tree_flat *flat = root->flat;
+	int parent = flat[t->index].parent;
 
-	closedir(dir);
+	if (parent < 0)
+		return root->nrflat;
 
-	return ret;
+	return parent + flat[parent].size;
 }
 
 /*
- * This function takes the topmost directory path and populate the
- * directory tree structures.
+ * This function will go over the tree passed as parameter and
+ * will call the callback passed as parameter for each node. The nodes
+ * are taken in preorder from the array of the tree, the callback must
+ * not add or remove nodes.
  *
- * @tree : a path to the topmost directory path
- * Returns a tree structure corresponding to the root node of the
- * directory tree representation on success, NULL otherwise
+ * @tree : the topmost node where we begin to browse the tree
+ * Returns 0 on success, < 0 otherwise
  */
-struct tree *tree_load(const char *path, tree_filter_t filter, bool follow)
+int tree_for_each(struct tree *tree, tree_cb_t cb, void *data)
 {
-	struct tree *tree;
+	struct tree_root *root;
+	struct tree *t;
+	int i, end;
 
-	tree = tree_alloc(path, 0);
 	if (!tree)
-		return NULL;
+		return 0;
 
-	if (tree_scan(tree, filter, follow)) {
-		tree_free(tree);
-		return NULL;
+	root = tree_flat(tree);
+	if (!root) {
+		/* no memory for the array, follow the links */
+		for (t = tree; t; t = tree_next(t, tree->parent))
+			if (cb(t, data))
+				return -1;
+		return 0;
 	}
 
-	return tree;
+	end = tree_flat_end(root, tree);
+
+	for (i = tree->index; i < end; i++)
+		if (cb(root->flat[i].node, data))
+			return -1;
+
+	return 0;
 }
 
 /*
- * This function will go over the tree passed as parameter and
- * will call the callback passed as parameter for each node.
+ * This function will go over the tree like tree_for_each, the
+ * callback can skip the subtree of a node, the browsing goes on with
+ * the next sibling.
  *
  * @tree : the topmost node where we begin to browse the tree
+ * @cb   : a callback for each node, returning < 0 on error, > 0 to
+ *         skip the subtree of the node and 0 otherwise
+ * @data : some private data to be passed across the callbacks
  * Returns 0 on success, < 0 otherwise
  */
-int tree_for_each(struct tree *tree, tree_cb_t cb, void *data)
+int tree_for_each_skip(struct tree *tree, tree_cb_t cb, void *data)
 {
+	struct tree_root *root;
+	int i, end, ret;
+
 	if (!tree)
 		return 0;
 
-	if (cb(tree, data))
+	root = tree_flat(tree);
+	if (!root)
 		return -1;
 
-	if (tree_for_each(tree->child, cb, data))
-		return -1;
+	end = tree_flat_end(root, tree);
+
+	for (i = tree->index; i < end; ) {
+
+		ret = cb(root->flat[i].node, data);
+		if (ret < 0)
+			return -1;
+
+		i += ret ? root->flat[i].size : 1;
+	}
 
-	return tree_for_each(tree->next, cb, data);
+	return 0;
 }
 
 /*
@@ -252,106 +2209,620 @@ int tree_for_each_reverse(struct tree *tree, tree_cb_t cb, void *data)
 }
 
 
+static int tree_for_each_parent_links(struct tree *tree, tree_cb_t cb,
+				      void *data)
+{
+	if (!tree)
+		return 0;
+
+	if (tree_for_each_parent_links(tree->parent, cb, data))
+		return -1;
+
+	return cb(tree, data);
+}
+
 /*
  * The function will go over all the parent of the specified node passed
  * as parameter.
  * @tree : the child node from where we back path to the parent
  * cb : a callback for each node the function will go over
  * data : some private data to be passed across the callbacks
+ * The parents are found with the indexes of the preorder array.
  * Returns 0 on success, < 0 otherwise
  */
 int tree_for_each_parent(struct tree *tree, tree_cb_t cb, void *data)
 {
+	struct tree_root *root;
+	int chain[UCHAR_MAX + 1];
+	int i, nr = 0;
+
 	if (!tree)
 		return 0;
 
-	if (tree_for_each_parent(tree->parent, cb, data))
-		return -1;
+	root = tree_flat(tree);
+	if (!root || tree->index < 0)
+		return tree_for_each_parent_links(tree, cb, data);
 
-	return cb(tree, data);
+	for (i = tree->index; i >= 0; i = root->flat[i].parent) {
+		if (nr == sizeof(chain) / sizeof(chain[0]))
+			return tree_for_each_parent_links(tree, cb, data);
+		chain[nr++] = i;
+	}
+
+	while (nr--)
+		if (cb(root->flat[chain[nr]].node, data))
+			return -1;
+
+	return 0;
 }
 
 /*
  * The function will return the first node which match with the name as
- * parameter.
+ * parameter. The name index of the tree is built at the first call and
+ * kept up to date with the preorder array.
  * @tree : the tree where we begin to find
  * @name : the name of the node the function must look for.
  * Returns a pointer to the tree structure if found, NULL otherwise.
  */
 struct tree *tree_find(struct tree *tree, const char *name)
 {
+	struct tree_root *root;
+	struct tree_hash *slot;
 	struct tree *t;
+	int i, end;
 
 	if (!tree)
 		return NULL;
 
-	if (!strcmp(tree->name, name))
-		return tree;
+	root = tree_flat(tree);
+	if (!root) {
+		for (t = tree; t; t = tree_next(t, tree->parent))
+			if (!strcmp(t->name, name))
+				return t;
+		return NULL;
+	}
 
-	t = tree_find(tree->child, name);
-	if (t)
-		return t;
+	end = tree_flat_end(root, tree);
 
-	return tree_find(tree->next, name);
-}
+	if (!root->hashed) {
+		root->hashed = true;
+		tree_hash_build(root);
+	}
 
-struct struct_find {
-	int nr;
-	const char *name;
-	struct tree ***ptree;
-};
+	if (!root->hash) {
+		for (i = tree->index; i < end; i++)
+			if (!strcmp(root->flat[i].node->name, name))
+				return root->flat[i].node;
+		return NULL;
+	}
+
+	/* the first node with the name in the range browsed by the DFS */
+	slot = tree_hash_slot(root, name, tree_hash_name(name));
+
+	for (i = slot->head; i >= 0 && i < end; i = root->flat[i].same)
+		if (i >= tree->index)
+			return root->flat[i].node;
 
-static int tree_finds_cb(struct tree *tree, void *data)
+	return NULL;
+}
+
+/*
+ * This function will search for all the nodes where the name begin
+ * with the name passed as parameter. *Note* the function allocates
+ * the array, it is up to the caller to free this array.
+ * @tree : the topmost node of the tree where we being to search
+ * @name : the name to find in the tree
+ * @ptr  : a pointer to a pointer of pointer of tree structure :)
+ * Returns the number of elements found in the tree, < 0 if something
+ * went wrong.
+ */
+int tree_finds(struct tree *tree, const char *name, struct tree ***ptr)
 {
-	struct struct_find *sf = data;
+	struct tree_root *root;
+	struct tree **ptree;
+	size_t len = strlen(name);
+	int i, end, nr = 0, size = 0;
 
-	if (!strlen(sf->name))
+	if (!tree || !len)
 		return 0;
 
-	if (strncmp(sf->name, tree->name, strlen(sf->name)))
+	root = tree_flat(tree);
+	if (!root)
+		return -1;
+
+	end = tree_flat_end(root, tree);
+
+	for (i = tree->index; i < end; i++) {
+
+		if (strncmp(name, root->flat[i].node->name, len))
+			continue;
+
+		if (nr == size) {
+			size = size ? size * 2 : TREE_STACK_SIZE;
+			ptree = realloc(nr ? *ptr : NULL,
+					sizeof(*ptree) * size);
+			if (!ptree) {
+				if (nr)
+					free(*ptr);
+				return -1;
+			}
+			*ptr = ptree;
+		}
+
+		(*ptr)[nr++] = root->flat[i].node;
+	}
+
+	return nr;
+}
+
+static int tree_index_cmp(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * Find the nodes of a range of the preorder array where the name
+ * begins with a prefix, with the sorted name index.
+ *
+ * @root   : the root structure of the tree, with an up to date array
+ * @level  : the result to be filled
+ * @prefix : the prefix
+ * @start  : the first index of the range
+ * @end    : the index following the range
+ * Returns 0 on success, -1 otherwise
+ */
+static int tree_search_names(struct tree_root *root, struct tree_level *level,
+			     const char *prefix, int start, int end)
+{
+	struct tree_name *names;
+	int *indexes;
+	int lo, hi, mid, first, i, nr = 0;
+
+	if (!root->names && tree_names_build(root))
+		return -1;
+
+	names = root->names;
+	level->len = strlen(prefix);
+
+	/* the first name not lower than the prefix */
+	for (lo = 0, hi = root->nrflat; lo < hi; ) {
+		mid = (lo + hi) / 2;
+		if (strncmp(names[mid].name, prefix, level->len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	first = lo;
+
+	/* the first name greater than the prefix */
+	for (hi = root->nrflat; lo < hi; ) {
+		mid = (lo + hi) / 2;
+		if (strncmp(names[mid].name, prefix, level->len) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	level->nodes = malloc(sizeof(*level->nodes) * (lo - first + 1));
+	if (!level->nodes)
+		return -1;
+
+	/* most of the nodes match, browsing the range is faster than sorting */
+	if ((lo - first) * 8 > end - start) {
+		for (i = start; i < end; i++)
+			if (!strncmp(root->flat[i].node->name, prefix,
+				     level->len))
+				level->nodes[nr++] = root->flat[i].node;
+		level->nr = nr;
 		return 0;
+	}
+
+	indexes = malloc(sizeof(*indexes) * (lo - first + 1));
+	if (!indexes) {
+		free(level->nodes);
+		return -1;
+	}
+
+	for (i = first; i < lo; i++)
+		if (names[i].index >= start && names[i].index < end)
+			indexes[nr++] = names[i].index;
+
+	/* the nodes are shown in the order of the tree */
+	qsort(indexes, nr, sizeof(*indexes), tree_index_cmp);
 
-	if (sf->ptree)
-		(*(sf->ptree))[sf->nr] = tree;
+	for (i = 0; i < nr; i++)
+		level->nodes[i] = root->flat[indexes[i]].node;
 
-	sf->nr++;
+	level->nr = nr;
+
+	free(indexes);
 
 	return 0;
 }
 
 /*
- * This function will search for all the nodes where the name begin
- * with the name passed as parameter. *Note* the function allocates
- * the array, it is up to the caller to free this array.
+ * Structure describing a node found by a search
+ *
+ * score : the score of the match, the best matches are shown first
+ * index : the index of the node in the preorder array
+ */
+struct tree_score {
+	int score;
+	int index;
+};
+
+static int tree_score_cmp(const void *a, const void *b)
+{
+	const struct tree_score *sa = a, *sb = b;
+
+	if (sa->score != sb->score)
+		return sb->score - sa->score;
+
+	return sa->index - sb->index;
+}
+
+/*
+ * Look for a string in a name, the first character is looked for with
+ * memchr which compares many bytes at once.
+ *
+ * @s    : the name
+ * @len  : the length of the name
+ * @p    : the string to look for
+ * @plen : the length of the string
+ * Returns the position of the string, NULL if not found
+ */
+static const char *tree_substr(const char *s, size_t len,
+			       const char *p, size_t plen)
+{
+	const char *end = s + len;
+
+	while (end - s >= plen) {
+
+		s = memchr(s, p[0], end - s - plen + 1);
+		if (!s)
+			return NULL;
+
+		if (!memcmp(s + 1, p + 1, plen - 1))
+			return s;
+
+		s++;
+	}
+
+	return NULL;
+}
+
+/*
+ * Score a name where the characters of a pattern are found in order,
+ * not necessarily next to each other. The characters following each
+ * other or beginning a word of the name score more, and the shorter
+ * names score more than the longer ones.
+ *
+ * @name    : the name
+ * @pattern : the characters to look for
+ * Returns the score, -1 if the name does not match
+ */
+static int tree_fuzzy(const char *name, const char *pattern)
+{
+	const char *s = name, *last = NULL;
+	int score = 0;
+
+	for (; *pattern; pattern++, last = s++) {
+
+		s = strchr(s, *pattern);
+		if (!s)
+			return -1;
+
+		score++;
+
+		if (last && s == last + 1)
+			score += 4;
+
+		if (s == name || strchr("_-.", s[-1]))
+			score += 2;
+	}
+
+	/* for the same score, the names with fewer other characters first */
+	return score * (NAME_MAX + 1) - (int)strlen(name);
+}
+
+/*
+ * Check if a node matches a pattern.
+ *
+ * @root    : the root structure of the tree, with the lowercase names
+ * @index   : the index of the node in the preorder array
+ * @pattern : the pattern, in lowercase except for the prefix mode
+ * @plen    : the length of the pattern
+ * @mode    : the kind of match
+ * Returns the score of the match, -1 if the node does not match
+ */
+static int tree_match(struct tree_root *root, int index,
+		      const char *pattern, int plen, int mode)
+{
+	const char *lower = root->lower + root->offsets[index];
+	int len = root->offsets[index + 1] - root->offsets[index] - 1;
+
+	switch (mode) {
+	case TREE_FIND_SUBSTRING:
+		return tree_substr(lower, len, pattern, plen) ? 0 : -1;
+	case TREE_FIND_GLOB:
+		return fnmatch(pattern, lower, 0) ? -1 : 0;
+	case TREE_FIND_FUZZY:
+		return tree_fuzzy(lower, pattern);
+	}
+
+	return strncmp(root->flat[index].node->name, pattern, plen) ? -1 : 0;
+}
+
+/*
+ * Store the nodes found by a search in a result, in preorder or by
+ * score for the fuzzy mode.
+ *
+ * @root   : the root structure of the tree
+ * @level  : the result to be filled, the array of nodes is allocated
+ * @found  : the nodes found, in preorder
+ * @nr     : the number of nodes found
+ * @mode   : the kind of match
+ * Returns 0 on success, -1 otherwise
+ */
+static int tree_level_fill(struct tree_root *root, struct tree_level *level,
+			   struct tree_score *found, int nr, int mode)
+{
+	int i;
+
+	level->nodes = malloc(sizeof(*level->nodes) * (nr + 1));
+	if (!level->nodes)
+		return -1;
+
+	if (mode == TREE_FIND_FUZZY)
+		qsort(found, nr, sizeof(*found), tree_score_cmp);
+
+	for (i = 0; i < nr; i++)
+		level->nodes[i] = root->flat[found[i].index].node;
+
+	level->nr = nr;
+
+	return 0;
+}
+
+/*
+ * Find the nodes of a range of the preorder array matching a pattern,
+ * in the table of the lowercase names.
+ *
+ * @root    : the root structure of the tree, with an up to date array
+ * @level   : the result to be filled
+ * @pattern : the pattern in lowercase
+ * @mode    : the kind of match, but the prefix
+ * @start   : the first index of the range
+ * @end     : the index following the range
+ * Returns 0 on success, -1 otherwise
+ */
+static int tree_search_lower(struct tree_root *root, struct tree_level *level,
+			     const char *pattern, int mode, int start, int end)
+{
+	struct tree_score *found;
+	const char *s, *blob, *bend;
+	int i, nr = 0, score, plen = strlen(pattern), ret;
+
+	if (!root->lower && tree_lower_build(root))
+		return -1;
+
+	found = malloc(sizeof(*found) * (end - start + 1));
+	if (!found)
+		return -1;
+
+	level->len = plen;
+
+	if (mode != TREE_FIND_SUBSTRING) {
+
+		for (i = start; i < end; i++) {
+			score = tree_match(root, i, pattern, plen, mode);
+			if (score < 0)
+				continue;
+			found[nr].score = score;
+			found[nr++].index = i;
+		}
+
+		goto out;
+	}
+
+	/* one scan of all the names, a match can not cross a name end */
+	blob = root->lower;
+	bend = blob + root->offsets[end];
+	i = start;
+
+	for (s = blob + root->offsets[start];
+	     (s = tree_substr(s, bend - s, pattern, plen)); ) {
+
+		while (root->offsets[i + 1] <= s - blob)
+			i++;
+
+		found[nr].score = 0;
+		found[nr++].index = i;
+
+		/* the other matches in this name are not needed */
+		s = blob + root->offsets[i + 1];
+	}
+out:
+	ret = tree_level_fill(root, level, found, nr, mode);
+
+	free(found);
+
+	return ret;
+}
+
+/*
+ * Narrow the result of a search with a longer pattern.
+ *
+ * @root    : the root structure of the tree
+ * @level   : the result to be filled, it can be the previous result
+ * @prev    : the result for the beginning of the pattern
+ * @pattern : the pattern, in lowercase except for the prefix mode
+ * @mode    : the kind of match, but the glob
+ * Returns 0 on success, -1 otherwise
+ */
+static int tree_search_narrow(struct tree_root *root, struct tree_level *level,
+			      struct tree_level *prev, const char *pattern,
+			      int mode)
+{
+	struct tree_score *found;
+	struct tree **nodes = prev->nodes;
+	int i, nr = 0, score, plen = prev->len, len = strlen(pattern), ret;
+
+	if (mode == TREE_FIND_PREFIX) {
+
+		/* the last level is narrowed in place when the stack is full */
+		if (level != prev) {
+			level->nodes = malloc(sizeof(*level->nodes) *
+					      (prev->nr + 1));
+			if (!level->nodes)
+				return -1;
+		}
+
+		/* the first characters are known to match */
+		for (i = 0; i < prev->nr; i++)
+			if (!strncmp(nodes[i]->name + plen, pattern + plen,
+				     len - plen))
+				level->nodes[nr++] = nodes[i];
+
+		level->len = len;
+		level->nr = nr;
+
+		return 0;
+	}
+
+	found = malloc(sizeof(*found) * (prev->nr + 1));
+	if (!found)
+		return -1;
+
+	/* a name containing the pattern contains its beginning */
+	for (i = 0; i < prev->nr; i++) {
+		score = tree_match(root, nodes[i]->index, pattern, len, mode);
+		if (score < 0)
+			continue;
+		found[nr].score = score;
+		found[nr++].index = nodes[i]->index;
+	}
+
+	/* the fuzzy results are sorted again with the new scores */
+	ret = tree_level_fill(root, level, found, nr, mode);
+	if (!ret)
+		level->len = len;
+
+	if (level == prev) {
+		if (ret)
+			level->nodes = nodes;
+		else
+			free(nodes);
+	}
+
+	free(found);
+
+	return ret;
+}
+
+/*
+ * This function will search for all the nodes where the name matches
+ * the name passed as parameter, it is meant to be called again as the
+ * name is typed. The result of a name is computed from the result of
+ * the name without its last characters, but for the glob patterns, and
+ * the previous results are kept to be given back when characters are
+ * removed. *Note* the array belongs to the tree, it is valid until the
+ * next call or until the tree changes.
+ *
  * @tree : the topmost node of the tree where we being to search
  * @name : the name to find in the tree
- * @ptr  : a pointer to a pointer of pointer of tree structure :)
+ * @mode : TREE_FIND_PREFIX for the names beginning with the name,
+ *         TREE_FIND_SUBSTRING for the names containing it,
+ *         TREE_FIND_GLOB for the names matching it as a shell pattern
+ *         and TREE_FIND_FUZZY for the names containing its characters
+ *         in the same order, the best matches first. But for the
+ *         prefix, the case is ignored
+ * @ptr  : a pointer to a pointer of pointer of tree structure
  * Returns the number of elements found in the tree, < 0 if something
  * went wrong.
  */
-int tree_finds(struct tree *tree, const char *name, struct tree ***ptr)
+int tree_search(struct tree *tree, const char *name, int mode,
+		struct tree ***ptr)
 {
-	struct struct_find sf = { .nr = 0, .ptree = NULL, .name = name };
-	int nmatch;
+	struct tree_root *root;
+	struct tree_search *search;
+	struct tree_level *level, *prev;
+	char pattern[NAME_MAX + 1];
+	int len = strlen(name), common, i, ret;
+
+	*ptr = NULL;
+
+	if (!tree)
+		return 0;
 
-	/* first pass : count # of matching nodes */
-	tree_for_each(tree, tree_finds_cb, &sf);
+	root = tree_flat(tree);
+	if (!root)
+		return -1;
+
+	search = &root->search;
 
-	/* no match */
-	if (!sf.nr)
+	if (search->tree != tree || search->mode != mode || !len ||
+	    len > NAME_MAX)
+		tree_search_reset(search);
+
+	/* a name can not be longer than NAME_MAX */
+	if (!len || len > NAME_MAX)
 		return 0;
 
-	*ptr = malloc(sizeof(struct tree *) * sf.nr);
-	if (!*ptr)
+	search->tree = tree;
+	search->mode = mode;
+
+	for (i = 0; i <= len; i++)
+		pattern[i] = mode == TREE_FIND_PREFIX ? name[i] :
+			tolower((unsigned char)name[i]);
+
+	/* drop the results of the characters which were removed */
+	for (common = 0; common < len && search->prefix[common] == name[common];
+	     common++)
+		;
+
+	while (search->nrlevels &&
+	       search->levels[search->nrlevels - 1].len > common)
+		free(search->levels[--search->nrlevels].nodes);
+
+	strcpy(search->prefix, name);
+
+	prev = search->nrlevels ? &search->levels[search->nrlevels - 1] : NULL;
+
+	if (prev && prev->len == len) {
+		*ptr = prev->nodes;
+		return prev->nr;
+	}
+
+	level = search->nrlevels < TREE_SEARCH_LEVELS ?
+		&search->levels[search->nrlevels] : prev;
+
+	/* a longer glob pattern can match names the shorter one did not */
+	if (prev && mode != TREE_FIND_GLOB) {
+		ret = tree_search_narrow(root, level, prev, pattern, mode);
+	} else {
+		if (level == prev) {
+			free(prev->nodes);
+			search->nrlevels--;
+		}
+
+		if (mode == TREE_FIND_PREFIX)
+			ret = tree_search_names(root, level, pattern,
+						tree->index,
+						tree_flat_end(root, tree));
+		else
+			ret = tree_search_lower(root, level, pattern, mode,
+						tree->index,
+						tree_flat_end(root, tree));
+	}
+
+	if (ret)
 		return -1;
 
-	/* store the result as it will be overwritten by the next call */
-	nmatch = sf.nr;
-	sf.nr = 0;
-	sf.ptree = ptr;
+	if (level != prev || mode == TREE_FIND_GLOB)
+		search->nrlevels++;
 
-	/* second pass : fill with the matching nodes */
-	tree_for_each(tree, tree_finds_cb, &sf);
+	*ptr = level->nodes;
 
-	return nmatch;
+	return level->nr;
 }
@@ -13,6 +13,8 @@
  *
  *******************************************************************************/
 
+#include <dirent.h>
+
 /*
  * Structure describing a node of the clock tree
  *
@@ -23,6 +25,9 @@
  * depth  : the recursive level of the node
  * path   : absolute pathname of the directory
  * name   : basename of the directory
+ * handles : the attribute files kept opened for this node
+ * dirfd  : an O_PATH file descriptor on the directory, -1 if none
+ * index  : the position of the node in the preorder array of the tree
  */
 struct tree {
 	struct tree *tail;
@@ -33,7 +38,10 @@ struct tree {
 	char *path;
 	char *name;
 	void *private;
+	struct cached_file *handles;
+	int   dirfd;
 	int   nrchild;
+	int   index;
 	unsigned char depth;
 };
 
@@ -41,14 +49,59 @@ typedef int (*tree_cb_t)(struct tree *t, void *data);
 
 typedef int (*tree_filter_t)(const char *name);
 
+typedef int (*tree_node_t)(int index, const char **name, void *data);
+
+/* Kinds of match of tree_search */
+enum { TREE_FIND_PREFIX, TREE_FIND_SUBSTRING, TREE_FIND_GLOB,
+       TREE_FIND_FUZZY, TREE_FIND_MODES };
+
 extern struct tree *tree_load(const char *path, tree_filter_t filter, bool follow);
 
+extern struct tree *tree_build(const char *path, int nr, tree_node_t node,
+			       void *data);
+
+extern void tree_destroy(struct tree *tree);
+
+extern void *tree_alloc_private(struct tree *t, size_t size);
+
+extern void tree_free_private(struct tree *t, void *ptr, size_t size);
+
+extern void tree_set_workers(int nr);
+
+extern struct tree *tree_add(struct tree *parent, const char *name,
+			     tree_filter_t filter, bool follow);
+
+extern int tree_del(struct tree *parent, const char *name,
+		    tree_cb_t release, void *data);
+
+extern int tree_move(struct tree *t, struct tree *parent);
+
+extern int tree_reload(struct tree *tree, tree_filter_t filter, bool follow,
+		       tree_cb_t added, tree_cb_t removed, void *data);
+
+extern DIR *tree_opendir(struct tree *t);
+
+extern int tree_read_value(struct tree *t, const char *name,
+			   int type, void *value, size_t size);
+
+extern int tree_batch_value(struct tree *t, const char *name,
+			    int type, void *value, size_t size);
+
+extern int tree_open(struct tree *t, const char *name);
+
+extern int tree_access(struct tree *t, const char *name);
+
 extern struct tree *tree_find(struct tree *tree, const char *name);
 
 extern int tree_for_each(struct tree *tree, tree_cb_t cb, void *data);
 
+extern int tree_for_each_skip(struct tree *tree, tree_cb_t cb, void *data);
+
 extern int tree_for_each_reverse(struct tree *tree, tree_cb_t cb, void *data);
 
 extern int tree_for_each_parent(struct tree *tree, tree_cb_t cb, void *data);
 
 extern int tree_finds(struct tree *tree, const char *name, struct tree ***ptr);
+
+extern int tree_search(struct tree *tree, const char *name, int mode,
+		       struct tree ***ptr);
@@ -0,0 +1,151 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "mainloop.h"
+#include "uevent.h"
+
+/* Maximum number of subsystems listening to the hotplug events */
+#define UEVENT_HANDLERS 8
+
+/* Size of the buffer receiving an event, the kernel limit is 2048 */
+#define UEVENT_BUFFER_SIZE 4096
+
+struct uevent_handler {
+	const char *subsystem;
+	uevent_callback_t cb;
+	void *data;
+};
+
+static struct uevent_handler handlers[UEVENT_HANDLERS];
+static int nrhandlers;
+
+/*
+ * Register a function to be called when a device of a subsystem is
+ * added or removed.
+ *
+ * @subsystem : the name of the subsystem, "regulator", "hwmon", ...
+ * @cb        : the function to call
+ * @data      : a pointer passed to the function
+ * Returns 0 on success, -1 otherwise
+ */
+int uevent_register(const char *subsystem, uevent_callback_t cb, void *data)
+{
+	if (nrhandlers == UEVENT_HANDLERS)
+		return -1;
+
+	handlers[nrhandlers].subsystem = subsystem;
+	handlers[nrhandlers].cb = cb;
+	handlers[nrhandlers].data = data;
+	nrhandlers++;
+
+	return 0;
+}
+
+/*
+ * Read an event sent by the kernel, the message is made of a header
+ * "<action>@<devpath>" followed by "KEY=value" strings, all of them
+ * terminated by a nul character.
+ */
+static int uevent_cb(int fd, void *data)
+{
+	char buf[UEVENT_BUFFER_SIZE];
+	struct sockaddr_nl addr;
+	socklen_t addrlen = sizeof(addr);
+	const char *action = NULL, *devpath = NULL, *subsystem = NULL;
+	const char *name;
+	ssize_t len;
+	char *s;
+	int i;
+
+	len = recvfrom(fd, buf, sizeof(buf) - 1, 0,
+		       (struct sockaddr *)&addr, &addrlen);
+	if (len <= 0)
+		return 0;
+
+	/* only trust the messages coming from the kernel */
+	if (addr.nl_pid)
+		return 0;
+
+	buf[len] = '\0';
+
+	if (!strchr(buf, '@'))
+		return 0;
+
+	for (s = buf + strlen(buf) + 1; s < buf + len; s += strlen(s) + 1) {
+
+		if (!strncmp(s, "ACTION=", 7))
+			action = s + 7;
+		else if (!strncmp(s, "DEVPATH=", 8))
+			devpath = s + 8;
+		else if (!strncmp(s, "SUBSYSTEM=", 10))
+			subsystem = s + 10;
+	}
+
+	if (!action || !devpath || !subsystem)
+		return 0;
+
+	name = strrchr(devpath, '/');
+	if (!name)
+		return 0;
+	name++;
+
+	for (i = 0; i < nrhandlers; i++) {
+
+		if (strcmp(handlers[i].subsystem, subsystem))
+			continue;
+
+		if (!strcmp(action, "add"))
+			handlers[i].cb(UEVENT_ADD, name, handlers[i].data);
+		else if (!strcmp(action, "remove"))
+			handlers[i].cb(UEVENT_REMOVE, name, handlers[i].data);
+	}
+
+	return 0;
+}
+
+/*
+ * Listen to the hotplug events sent by the kernel, the subsystems
+ * registered with uevent_register are then notified from the mainloop.
+ *
+ * Returns 0 on success, -1 otherwise
+ */
+int uevent_init(void)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,
+	};
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -1;
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)))
+		goto out_close;
+
+	if (mainloop_add(fd, uevent_cb, NULL))
+		goto out_close;
+
+	return 0;
+
+out_close:
+	close(fd);
+	return -1;
+}
@@ -0,0 +1,26 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+enum { UEVENT_ADD, UEVENT_REMOVE };
+
+/*
+ * Function called when a device of a subsystem is added or removed
+ *
+ * action : UEVENT_ADD or UEVENT_REMOVE
+ * name   : the name of the device, as found in /sys/class/<subsystem>
+ * data   : the pointer given to uevent_register
+ */
+typedef int (*uevent_callback_t)(int action, const char *name, void *data);
+
+extern int uevent_register(const char *subsystem, uevent_callback_t cb,
+			   void *data);
+extern int uevent_init(void);
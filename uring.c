@@ -0,0 +1,288 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+
+/*
+ * Structure describing the io_uring instance shared with the kernel
+ *
+ * fd      : the io_uring file descriptor
+ * sq_*    : pointers to the submission ring fields mapped from the kernel
+ * cq_*    : pointers to the completion ring fields mapped from the kernel
+ * sqes    : the submission queue entries array
+ * pending : number of entries prepared but not yet submitted
+ * *_map   : the mappings of the rings and of the entries, NULL if none
+ * *_size  : the sizes of the mappings
+ */
+static struct uring {
+	int fd;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_entries;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	struct io_uring_sqe *sqes;
+	unsigned int pending;
+	void *sq_map;
+	void *cq_map;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqes_size;
+} ring = { .fd = -1 };
+
+/*
+ * Setup an io_uring instance and map the rings in our address space.
+ *
+ * @entries : the number of entries of the submission queue
+ * Returns 0 on success, -1 if io_uring is not available
+ */
+int uring_init(unsigned int entries)
+{
+	struct io_uring_params p;
+	void *sq_ptr, *cq_ptr, *sqes;
+
+	if (ring.fd >= 0)
+		return 0;
+
+	memset(&p, 0, sizeof(p));
+
+	ring.fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring.fd < 0)
+		return -1;
+
+	/* IORING_OP_READ was introduced with the feature below */
+	if (!(p.features & IORING_FEAT_RW_CUR_POS))
+		goto out_exit;
+
+	ring.sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ring.cq_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring.cq_size > ring.sq_size)
+			ring.sq_size = ring.cq_size;
+		ring.cq_size = ring.sq_size;
+	}
+
+	sq_ptr = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+	if (sq_ptr == MAP_FAILED)
+		goto out_exit;
+
+	ring.sq_map = sq_ptr;
+
+	cq_ptr = sq_ptr;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		cq_ptr = mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_POPULATE, ring.fd,
+			      IORING_OFF_CQ_RING);
+		if (cq_ptr == MAP_FAILED)
+			goto out_exit;
+
+		ring.cq_map = cq_ptr;
+	}
+
+	ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		goto out_exit;
+
+	ring.sqes = sqes;
+
+	ring.sq_head = sq_ptr + p.sq_off.head;
+	ring.sq_tail = sq_ptr + p.sq_off.tail;
+	ring.sq_mask = sq_ptr + p.sq_off.ring_mask;
+	ring.sq_entries = sq_ptr + p.sq_off.ring_entries;
+	ring.sq_array = sq_ptr + p.sq_off.array;
+
+	ring.cq_head = cq_ptr + p.cq_off.head;
+	ring.cq_tail = cq_ptr + p.cq_off.tail;
+	ring.cq_mask = cq_ptr + p.cq_off.ring_mask;
+	ring.cqes = cq_ptr + p.cq_off.cqes;
+
+	return 0;
+
+out_exit:
+	uring_exit();
+	return -1;
+}
+
+/*
+ * Release the io_uring instance, the requests not completed yet are
+ * cancelled by the kernel and their completions are never reaped.
+ */
+void uring_exit(void)
+{
+	if (ring.fd < 0)
+		return;
+
+	if (ring.sqes)
+		munmap(ring.sqes, ring.sqes_size);
+
+	if (ring.cq_map)
+		munmap(ring.cq_map, ring.cq_size);
+
+	if (ring.sq_map)
+		munmap(ring.sq_map, ring.sq_size);
+
+	close(ring.fd);
+
+	memset(&ring, 0, sizeof(ring));
+	ring.fd = -1;
+}
+
+/*
+ * Returns the number of entries which can be prepared before submitting
+ * the queue, 0 if io_uring is not available.
+ */
+unsigned int uring_size(void)
+{
+	if (ring.fd < 0)
+		return 0;
+
+	return *ring.sq_entries;
+}
+
+/*
+ * Prepare a read request, it will be sent to the kernel with the
+ * next uring_submit call.
+ *
+ * @fd     : the file descriptor to read from
+ * @buf    : the buffer to store the content
+ * @len    : the size of the buffer
+ * @off    : the offset in the file to read from
+ * @cookie : a cookie passed back with the completion
+ * Returns 0 on success, -1 if the submission queue is full
+ */
+int uring_prep_read(int fd, void *buf, unsigned int len, off_t off,
+		    unsigned long long cookie)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail, index;
+
+	if (ring.pending >= *ring.sq_entries)
+		return -1;
+
+	tail = *ring.sq_tail + ring.pending;
+	index = tail & *ring.sq_mask;
+
+	sqe = &ring.sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	sqe->off = off;
+	sqe->user_data = cookie;
+
+	ring.sq_array[index] = index;
+	ring.pending++;
+
+	return 0;
+}
+
+/*
+ * Submit the prepared requests and wait for all of them to complete,
+ * then call the callback for each completion.
+ *
+ * @cb   : the callback called with the cookie and the result of a request
+ * @data : some private data passed to the callback
+ * Returns 0 on success, -1 otherwise, some requests may then not have
+ * completed and the instance has to be released with uring_exit
+ */
+int uring_submit(uring_cb_t cb, void *data)
+{
+	unsigned int head, tail, nr = ring.pending, submit = nr;
+	struct io_uring_cqe *cqe;
+	int ret;
+
+	if (!nr)
+		return 0;
+
+	__atomic_store_n(ring.sq_tail, *ring.sq_tail + nr, __ATOMIC_RELEASE);
+	ring.pending = 0;
+
+	while (nr) {
+
+		ret = syscall(__NR_io_uring_enter, ring.fd, submit, nr,
+			      IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0) {
+			if (errno != EINTR)
+				return -1;
+		} else {
+			submit -= ret < submit ? ret : submit;
+		}
+
+		head = *ring.cq_head;
+		tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+		for (; head != tail && nr; head++, nr--) {
+			cqe = &ring.cqes[head & *ring.cq_mask];
+			cb(cqe->user_data, cqe->res, data);
+		}
+
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+#else
+
+int uring_init(unsigned int entries)
+{
+	return -1;
+}
+
+void uring_exit(void)
+{
+}
+
+unsigned int uring_size(void)
+{
+	return 0;
+}
+
+int uring_prep_read(int fd, void *buf, unsigned int len, off_t off,
+		    unsigned long long cookie)
+{
+	return -1;
+}
+
+int uring_submit(uring_cb_t cb, void *data)
+{
+	return -1;
+}
+
+#endif
@@ -0,0 +1,22 @@
+/*******************************************************************************
+ * Copyright (C) 2010, Linaro Limited.
+ *
+ * This file is part of PowerDebug.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the Eclipse Public License v1.0
+ * which accompanies this distribution, and is available at
+ * http://www.eclipse.org/legal/epl-v10.html
+ *
+ *******************************************************************************/
+
+#include <sys/types.h>
+
+typedef void (*uring_cb_t)(unsigned long long cookie, int res, void *data);
+
+extern int uring_init(unsigned int entries);
+extern void uring_exit(void);
+extern unsigned int uring_size(void);
+extern int uring_prep_read(int fd, void *buf, unsigned int len, off_t off,
+			   unsigned long long cookie);
+extern int uring_submit(uring_cb_t cb, void *data);
@@ -18,43 +18,348 @@
 #include <stdio.h>
 #undef _GNU_SOURCE
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "utils.h"
+#include "uring.h"
+
+/*
+ * Number of file descriptors left for the rest of the program: ncurses,
+ * epoll, uevent, io_uring, the snapshots and the gpio value files.
+ */
+#define FILE_FD_RESERVE 64
+
+/* Number of file descriptors used by ftrace for each cpu */
+#define FILE_FD_PERCPU 3
+
+/* Minimum number of file descriptors of the cache */
+#define FILE_FD_MIN 16
+
+/* Size of the buffer used to read an attribute */
+#define FILE_VALUE_MAX 512
+
+/* Number of reads sent to the kernel at once */
+#define FILE_BATCH 256
+
+/*
+ * Least recently used list of the handles having an opened file
+ * descriptor, the most recently used is at the head of the list.
+ */
+static struct cached_file *lru_head;
+static struct cached_file *lru_tail;
+static int lru_nropen;
+static int lru_maxopen;
+
+/* Number of directory file descriptors hold by the tree nodes */
+static int dir_nropen;
+
+/*
+ * Serialize the evictions done by the threads browsing a tree, the
+ * main thread is one of them and does not read attributes meanwhile.
+ */
+static pthread_mutex_t lru_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Directory prepended to the sysfs and debugfs paths, empty for "/" */
+static char file_root[PATH_MAX];
+
+/*
+ * Structure describing a read queued with file_batch_value
+ *
+ * fh     : the handle of the file to be read
+ * dirfd  : a file descriptor on the directory containing the file or -1
+ * path   : directory path containing the file
+ * type   : the type of the value
+ * value  : a pointer to a variable to store the value
+ * size   : the size of the variable pointed by value
+ * done   : the read is completed or failed, it is not to be done again
+ */
+struct file_batch {
+	struct cached_file *fh;
+	int dirfd;
+	int type;
+	const char *path;
+	void *value;
+	size_t size;
+	bool done;
+};
+
+static struct file_batch *batch;
+static int batch_nr;
+static int batch_size;
+static bool batch_uring = true;
+static char batch_buffers[FILE_BATCH][FILE_VALUE_MAX];
+
+/*
+ * Skip the blank characters in front of a value, as the scanf
+ * conversions do.
+ */
+static inline const char *parse_skip(const char *s)
+{
+	while (*s == ' ' || *s == '\t' || *s == '\n')
+		s++;
+
+	return s;
+}
+
+/*
+ * Parse an unsigned decimal integer.
+ *
+ * @s     : the string to be parsed
+ * @value : a pointer to store the value
+ * Returns 0 on success, -1 if there is no digit
+ */
+int parse_u64(const char *s, uint64_t *value)
+{
+	uint64_t v = 0;
+
+	s = parse_skip(s);
+
+	if (*s < '0' || *s > '9')
+		return -1;
+
+	while (*s >= '0' && *s <= '9')
+		v = v * 10 + (*s++ - '0');
+
+	*value = v;
+
+	return 0;
+}
+
+/*
+ * Parse a signed decimal integer.
+ *
+ * @s     : the string to be parsed
+ * @value : a pointer to store the value
+ * Returns 0 on success, -1 if there is no digit
+ */
+int parse_int(const char *s, int *value)
+{
+	uint64_t v;
+	bool neg;
+
+	s = parse_skip(s);
+
+	neg = *s == '-';
+	if (neg || *s == '+')
+		s++;
+
+	if (parse_u64(s, &v))
+		return -1;
+
+	*value = neg ? -(int)v : (int)v;
+
+	return 0;
+}
+
+/*
+ * Parse an hexadecimal integer with or without the 0x prefix.
+ *
+ * @s     : the string to be parsed
+ * @value : a pointer to store the value
+ * Returns 0 on success, -1 if there is no digit
+ */
+int parse_hex(const char *s, unsigned int *value)
+{
+	unsigned int v = 0;
+	int digit, nrdigits = 0;
+
+	s = parse_skip(s);
+
+	if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+		s += 2;
+
+	for (;; s++, nrdigits++) {
+
+		if (*s >= '0' && *s <= '9')
+			digit = *s - '0';
+		else if (*s >= 'a' && *s <= 'f')
+			digit = *s - 'a' + 10;
+		else if (*s >= 'A' && *s <= 'F')
+			digit = *s - 'A' + 10;
+		else
+			break;
+
+		v = (v << 4) | digit;
+	}
+
+	if (!nrdigits)
+		return -1;
+
+	*value = v;
+
+	return 0;
+}
+
+/*
+ * Copy the first word of a string, the copy is truncated to the size
+ * of the destination buffer.
+ *
+ * @s     : the string to be parsed
+ * @value : the destination buffer
+ * @size  : the size of the destination buffer
+ * Returns 0 on success, -1 if there is no word
+ */
+int parse_string(const char *s, char *value, size_t size)
+{
+	size_t len = 0;
+
+	s = parse_skip(s);
+
+	if (!*s || !size)
+		return -1;
+
+	while (s[len] && s[len] != ' ' && s[len] != '\t' && s[len] != '\n' &&
+	       len < size - 1)
+		len++;
+
+	memcpy(value, s, len);
+	value[len] = '\0';
+
+	return 0;
+}
+
+/*
+ * Parse a value with the parser corresponding to its type.
+ *
+ * @s     : the string to be parsed
+ * @type  : the type of the value
+ * @value : a pointer to store the value
+ * @size  : the size of the variable pointed by value
+ * Returns 0 on success, -1 otherwise
+ */
+int parse_value(const char *s, int type, void *value, size_t size)
+{
+	switch (type) {
+	case VALUE_INT:
+		return parse_int(s, value);
+	case VALUE_HEX:
+		return parse_hex(s, value);
+	case VALUE_U64:
+		return parse_u64(s, value);
+	case VALUE_STRING:
+		return parse_string(s, value, size);
+	}
+
+	return -1;
+}
 
 /*
  * This functions is a helper to read a specific file content and store
- * the content inside a variable pointer passed as parameter, the format
+ * the content inside a variable pointer passed as parameter, the type
  * parameter gives the variable type to be read from the file.
  *
- * @path : directory path containing the file
- * @name : name of the file to be read
- * @format : the format of the format
+ * @path  : directory path containing the file
+ * @name  : name of the file to be read
+ * @type  : the type of the value
  * @value : a pointer to a variable to store the content of the file
+ * @size  : the size of the variable pointed by value
  * Returns 0 on success, -1 otherwise
  */
 int file_read_value(const char *path, const char *name,
-                    const char *format, void *value)
+		    int type, void *value, size_t size)
 {
-        FILE *file;
-        char *rpath;
-        int ret;
+	char rpath[PATH_MAX];
+	char buffer[FILE_VALUE_MAX];
+	ssize_t len;
+	int fd;
 
-        ret = asprintf(&rpath, "%s/%s", path, name);
-        if (ret < 0)
-                return ret;
+	if (snprintf(rpath, sizeof(rpath), "%s/%s", path,
+		     name) >= sizeof(rpath))
+		return -1;
 
-        file = fopen(rpath, "r");
-        if (!file) {
-                ret = -1;
-                goto out_free;
-        }
+	fd = open(rpath, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
 
-        ret = fscanf(file, format, value) == EOF ? -1 : 0;
+	len = read(fd, buffer, sizeof(buffer) - 1);
 
-        fclose(file);
-out_free:
-        free(rpath);
-        return ret;
+	close(fd);
+
+	if (len < 0)
+		return -1;
+
+	buffer[len] = '\0';
+
+	return parse_value(buffer, type, value, size);
 }
 
+/*
+ * Set the directory where the sysfs and debugfs trees are looked for,
+ * so a copy of these trees can be browsed instead of the running
+ * system.
+ *
+ * @root : the directory, NULL or "/" for the running system
+ * Returns 0 on success, -1 otherwise
+ */
+int file_set_root(const char *root)
+{
+	size_t len;
+
+	if (!root)
+		root = "";
+
+	len = strlen(root);
+	if (len >= sizeof(file_root))
+		return -1;
+
+	/* the paths appended already begin with a '/' */
+	while (len && root[len - 1] == '/')
+		len--;
+
+	memcpy(file_root, root, len);
+	file_root[len] = '\0';
+
+	return 0;
+}
+
+/*
+ * Build the path of a sysfs or debugfs directory in the root set with
+ * file_set_root.
+ *
+ * @buf  : the buffer to store the path
+ * @size : the size of the buffer
+ * @path : the absolute path of the directory on the running system
+ * Returns 0 on success, -1 if the path does not fit in the buffer
+ */
+int file_root_path(char *buf, size_t size, const char *path)
+{
+	if (snprintf(buf, size, "%s%s", file_root, path) >= size)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Read and parse the value of an attribute file already opened, the
+ * file is read from its beginning.
+ *
+ * @fd    : the file descriptor of the attribute file
+ * @type  : the type of the value
+ * @value : a pointer to a variable to store the value
+ * @size  : the size of the variable pointed by value
+ * Returns 0 on success, -1 otherwise
+ */
+int file_pread_value(int fd, int type, void *value, size_t size)
+{
+	char buffer[FILE_VALUE_MAX];
+	ssize_t len;
+
+	len = pread(fd, buffer, sizeof(buffer) - 1, 0);
+	if (len < 0)
+		return -1;
+
+	buffer[len] = '\0';
+
+	return parse_value(buffer, type, value, size);
+}
 
 /*
  * This functions is a helper to write a specific file content and store
@@ -92,3 +397,459 @@ out_free:
         free(rpath);
         return ret;
 }
+
+/*
+ * Compute the maximum number of attribute file descriptors we can keep
+ * opened at the same time, that depends on the RLIMIT_NOFILE limit. The
+ * descriptors used elsewhere are not all known when this is computed,
+ * so besides the reserve, a quarter of the limit is always left.
+ *
+ * Returns the maximum number of file descriptors for the cache
+ */
+static int cached_file_maxopen(void)
+{
+	struct rlimit rlim;
+	long limit = 1024, reserve, nrcpus;
+
+	if (lru_maxopen)
+		return lru_maxopen;
+
+	if (!getrlimit(RLIMIT_NOFILE, &rlim) && rlim.rlim_cur != RLIM_INFINITY)
+		limit = rlim.rlim_cur < INT_MAX ? rlim.rlim_cur : INT_MAX;
+
+	nrcpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (nrcpus < 1)
+		nrcpus = 1;
+
+	reserve = FILE_FD_RESERVE + FILE_FD_PERCPU * nrcpus;
+	if (reserve < limit / 4)
+		reserve = limit / 4;
+
+	lru_maxopen = limit - reserve;
+	if (lru_maxopen < FILE_FD_MIN)
+		lru_maxopen = FILE_FD_MIN;
+
+	return lru_maxopen;
+}
+
+static void cached_file_lru_del(struct cached_file *fh)
+{
+	if (fh->lru_prev)
+		fh->lru_prev->lru_next = fh->lru_next;
+	else
+		lru_head = fh->lru_next;
+
+	if (fh->lru_next)
+		fh->lru_next->lru_prev = fh->lru_prev;
+	else
+		lru_tail = fh->lru_prev;
+
+	fh->lru_prev = fh->lru_next = NULL;
+}
+
+static void cached_file_lru_add(struct cached_file *fh)
+{
+	fh->lru_prev = NULL;
+	fh->lru_next = lru_head;
+
+	if (lru_head)
+		lru_head->lru_prev = fh;
+	else
+		lru_tail = fh;
+
+	lru_head = fh;
+}
+
+/*
+ * Close the file descriptor of a handle, the handle stays in the node
+ * list and will be opened again at the next read.
+ *
+ * @fh : the file handle to be closed
+ */
+static void cached_file_close(struct cached_file *fh)
+{
+	if (fh->fd < 0)
+		return;
+
+	cached_file_lru_del(fh);
+	close(fh->fd);
+	fh->fd = -1;
+	lru_nropen--;
+}
+
+/*
+ * Open the attribute file of a handle, if we reached the limit of
+ * opened file descriptors, the least recently used one is closed.
+ *
+ * @fh    : the file handle to be opened
+ * @dirfd : a file descriptor on the directory containing the file or -1
+ * @path  : directory path containing the file, used when dirfd is -1
+ * Returns 0 on success, -1 otherwise
+ */
+static int cached_file_open(struct cached_file *fh, int dirfd,
+			    const char *path)
+{
+	char rpath[PATH_MAX];
+
+	while (lru_tail && lru_nropen >= cached_file_maxopen() - dir_nropen)
+		cached_file_close(lru_tail);
+
+	if (dirfd >= 0) {
+		fh->fd = openat(dirfd, fh->name, O_RDONLY | O_CLOEXEC);
+	} else {
+		if (snprintf(rpath, sizeof(rpath), "%s/%s", path,
+			     fh->name) >= sizeof(rpath))
+			return -1;
+
+		fh->fd = open(rpath, O_RDONLY | O_CLOEXEC);
+	}
+
+	if (fh->fd < 0)
+		return -1;
+
+	cached_file_lru_add(fh);
+	lru_nropen++;
+
+	return 0;
+}
+
+/*
+ * Look for the handle of an attribute in the list of the handles of a
+ * node, a new handle is added to the list if it is not found.
+ *
+ * @handles : the list of the handles of the node
+ * @name    : name of the attribute file
+ * Returns a file handle on success, NULL otherwise
+ */
+static struct cached_file *cached_file_get(struct cached_file **handles,
+					   const char *name)
+{
+	struct cached_file *fh;
+
+	for (fh = *handles; fh; fh = fh->next)
+		if (!strcmp(fh->name, name))
+			return fh;
+
+	fh = malloc(sizeof(*fh) + strlen(name) + 1);
+	if (!fh)
+		return NULL;
+
+	strcpy(fh->name, name);
+	fh->fd = -1;
+	fh->lru_prev = fh->lru_next = NULL;
+	fh->next = *handles;
+	*handles = fh;
+
+	return fh;
+}
+
+/*
+ * Make sure the file of a handle is opened and move it at the head of
+ * the least recently used list.
+ *
+ * @fh    : the file handle to be used
+ * @dirfd : a file descriptor on the directory containing the file or -1
+ * @path  : directory path containing the file
+ * Returns 0 on success, -1 otherwise
+ */
+static int cached_file_use(struct cached_file *fh, int dirfd, const char *path)
+{
+	if (fh->fd < 0)
+		return cached_file_open(fh, dirfd, path);
+
+	if (fh != lru_head) {
+		cached_file_lru_del(fh);
+		cached_file_lru_add(fh);
+	}
+
+	return 0;
+}
+
+/*
+ * Read the opened file of a handle from its beginning and parse it.
+ *
+ * @fh    : the file handle to be read
+ * @type  : the type of the value
+ * @value : a pointer to a variable to store the value
+ * @size  : the size of the variable pointed by value
+ * Returns 0 on success, -1 otherwise
+ */
+static int cached_file_pread(struct cached_file *fh, int type,
+			     void *value, size_t size)
+{
+	char buffer[FILE_VALUE_MAX];
+	ssize_t len;
+
+	len = pread(fh->fd, buffer, sizeof(buffer) - 1, 0);
+	if (len < 0) {
+		cached_file_close(fh);
+		return -1;
+	}
+
+	buffer[len] = '\0';
+
+	return parse_value(buffer, type, value, size);
+}
+
+/*
+ * This function is the cached version of file_read_value. The file
+ * is opened once and kept in the list of handles passed as parameter,
+ * the next reads are done with pread at the beginning of the file, so
+ * we don't have to lookup the path and open the file again.
+ *
+ * @handles : the list of the handles of the node
+ * @dirfd   : a file descriptor on the directory containing the file or -1
+ * @path    : directory path containing the file
+ * @name    : name of the file to be read
+ * @type    : the type of the value
+ * @value   : a pointer to a variable to store the content of the file
+ * @size    : the size of the variable pointed by value
+ * Returns 0 on success, -1 otherwise
+ */
+int file_read_cached(struct cached_file **handles, int dirfd,
+		     const char *path, const char *name,
+		     int type, void *value, size_t size)
+{
+	struct cached_file *fh;
+
+	fh = cached_file_get(handles, name);
+	if (!fh)
+		return -1;
+
+	if (cached_file_use(fh, dirfd, path))
+		return -1;
+
+	return cached_file_pread(fh, type, value, size);
+}
+
+/*
+ * Queue the read of an attribute file, the read is done and the value
+ * is stored when file_batch_submit is called, so the value pointer
+ * must stay valid until then.
+ *
+ * @handles : the list of the handles of the node
+ * @dirfd   : a file descriptor on the directory containing the file or -1
+ * @path    : directory path containing the file, must stay valid too
+ * @name    : name of the file to be read
+ * @type    : the type of the value
+ * @value   : a pointer to a variable to store the content of the file
+ * @size    : the size of the variable pointed by value
+ * Returns 0 on success, -1 otherwise
+ */
+int file_batch_value(struct cached_file **handles, int dirfd,
+		     const char *path, const char *name,
+		     int type, void *value, size_t size)
+{
+	struct file_batch *fb;
+
+	if (batch_nr == batch_size) {
+
+		fb = realloc(batch, sizeof(*batch) * (batch_size + FILE_BATCH));
+		if (!fb)
+			return -1;
+
+		batch = fb;
+		batch_size += FILE_BATCH;
+	}
+
+	fb = &batch[batch_nr];
+
+	fb->fh = cached_file_get(handles, name);
+	if (!fb->fh)
+		return -1;
+
+	fb->dirfd = dirfd;
+	fb->path = path;
+	fb->type = type;
+	fb->value = value;
+	fb->size = size;
+
+	batch_nr++;
+
+	return 0;
+}
+
+/*
+ * Completion callback of a batched read, the value is parsed in place
+ * in the buffer of the request.
+ */
+static void file_batch_complete(unsigned long long cookie, int res, void *data)
+{
+	struct file_batch *fb = &batch[cookie];
+	char *buffer = batch_buffers[cookie % FILE_BATCH];
+	int *nrerr = data;
+
+	fb->done = true;
+
+	/* the kernel does not know IORING_OP_READ, let's do it by hand */
+	if (res == -EINVAL || res == -EOPNOTSUPP) {
+		batch_uring = false;
+		if (cached_file_pread(fb->fh, fb->type, fb->value, fb->size))
+			(*nrerr)++;
+		return;
+	}
+
+	if (res < 0) {
+		cached_file_close(fb->fh);
+		(*nrerr)++;
+		return;
+	}
+
+	buffer[res] = '\0';
+
+	if (parse_value(buffer, fb->type, fb->value, fb->size))
+		(*nrerr)++;
+}
+
+/*
+ * Read all the attribute files queued with file_batch_value. When
+ * io_uring is available, the reads are sent to the kernel by chunks in
+ * a single system call, otherwise they are done one by one with pread.
+ *
+ * Returns the number of values which could not be read
+ */
+int file_batch_submit(void)
+{
+	struct file_batch *fb;
+	int i, first, chunk, nrerr = 0;
+
+	if (batch_uring && uring_init(FILE_BATCH))
+		batch_uring = false;
+
+	chunk = batch_nr;
+
+	if (batch_uring) {
+		/* do not let the cache close the files of the current chunk */
+		chunk = (cached_file_maxopen() - dir_nropen) / 2;
+		if (chunk > FILE_BATCH)
+			chunk = FILE_BATCH;
+		if (chunk > uring_size())
+			chunk = uring_size();
+		if (chunk < 1)
+			chunk = 1;
+	}
+
+	for (first = 0; first < batch_nr; first += chunk) {
+
+		for (i = first; i < batch_nr && i < first + chunk; i++) {
+
+			fb = &batch[i];
+			fb->done = true;
+
+			if (cached_file_use(fb->fh, fb->dirfd, fb->path)) {
+				nrerr++;
+				continue;
+			}
+
+			if (batch_uring &&
+			    !uring_prep_read(fb->fh->fd,
+					     batch_buffers[i % FILE_BATCH],
+					     FILE_VALUE_MAX - 1, 0, i)) {
+				fb->done = false;
+				continue;
+			}
+
+			if (cached_file_pread(fb->fh, fb->type, fb->value,
+					      fb->size))
+				nrerr++;
+		}
+
+		if (!batch_uring || !uring_submit(file_batch_complete, &nrerr))
+			continue;
+
+		/*
+		 * The completions of the chunk may be missing, the reads
+		 * not completed are done by hand and the late completions
+		 * are dropped with the instance
+		 */
+		batch_uring = false;
+		uring_exit();
+
+		for (i = first; i < batch_nr && i < first + chunk; i++) {
+
+			fb = &batch[i];
+			if (fb->done)
+				continue;
+
+			if (cached_file_pread(fb->fh, fb->type, fb->value,
+					      fb->size))
+				nrerr++;
+		}
+	}
+
+	batch_nr = 0;
+
+	return nrerr;
+}
+
+/*
+ * Close and free all the handles of a node.
+ *
+ * @handles : the list of the handles of the node
+ */
+void file_close_cached(struct cached_file **handles)
+{
+	struct cached_file *fh;
+
+	while (*handles) {
+		fh = *handles;
+		*handles = fh->next;
+		cached_file_close(fh);
+		free(fh);
+	}
+}
+
+/*
+ * Open a directory with O_PATH in order to use it as a base for the
+ * *at functions. The directory file descriptors can use up to the half
+ * of the file descriptors allowed for the cache, beyond that the
+ * callers have to fallback to the absolute path names.
+ *
+ * @dirfd : the directory the name is relative to, or AT_FDCWD
+ * @name  : the name of the directory to be opened
+ * Returns a file descriptor on success, -1 otherwise
+ */
+int file_opendir(int dirfd, const char *name)
+{
+	int fd;
+
+	if (dirfd < 0 && dirfd != AT_FDCWD)
+		return -1;
+
+	/* the trees can be browsed by several threads */
+	if (__atomic_add_fetch(&dir_nropen, 1, __ATOMIC_RELAXED) >
+	    cached_file_maxopen() / 2)
+		goto out_dec;
+
+	/* the directories and the cache share the same budget */
+	pthread_mutex_lock(&lru_lock);
+	while (lru_tail && lru_nropen +
+	       __atomic_load_n(&dir_nropen, __ATOMIC_RELAXED) >
+	       cached_file_maxopen())
+		cached_file_close(lru_tail);
+	pthread_mutex_unlock(&lru_lock);
+
+	fd = openat(dirfd, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		goto out_dec;
+
+	return fd;
+
+out_dec:
+	__atomic_sub_fetch(&dir_nropen, 1, __ATOMIC_RELAXED);
+	return -1;
+}
+
+/*
+ * Close a directory file descriptor opened with file_opendir.
+ *
+ * @fd : the file descriptor to be closed, ignored if -1
+ */
+void file_closedir(int fd)
+{
+	if (fd < 0)
+		return;
+
+	close(fd);
+	__atomic_sub_fetch(&dir_nropen, 1, __ATOMIC_RELAXED);
+}
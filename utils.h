@@ -16,10 +16,59 @@
 #ifndef __UTILS_H
 #define __UTILS_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Types of the values read from the attribute files
+ *
+ * VALUE_INT    : signed decimal integer stored in an int
+ * VALUE_HEX    : hexadecimal integer stored in an unsigned int
+ * VALUE_U64    : unsigned decimal integer stored in an uint64_t
+ * VALUE_STRING : first word of the file stored in a char array
+ */
+enum { VALUE_INT, VALUE_HEX, VALUE_U64, VALUE_STRING };
+
+/*
+ * Structure describing an attribute file kept opened between two reads
+ *
+ * next     : the next handle of the same node
+ * lru_prev : the previous handle in the least recently used list
+ * lru_next : the next handle in the least recently used list
+ * fd       : the file descriptor, -1 if the file is not opened
+ * name     : the name of the attribute file
+ */
+struct cached_file {
+	struct cached_file *next;
+	struct cached_file *lru_prev;
+	struct cached_file *lru_next;
+	int fd;
+	char name[];
+};
+
+extern int parse_u64(const char *s, uint64_t *value);
+extern int parse_int(const char *s, int *value);
+extern int parse_hex(const char *s, unsigned int *value);
+extern int parse_string(const char *s, char *value, size_t size);
+extern int parse_value(const char *s, int type, void *value, size_t size);
+
 extern int file_read_value(const char *path, const char *name,
-                           const char *format, void *value);
+			   int type, void *value, size_t size);
+extern int file_set_root(const char *root);
+extern int file_root_path(char *buf, size_t size, const char *path);
+extern int file_pread_value(int fd, int type, void *value, size_t size);
 extern int file_write_value(const char *path, const char *name,
                            const char *format, ...);
+extern int file_read_cached(struct cached_file **handles, int dirfd,
+			    const char *path, const char *name,
+			    int type, void *value, size_t size);
+extern void file_close_cached(struct cached_file **handles);
+extern int file_batch_value(struct cached_file **handles, int dirfd,
+			    const char *path, const char *name,
+			    int type, void *value, size_t size);
+extern int file_batch_submit(void);
+extern int file_opendir(int dirfd, const char *name);
+extern void file_closedir(int fd);
 
 
 #endif